@@ -9,6 +9,7 @@
  *   CSIMCD_INTR from a client fd causes sending its node PT_INTR.
  *   EOF from a client fd causes sending its node KILL.
  *   opens FOR_REBOOT broadcasts PT_REBOOT to all nodes and closes all clients.
+ *   opens FOR_VAR exchange binary frames sent as PT_GETVAR/PT_SETVAR packets.
  *   anything but PT_SHELL/ACK from a node: send message to fd then close.
  *   also listen for special LOGADR packets and log those.
  *   if we die for any reason we issue a network-wide reboot.
@@ -18,8 +19,14 @@
  * contact us. Being a token ring, only one node may transmit at a time. We
  * also serve as the token broker. The token is given in turn to each node
  * address (0..31) we have ever connected to. Then it is set to 32 which means
- * it is our turn to let our clients originate packets. We let each client
- * send up to one packet before we give up the token. Being token based,
+ * it is our turn to let our clients originate packets. Clients are served in
+ * order of their CSIPri class, round robin within each, and CTRL clients are
+ * served again before each further packet from the others. Each client may
+ * send up to its class burst of packets before we give up the token, but once
+ * a CTRL packet has been sent only CTRLSHARE more go from all the others, so
+ * the node gets the token to answer it sooner. So that busy CTRL clients do
+ * not starve BULK, anyone kept waiting STARVEMS goes next. SIGUSR1 logs the
+ * queue depth and wait of each class. Being token based,
  * all packets originating here are synchronous, so we can just wait around
  * for their ACK, making the code read more linearly. When a new connection
  * is made to us, we Ping the new target node to confirm it is alive hence we
@@ -27,11 +34,27 @@
  * (our clients) at any time though so we must always be listening to the LAN
  * tty connection.
  *
+ * Nodes given WINDOWn > 1 in the config file may have that many shell, boot
+ * or serial packets outstanding from one client at a time. We send them back
+ * to back, collect an ACK for each by its sequence and resend only those not
+ * acked. Such a node must accept any packet within WINDOWn of the last it
+ * delivered, deliver them in sequence order and ACK every one, dups too.
+ * All other nodes and packets get stop-and-wait as ever.
+ *
+ * We time how long each node takes to ACK and to hand back an idle token,
+ * and once we know, wait RTTMULT times that rather than the full ACKWT and
+ * TOKWT, doubling after each miss. With IDLESKIP > 0, while clients are
+ * waiting or some node owes a reply, we pass over nodes which had nothing to
+ * say for their last few tokens and owe none, for up to IDLESKIP rings in a
+ * row.
  */
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +64,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "configfile.h"
@@ -50,10 +74,20 @@
 #include "telenv.h"
 
 #define SPEED B38400 /* cflag for tty speed */
+#define INBUFSZ 4096 /* most bytes taken from tty per read */
 #define MAXV 5       /* max verbose */
 #define SOPWAIT 50   /* socket open wait time, secs */
 
 #define TOKWT 5000 /* ms to wait for token back */
+#define DEFBURST 4  /* default packets per client per token, see burst[] */
+#define CTRLSHARE 1 /* non-CTRL packets per token once a CTRL packet is sent */
+#define STARVEMS 1000 /* non-CTRL clients waiting this long go before the rest */
+#define WINMAX 8      /* max WINDOWn, half the sequence numbers */
+#define WINGAPMS 2    /* ms to wait for a client's next packet to fill a window */
+#define NRTTLEARN 4   /* samples before we trust an RTT estimate */
+#define IDLEVISITS 2  /* idle tokens before a node may be passed over */
+#define WIREMS(n) ((n)*10000.0 / ttybaud) /* ms to send n bytes on the tty */
+#define VARTRY 2   /* tries for a GETVAR/SETVAR ACK, see sendVarXpkt() */
 
 typedef struct
 {
@@ -62,14 +96,44 @@ typedef struct
     int cfd;        /* client fd, if cfdset */
     int toaddr;     /* node address */
     OpenWhy why;    /* goal of connect */
+    CSIPri pri;     /* service class */
+    int ready;      /* set while cfd has something for us */
+    double readyms; /* when first seen ready, msNow() */
 } CInfo;
 
+/* scheduler metrics for one CSIPri class */
+typedef struct
+{
+    long npkts;      /* packets sent for clients */
+    long nvisits;    /* token visits with any of its clients ready */
+    long depthsum;   /* sum of ready clients found each such visit */
+    int maxdepth;    /* most ready clients found at one visit */
+    double waitsum;  /* sum of ms from ready until each packet was sent */
+    double maxwait;  /* longest ms from ready until a packet was sent */
+} PriStats;
+
+/* token and ACK timing for one node */
+typedef struct
+{
+    double toksrtt, tokvar; /* smoothed ms to start answering the token, and its deviation */
+    double acksrtt, ackvar; /* smoothed ms to ACK, less wire time, and its deviation */
+    int ntok, nack;         /* samples in each, up to NRTTLEARN */
+    int tokbackoff;         /* times in a row the token was not handed back */
+    int idle;               /* tokens in a row with which it sent nothing */
+    int owed;               /* set when we sent it a packet since its last token, so it may owe a reply */
+    int skipped;            /* rings in a row it has been passed over */
+    long nskips;            /* total times passed over */
+    long ntoklost;          /* total tokens not handed back */
+} NodeTime;
+
 static void usage(char *me);
 static void initCfg(void);
 static int selectI(int n, fd_set *rp, fd_set *wp, fd_set *xp, struct timeval *tp);
 static size_t readI(int fd, void *buf, size_t n);
+static int readN(int fd, void *buf, int n);
 static size_t writeI(int fd, const void *buf, size_t n);
 static void openTTY(void);
+static int speed2baud(speed_t speed);
 static void announce(void);
 static void mainLoop(void);
 static void initPty(void);
@@ -77,14 +141,35 @@ static void openPty(char pty[], int addr, int baud);
 static void reopenPty(int cfd);
 static void advanceToken(void);
 static void checkClients(void);
+static int serveClass(CSIPri pri, int n);
+static int serveClient(CInfo *cip, int n);
+static int isReady(int fd, int ms);
+static int clientWindow(CInfo *cip, int n);
+static int buildXPkt(int cfd);
+static int sendWindow(int nw);
+static int ack4wpkt(int nw);
+static void restartNode(int to);
+static int skipNode(int a, int waiting);
+static int clientsWaiting(void);
+static void rttSample(double *srttp, double *varp, int *np, double ms);
+static int tokTimeout(int a);
+static int ackTimeout(int to, int nbytes, int try, int nlearn);
+static double msNow(void);
+static void logStats(void);
+static void onStatsSig(int dummy);
+static char *pri2str(CSIPri pri);
 static void wait4TokenBack(void);
 static void newClient();
 static void newShell(CInfo *cip);
 static void newReboot(CInfo *cip);
 static void newBoot(CInfo *cip);
 static void newSerial(CInfo *cip, int baud);
+static void newVar(CInfo *cip);
 static int sendConfirmPing(CInfo *cip);
-static int readLANpacket(char *what, int nto, int from);
+static int readLAN(int ms);
+static int checkFrame(Byte f[], int have);
+static int decodeLAN(void);
+static int readLANpacket(char *what, int ms, int from);
 static void rpktDispatch(void);
 
 static void initCInfo(void);
@@ -94,10 +179,16 @@ static void buildCtrlPkt(int from, int to, PktType t);
 static void sendPkt(Byte pkt[], int retry);
 static void sendCurToken(void);
 static int chkSum(Byte p[], int n);
+static int escData(Byte dst[], Byte src[], int n);
+static int unescData(Byte dst[], Byte src[], int n);
 static void clientMsg(int fd);
 static int buildShellXPkt(int fd);
 static int buildSerialXPkt(int fd);
 static int buildBootXPkt(int fd);
+static void varMsg(int cfd);
+static int sendVarXpkt(void);
+static int varXpkt(int haddr, int toaddr, int t, Byte req[], int len);
+static int probeVar(int ha, int to);
 static void closecfd(int cfd);
 static void breakAllConnections(void);
 static void breakConnections(int to);
@@ -123,15 +214,38 @@ static fd_set clset;            /* each client fd. host addr = fd + MAXNA */
 static int maxclset = -1;       /* largest fd set in clset, -1 if empty */
 static int listenfd;            /* universal listening post */
 static int ttyfd;               /* tty fd once open */
-static Byte rpkt[PMXLEN];       /* packet being received from CSIMC network */
-static int rpktlen;             /* bytes in packet received so far */
+static int ttybaud;             /* tty bits/sec once open, from SPEED */
+static Byte inbuf[INBUFSZ];     /* bytes read from CSIMC network */
+static int inlen, inpos;        /* bytes in inbuf, and next to decode */
+static Byte pktbuf[PMXLEN];     /* packet split across reads, so far */
+static int rpktlen;             /* bytes in pktbuf so far */
+static Byte *rpkt = pktbuf;     /* last packet from network, in inbuf or pktbuf */
 static Byte rseq[NADDR][NADDR]; /* seq of last rx packet acked, [fr][to] */
 static Byte xpkt[PMXLEN];       /* packet being transmitted to CSIMC network */
 static Byte xseq[NADDR];        /* sequence for next tx packet, per net addr. */
 static int verbose;             /* higher to log more details, up to MAXV */
 static int mflag;               /* do not lock.. allow multiple instances */
 static char livenodes[NNODES];  /* set as discover each node */
+static signed char varsup[NNODES]; /* 1 if node acks GETVAR/SETVAR, -1 if not, 0 until probed */
+static int window[NNODES];      /* packets each node may have unacked, WINDOWn */
+static Byte wpkt[WINMAX][PMXLEN]; /* window of packets being sent to one node */
+static long nwinpkts, nwinresent; /* packets sent in windows, and resent */
+static NodeTime nodetime[NNODES]; /* token and ACK timing per node */
+static int idleskip;              /* IDLESKIP: most rings an idle node is passed over */
+static int rttmult = 4;           /* RTTMULT: timeouts are this many RTTs.. */
+static int tokminms = 20;         /* TOKMINMS: .. but at least this for a token */
+static int ackminms = 10;         /* ACKMINMS: .. and at least this for an ACK */
+static double toksentms;          /* msNow() when the token was last sent */
+static int sawbroktok;            /* set when readLANpacket() saw BROKTOK */
 static int curtoken = BROKTOK;  /* current token */
+static int burst[CSI_NPRI] = {0, DEFBURST, DEFBURST, DEFBURST}; /* packets per client per token */
+static PriStats pristats[CSI_NPRI];   /* scheduler metrics per class */
+static int rrnext[CSI_NPRI];          /* cinfo[] index to serve first next, per class */
+static int othersleft;                /* non-CTRL packets still allowed this visit */
+static long ntokvisits;               /* times we have had the token */
+static double tokms, maxtokms;        /* sum and most ms between our tokens */
+static double lasttokms;              /* msNow() when we last had the token */
+static volatile int statsflag;        /* set by SIGUSR1 to log stats */
 
 /* connection info and handle conversions.
  * N.B. host address is index into cinfo[] biased by NNODES.
@@ -204,6 +318,7 @@ int main(int ac, char *av[])
     /* a few signal issues */
     signal(SIGPIPE, SIG_IGN);
     signal(SIGHUP, onVerboseSig);
+    signal(SIGUSR1, onStatsSig);
     signal(SIGTERM, onBye);
     signal(SIGINT, onBye);
     signal(SIGQUIT, onBye);
@@ -236,6 +351,7 @@ static void usage(char *me)
     fprintf(stderr, " -m      allow multiple instances for multiple LANs\n");
     fprintf(stderr, " -t tty  alternate <tty>. default is %s\n", tty_def);
     fprintf(stderr, " -v      verbose; up to %d; SIGHUP also bumps\n", MAXV);
+    fprintf(stderr, "           SIGUSR1 logs scheduler stats\n");
     fprintf(stderr, "           0: always show errors..\n");
     fprintf(stderr, "           1: plus basic actions..\n");
     fprintf(stderr, "           2: plus packet contents.. \n");
@@ -263,8 +379,43 @@ ptt(int on)
 /* read config file, if any */
 static void initCfg(void)
 {
+    int i;
+
     read1CfgEntry(1, cfg, "TTY", CFG_STR, tty_def, sizeof(tty_def));
     read1CfgEntry(1, cfg, "PORT", CFG_INT, &port, 0);
+
+    /* optional packets per client per token, by class */
+    read1CfgEntry(1, cfg, "CTRLBURST", CFG_INT, &burst[CSI_PRI_CTRL], 0);
+    read1CfgEntry(1, cfg, "SHELLBURST", CFG_INT, &burst[CSI_PRI_SHELL], 0);
+    read1CfgEntry(1, cfg, "BULKBURST", CFG_INT, &burst[CSI_PRI_BULK], 0);
+    for (i = CSI_PRI_CTRL; i < CSI_NPRI; i++)
+        if (burst[i] < 1)
+            burst[i] = 1;
+
+    /* optional token visit policy and timeouts */
+    read1CfgEntry(1, cfg, "IDLESKIP", CFG_INT, &idleskip, 0);
+    read1CfgEntry(1, cfg, "RTTMULT", CFG_INT, &rttmult, 0);
+    read1CfgEntry(1, cfg, "TOKMINMS", CFG_INT, &tokminms, 0);
+    read1CfgEntry(1, cfg, "ACKMINMS", CFG_INT, &ackminms, 0);
+    if (rttmult < 1)
+        rttmult = 1;
+
+    /* optional window size per node, default is stop-and-wait */
+    for (i = 0; i < NNODES; i++)
+    {
+        char name[32];
+
+        window[i] = 1;
+        sprintf(name, "WINDOW%d", i);
+        if (!read1CfgEntry(0, cfg, name, CFG_INT, &window[i], 0))
+        {
+            if (window[i] < 1)
+                window[i] = 1;
+            if (window[i] > WINMAX)
+                window[i] = WINMAX;
+            daemonLog("Node %d window is %d packets\n", i, window[i]);
+        }
+    }
 }
 
 /* read the config file and set up any serial entries.
@@ -349,6 +500,8 @@ static void openPty(char pty[], int toaddr, int baud)
     cip->cfd = cfd;
     cip->toaddr = toaddr;
     cip->why = FOR_SERIAL;
+    cip->pri = CSI_PRI_BULK;
+    cip->ready = 0;
     rseq[toaddr][CFD2HA(cfd)] = -1;
     livenodes[toaddr] = 1; /* insure it gets a token */
     if (sendBaud(cfd, baud) < 0)
@@ -464,6 +617,23 @@ static size_t readI(int fd, void *buf, size_t n)
     return (s);
 }
 
+/* read exactly n bytes unless EOF or error.
+ * return n, 0 if EOF else -1.
+ */
+static int readN(int fd, void *buf, int n)
+{
+    int s, got;
+
+    for (got = 0; got < n; got += s)
+    {
+        s = readI(fd, (Byte *)buf + got, n - got);
+        if (s <= 0)
+            return (s);
+    }
+
+    return (n);
+}
+
 /* just like write(2) but retries if interrupted */
 static size_t writeI(int fd, const void *buf, size_t n)
 {
@@ -490,8 +660,8 @@ static void openTTY()
     memset(&tio, 0, sizeof(tio));
     tio.c_cflag = CS8 | CREAD | CLOCAL;
     tio.c_iflag = IGNPAR | IGNBRK;
-    tio.c_cc[VMIN] = 0;            /* start timer when call read() */
-    tio.c_cc[VTIME] = ACKWT / 100; /* wait up to n 1/10ths seconds */
+    tio.c_cc[VMIN] = 0;  /* read() returns what there is.. */
+    tio.c_cc[VTIME] = 0; /* .. at once; readLAN() waits in poll() */
     cfsetospeed(&tio, SPEED);
     cfsetispeed(&tio, SPEED);
     if (tcsetattr(ttyfd, TCSANOW, &tio) < 0)
@@ -500,7 +670,34 @@ static void openTTY()
         exit(1);
     }
 
-    daemonLog("CSIMC network %s on fd %d\n", tty, ttyfd);
+    /* the rate the line really runs at, for the time packets spend on it */
+    if (tcgetattr(ttyfd, &tio) < 0 || (ttybaud = speed2baud(cfgetospeed(&tio))) == 0)
+        ttybaud = speed2baud(SPEED);
+    if (ttybaud == 0)
+    {
+        daemonLog("%s: unknown SPEED\n", tty);
+        exit(1);
+    }
+
+    daemonLog("CSIMC network %s on fd %d at %d baud\n", tty, ttyfd, ttybaud);
+}
+
+/* return bits/sec for the termios speed, else 0 if not known */
+static int speed2baud(speed_t speed)
+{
+    switch (speed)
+    {
+    case B1200: return (1200);
+    case B2400: return (2400);
+    case B4800: return (4800);
+    case B9600: return (9600);
+    case B19200: return (19200);
+    case B38400: return (38400);
+    case B57600: return (57600);
+    case B115200: return (115200);
+    case B230400: return (230400);
+    default: return (0);
+    }
 }
 
 /* create listenfd, on this host at the given port */
@@ -544,6 +741,12 @@ static void announce()
  */
 static void mainLoop()
 {
+    if (statsflag)
+    {
+        statsflag = 0;
+        logStats();
+    }
+
     advanceToken();
     if (isOurToken())
     {
@@ -564,30 +767,139 @@ static void mainLoop()
 static void advanceToken(void)
 {
     int a = tok2addr(curtoken);
+    int waiting = 0;
+    int i;
+
+    /* anyone in a hurry? */
+    if (idleskip > 0)
+    {
+        for (i = 0; i < NNODES && !waiting; i++)
+            waiting = livenodes[i] && nodetime[i].owed;
+        if (!waiting)
+            waiting = clientsWaiting();
+    }
 
     do
     {
         a = (a + 1) % (NNODES + 1); /* yes .. NNODES means us */
-    } while (a != NNODES && !livenodes[a]);
+    } while (a != NNODES && (!livenodes[a] || skipNode(a, waiting)));
 
     curtoken = addr2tok(a);
 }
 
+/* return 1 if live node a may be passed over this ring, else 0.
+ * waiting is set if any client has something for us or any node owes a reply.
+ */
+static int skipNode(int a, int waiting)
+{
+    NodeTime *ntp = &nodetime[a];
+
+    if (!waiting || ntp->owed || ntp->idle < IDLEVISITS || ntp->skipped >= idleskip)
+        return (0);
+
+    if (verbose > 3)
+        daemonLog("Passing over idle node %d\n", a);
+    ntp->skipped++;
+    ntp->nskips++;
+    return (1);
+}
+
+/* return 1 if any client has something for us now, else 0 */
+static int clientsWaiting()
+{
+    struct timeval tv;
+    fd_set fs;
+
+    if (maxclset < 0)
+        return (0);
+    fs = clset;
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    return (selectI(maxclset + 1, &fs, NULL, NULL, &tv) > 0);
+}
+
+/* fold a new round trip of ms into *srttp and *varp, as TCP does */
+static void rttSample(double *srttp, double *varp, int *np, double ms)
+{
+    if (ms < 0)
+        ms = 0;
+    if ((*np)++ == 0)
+    {
+        *srttp = ms;
+        *varp = ms / 2;
+    }
+    else
+    {
+        double err = ms - *srttp;
+
+        *srttp += err / 8;
+        *varp += (fabs(err) - *varp) / 4;
+    }
+    if (*np > NRTTLEARN)
+        *np = NRTTLEARN;
+}
+
+/* ms to wait for node a to hand back the token */
+static int tokTimeout(int a)
+{
+    NodeTime *ntp = &nodetime[a];
+    double ms;
+
+    if (ntp->ntok < NRTTLEARN)
+        return (TOKWT);
+    ms = rttmult * ntp->toksrtt + 4 * ntp->tokvar;
+    if (ms < tokminms)
+        ms = tokminms;
+    ms *= 1 << MIN(ntp->tokbackoff, 8);
+    return (ms < TOKWT ? (int)ms : TOKWT);
+}
+
+/* ms to wait for an ACK from node to after sending it nbytes, on the
+ * given retry, once nlearn samples of its RTT are in hand.
+ */
+static int ackTimeout(int to, int nbytes, int try, int nlearn)
+{
+    NodeTime *ntp = &nodetime[to];
+    double ms;
+
+    if (to > MAXNA || ntp->nack < nlearn)
+        return (ACKWT);
+    ms = WIREMS(nbytes + PB_NZHSZ + 2 * VARVSZ) + rttmult * ntp->acksrtt + 4 * ntp->ackvar;
+    if (ms < ackminms)
+        ms = ackminms;
+    ms *= 1 << MIN(try, 8);
+    return (ms < ACKWT ? (int)ms : ACKWT);
+}
+
 /* for each new client wanting to connect
  *   check that target has indeed been booted
  *   send PING; wait for ACK; repeat as required; handle
- * for each existing client wanting to send
- *   read one packet's worth
- *   send packet; wait for ACK; repeat as required; handle
+ * for each existing client wanting to send, by class
+ *   read up to its burst of packets
+ *   send each packet; wait for ACK; repeat as required; handle
  */
 static void checkClients(void)
 {
+    int depth[CSI_NPRI];
     struct timeval tv;
+    CInfo *cip;
+    double now;
     fd_set fs;
     int maxfs;
     int fd;
     int n;
 
+    /* how long the token took to come back */
+    now = msNow();
+    if (ntokvisits++ > 0)
+    {
+        tokms += now - lasttokms;
+        if (now - lasttokms > maxtokms)
+            maxtokms = now - lasttokms;
+    }
+    lasttokms = now;
+    othersleft = INT_MAX; /* until a CTRL packet is sent */
+
     /* make copy so we can add listenfd */
     fs = clset;
     maxfs = maxclset;
@@ -607,17 +919,203 @@ static void checkClients(void)
         return;
     }
 
-    /* handle the actions -- some may change clset */
-    for (fd = 0; n > 0 && fd <= maxfs; fd++)
+    /* note who is waiting, and since when */
+    now = msNow();
+    memset(depth, 0, sizeof(depth));
+    for (cip = cinfo; cip < &cinfo[NHOSTS]; cip++)
     {
-        if (FD_ISSET(fd, &fs))
+        if (!cip->inuse || !cip->cfdset)
+            continue;
+        fd = cip->cfd;
+        if (!FD_ISSET(fd, &fs) || !FD_ISSET(fd, &clset))
+            continue;
+        if (!cip->ready)
         {
-            if (fd == listenfd)
-                newClient();
-            else if (FD_ISSET(fd, &clset))
-                clientMsg(fd);
-            --n;
+            cip->ready = 1;
+            cip->readyms = now;
         }
+        depth[cip->pri]++;
+    }
+    for (n = CSI_PRI_CTRL; n < CSI_NPRI; n++)
+    {
+        PriStats *psp = &pristats[n];
+
+        if (depth[n] == 0)
+            continue;
+        psp->nvisits++;
+        psp->depthsum += depth[n];
+        if (depth[n] > psp->maxdepth)
+            psp->maxdepth = depth[n];
+    }
+
+    /* serve the waiting clients, most important first, save any starving */
+    if (depth[CSI_PRI_CTRL])
+        (void)serveClass(CSI_PRI_CTRL, depth[CSI_PRI_CTRL]);
+    for (cip = cinfo; cip < &cinfo[NHOSTS] && othersleft > 0; cip++)
+        if (cip->inuse && cip->ready && cip->pri != CSI_PRI_CTRL && now - cip->readyms > STARVEMS)
+            (void)serveClient(cip, 1);
+    for (n = CSI_PRI_CTRL + 1; n < CSI_NPRI; n++)
+        if (depth[n])
+            (void)serveClass(n, depth[n]);
+
+    /* then any new connections */
+    if (FD_ISSET(listenfd, &fs))
+        newClient();
+}
+
+/* give each of the up to n ready clients of class pri their burst of
+ * packets, round robin, while othersleft allows.
+ * return number of packets sent.
+ */
+static int serveClass(CSIPri pri, int n)
+{
+    int i0 = rrnext[pri];
+    int nsent = 0;
+    int i;
+
+    for (i = 0; i < NHOSTS && n > 0; i++)
+    {
+        CInfo *cip = &cinfo[(i0 + i) % NHOSTS];
+
+        if (!cip->inuse || !cip->ready || cip->pri != pri)
+            continue;
+        if (pri != CSI_PRI_CTRL && othersleft <= 0)
+            break; /* next visit starts with this one */
+        rrnext[pri] = (i0 + i + 1) % NHOSTS;
+        nsent += serveClient(cip, burst[pri]);
+        n--;
+    }
+
+    return (nsent);
+}
+
+/* send up to n packets from the ready client cip, letting any ready CTRL
+ * clients go again before each after the first.
+ * return number of packets sent.
+ */
+static int serveClient(CInfo *cip, int n)
+{
+    PriStats *psp = &pristats[cip->pri];
+    int cfd = cip->cfd;
+    int nsent = 0;
+
+    while (1)
+    {
+        double wait = msNow() - cip->readyms;
+        int k;
+
+        if (window[cip->toaddr] > 1 && cip->why != FOR_VAR)
+            k = clientWindow(cip, cip->pri == CSI_PRI_CTRL ? n - nsent : MIN(n - nsent, othersleft));
+        else
+        {
+            clientMsg(cfd);
+            k = 1;
+        }
+        nsent += k;
+        psp->npkts += k;
+        psp->waitsum += k * wait;
+        if (wait > psp->maxwait)
+            psp->maxwait = wait;
+        if (cip->pri == CSI_PRI_CTRL)
+            othersleft = MIN(othersleft, CTRLSHARE);
+        else
+            othersleft -= k;
+
+        /* client may have gone, or have no more for now */
+        if (!cip->inuse || cip->cfd != cfd)
+            break;
+        if (!isReady(cfd, 0))
+        {
+            cip->ready = 0;
+            break;
+        }
+        cip->readyms = msNow();
+        if (nsent >= n || (cip->pri != CSI_PRI_CTRL && othersleft <= 0))
+            break;
+
+        /* control traffic may not wait behind a burst */
+        if (cip->pri != CSI_PRI_CTRL)
+        {
+            CInfo *ccip;
+            int nctrl = 0;
+
+            for (ccip = cinfo; ccip < &cinfo[NHOSTS]; ccip++)
+            {
+                if (ccip->inuse && ccip->cfdset && ccip->pri == CSI_PRI_CTRL && !ccip->ready &&
+                    isReady(ccip->cfd, 0))
+                {
+                    ccip->ready = 1;
+                    ccip->readyms = msNow();
+                }
+                if (ccip->inuse && ccip->ready && ccip->pri == CSI_PRI_CTRL)
+                    nctrl++;
+            }
+            if (nctrl)
+            {
+                (void)serveClass(CSI_PRI_CTRL, nctrl);
+                if (!cip->inuse || cip->cfd != cfd || othersleft <= 0)
+                    break;
+            }
+        }
+    }
+
+    return (nsent);
+}
+
+/* return 1 if fd has something for us to read within ms, else 0 */
+static int isReady(int fd, int ms)
+{
+    struct timeval tv;
+    fd_set fs;
+
+    FD_ZERO(&fs);
+    FD_SET(fd, &fs);
+    tv.tv_sec = 0;
+    tv.tv_usec = ms * 1000;
+    return (selectI(fd + 1, &fs, NULL, NULL, &tv) > 0);
+}
+
+/* return a monotonic time in ms */
+static double msNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6);
+}
+
+/* log the scheduler metrics so far */
+static void logStats()
+{
+    int i;
+
+    daemonLog("Token back to us %ld times, mean %.1f max %.1f ms\n", ntokvisits,
+              ntokvisits > 1 ? tokms / (ntokvisits - 1) : 0.0, maxtokms);
+    for (i = CSI_PRI_CTRL; i < CSI_NPRI; i++)
+    {
+        PriStats *psp = &pristats[i];
+        CInfo *cip;
+        int nclients = 0;
+
+        for (cip = cinfo; cip < &cinfo[NHOSTS]; cip++)
+            if (cip->inuse && (int)cip->pri == i)
+                nclients++;
+
+        daemonLog("%5s: %d clients, burst %d, %ld pkts, depth mean %.2f max %d, wait mean %.1f max %.1f ms\n",
+                  pri2str(i), nclients, burst[i], psp->npkts, psp->nvisits ? (double)psp->depthsum / psp->nvisits : 0.0,
+                  psp->maxdepth, psp->npkts ? psp->waitsum / psp->npkts : 0.0, psp->maxwait);
+    }
+    if (nwinpkts)
+        daemonLog("Window: %ld pkts, %ld resent\n", nwinpkts, nwinresent);
+    for (i = 0; i < NNODES; i++)
+    {
+        NodeTime *ntp = &nodetime[i];
+
+        if (!livenodes[i])
+            continue;
+        daemonLog("Node %2d: token rtt %.1f+-%.1f wait %d ms, ack rtt %.1f+-%.1f wait %d ms, %ld lost, %ld passed\n",
+                  i, ntp->toksrtt, ntp->tokvar, tokTimeout(i), ntp->acksrtt, ntp->ackvar,
+                  ackTimeout(i, PMXLEN, 0, NRTTLEARN), ntp->ntoklost, ntp->nskips);
     }
 }
 
@@ -627,8 +1125,35 @@ static void checkClients(void)
  */
 static void wait4TokenBack(void)
 {
-    while (!readLANpacket("BROKTOK back", TOKWT / ACKWT, tok2addr(curtoken)))
+    int a = tok2addr(curtoken);
+    NodeTime *ntp = &nodetime[a];
+    int npkts = 0;
+    int got;
+
+    while (!(got = readLANpacket("BROKTOK back", tokTimeout(a), a)) || sawbroktok)
+    {
+        /* how quick the node is is how soon it starts to answer */
+        if (npkts++ == 0)
+            rttSample(&ntp->toksrtt, &ntp->tokvar, &ntp->ntok,
+                      msNow() - toksentms - WIREMS(got ? 2 : pktSize(rpkt)));
+        if (got)
+            break;
         rpktDispatch();
+    }
+
+    if (sawbroktok)
+    {
+        ntp->tokbackoff = 0;
+        npkts--; /* BROKTOK itself */
+    }
+    else
+    {
+        ntp->tokbackoff++;
+        ntp->ntoklost++;
+    }
+    ntp->idle = npkts ? 0 : ntp->idle + 1;
+    ntp->owed = 0;
+    ntp->skipped = 0;
 }
 
 /* a new client just arrived on listenfd.
@@ -644,6 +1169,7 @@ static void newClient()
     OpenWhy why;
     int newcfd;
     Byte to;
+    int pri;
     int n;
 
     /* accept the new connection */
@@ -702,6 +1228,12 @@ static void newClient()
     cip->cfd = newcfd;
     cip->toaddr = to;
     cip->why = why;
+    cip->ready = 0;
+    pri = preamble[2];
+    if (why == FOR_SHELL || why == FOR_VAR)
+        cip->pri = pri > (int)CSI_PRI_DEFAULT && pri < (int)CSI_NPRI ? (CSIPri)pri : CSI_PRI_SHELL;
+    else
+        cip->pri = CSI_PRI_BULK;
 
     switch (why)
     {
@@ -717,6 +1249,9 @@ static void newClient()
     case FOR_SERIAL:
         newSerial(cip, 300 * preamble[2]); /* 3rd is baud/300 */
         break;
+    case FOR_VAR:
+        newVar(cip);
+        break;
     default:
         daemonLog("Unknown preamble 'Why' to %d: %d\n", to, why);
         closecfd(newcfd);
@@ -737,7 +1272,7 @@ static void newShell(CInfo *cip)
     if (sendConfirmPing(cip) < 0)
         return; /* already closed + logged */
     if (verbose)
-        daemonLog("New Shell client accepted: fd %d host %d node %d\n", newcfd, ha, to);
+        daemonLog("New Shell client accepted: fd %d host %d node %d %s\n", newcfd, ha, to, pri2str(cip->pri));
 }
 
 /* send a PT_REBOOT to all nodes */
@@ -832,6 +1367,24 @@ static void newSerial(CInfo *cip, int baud)
         daemonLog("New Serial client accepted: fd %d host %d node %d\n", newcfd, ha, to);
 }
 
+/* create a new binary variable connection */
+static void newVar(CInfo *cip)
+{
+    int newcfd = cip->cfd;
+    int ha = CIP2HA(cip);
+    int to = cip->toaddr;
+
+    if (verbose)
+        daemonLog("New Var client request: fd %d host %d node %d\n", newcfd, ha, to);
+
+    if (sendConfirmPing(cip) < 0)
+        return; /* already closed + logged */
+    probeVar(ha, to);
+    if (verbose)
+        daemonLog("New Var client accepted: fd %d host %d node %d%s\n", newcfd, ha, to,
+                  varsup[to] < 0 ? " (no GETVAR/SETVAR)" : "");
+}
+
 /* send a PING to cip's to from ha.
  * if ok add to clset, tell client and add to livenodes[].
  * return 0 if ok, else -1.
@@ -863,6 +1416,12 @@ static int sendConfirmPing(CInfo *cip)
         return (-1);
     }
 
+    /* new firmware may have been booted since last seen */
+    if (!livenodes[to])
+    {
+        varsup[to] = 0;
+        memset(&nodetime[to], 0, sizeof(nodetime[to]));
+    }
     livenodes[to] = 1;
 
     return (0);
@@ -874,27 +1433,39 @@ static int isTokPkt(Byte buf[2])
     return (buf[0] == PSYNC && (buf[1] == BROKTOK || ISNTOK(buf[1])));
 }
 
-/* read the next char from the lan.
- * return 0 if ok else -1 if time out after nto tries
+/* read whatever has arrived from the lan into inbuf[], waiting up to ms
+ * for the first of it. only called once the decoder has used all of inbuf.
+ * return 0 if ok else -1 if nothing arrives within ms.
  */
-static int readLANchar(int nto, Byte *bp)
+static int readLAN(int ms)
 {
-    static Byte inbuf[100];
-    static int lastsent, ninbuf;
+    double end = msNow() + ms;
 
-    /* pull from inbuf first */
-    if (lastsent < ninbuf)
+    while (1)
     {
-        *bp = inbuf[lastsent++];
-        return (0);
-    }
+        struct pollfd pfd;
+        int left = (int)ceil(end - msNow());
+        int n;
 
-    /* then try to read more, up to nto times */
-    while (nto-- > 0)
-    {
-        int n = readI(ttyfd, inbuf, sizeof(inbuf));
+        if (left < 0)
+            return (-1);
+        pfd.fd = ttyfd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, left) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            daemonLog("poll(%s): %s\n", tty, strerror(errno));
+            exit(1);
+        }
+        if (!pfd.revents)
+            continue;
+
+        n = read(ttyfd, inbuf, sizeof(inbuf));
         if (n < 0)
         {
+            if (errno == EINTR)
+                continue;
             daemonLog("Read(%s): %s\n", tty, strerror(errno));
             exit(1);
         }
@@ -906,126 +1477,182 @@ static int readLANchar(int nto, Byte *bp)
                 daemonLog("Read %d from %s.. rpktlen now %d\n", n, tty, rpktlen);
                 dump(inbuf, n);
             }
-            ninbuf = n;
-            lastsent = 0;
-            return (readLANchar(nto, bp));
+            inlen = n;
+            inpos = 0;
+            return (0);
         }
     }
+}
 
-    /* nothing */
-    return (-1);
+/* look at the have bytes at f, which start with PSYNC.
+ * return the length of a good packet or BROKTOK there, 0 if we can not
+ * tell until more arrive, else -n to skip n bytes before looking again.
+ */
+static int checkFrame(Byte f[], int have)
+{
+    Byte *sync;
+    int len, n;
+
+    if (have < 2)
+        return (0);
+
+    /* a token is just SYNC and the address; other nodes' we ignore */
+    if (f[1] == BROKTOK)
+        return (2);
+    if (ISNTOK(f[1]))
+        return (-2);
+
+    /* SYNC is never in a good packet but its first byte so another always
+     * starts over, without complaint unless we already found it bad.
+     */
+    if ((sync = memchr(f + 1, PSYNC, MIN(have, PB_COUNT + 1) - 1)))
+        return (-(sync - f));
+    if (have > PB_COUNT && f[PB_COUNT] > PMXDAT)
+    {
+        daemonLog("Preposterous data count: %d\n", f[PB_COUNT]);
+        dump(f, PB_COUNT + 1);
+        return (-(int)(PB_COUNT + 1));
+    }
+    if ((sync = memchr(f + 1, PSYNC, MIN(have, PB_HSZ) - 1)))
+        return (-(sync - f));
+    if (have < PB_HSZ)
+        return (0);
+    if ((n = chkSum(f, PB_NHCHK)) != f[PB_HCHK])
+    {
+        daemonLog("Bad header chksum: 0x%02x vs 0x%02x\n", n, f[PB_HCHK]);
+        dump(f, PB_HSZ);
+        return (-(int)PB_HSZ);
+    }
+    len = f[PB_COUNT] ? PB_NZHSZ + f[PB_COUNT] : PB_HSZ;
+    if ((sync = memchr(f + PB_HSZ, PSYNC, MAX(MIN(have, len) - (int)PB_HSZ, 0))))
+        return (-(sync - f));
+    if (have < len)
+        return (0);
+    if (len > PB_HSZ && (n = chkSum(f + PB_DATA, f[PB_COUNT])) != f[PB_DCHK])
+    {
+        daemonLog("Bad data chksum from %d: 0x%02x vs 0x%02x\n", f[PB_FR], n, f[PB_DCHK]);
+        dump(f, len);
+        return (-len);
+    }
+
+    return (len);
+}
+
+/* decode the next packet or BROKTOK from what remains in inbuf.
+ * a packet wholly within inbuf is left there with rpkt pointing to it;
+ * one split across reads is gathered in pktbuf, rpktlen bytes so far.
+ * return 1 if rpkt is a new packet, 2 if BROKTOK, 0 if inbuf is used up.
+ */
+static int decodeLAN()
+{
+    while (1)
+    {
+        Byte *f;
+        int r;
+
+        if (rpktlen > 0)
+        {
+            /* continue the packet begun in an earlier read */
+            int take = MIN(PMXLEN - rpktlen, inlen - inpos);
+
+            memcpy(pktbuf + rpktlen, inbuf + inpos, take);
+            r = checkFrame(pktbuf, rpktlen + take);
+            if (r == 0)
+            {
+                rpktlen += take;
+                inpos += take;
+                return (0);
+            }
+            if (r > 0)
+            {
+                inpos += r - rpktlen;
+                rpktlen = 0;
+                if (pktbuf[1] == BROKTOK)
+                    return (2);
+                rpkt = pktbuf;
+                return (1);
+            }
+
+            /* bad, hunt on from the skip whether still in pktbuf or not */
+            if (-r >= rpktlen)
+            {
+                inpos += -r - rpktlen;
+                rpktlen = 0;
+                continue;
+            }
+            rpktlen -= -r;
+            memmove(pktbuf, pktbuf - r, rpktlen);
+            f = memchr(pktbuf, PSYNC, rpktlen);
+            if (f)
+            {
+                rpktlen -= f - pktbuf;
+                memmove(pktbuf, f, rpktlen);
+            }
+            else
+                rpktlen = 0;
+            continue;
+        }
+
+        /* hunt for SYNC */
+        f = inpos < inlen ? memchr(inbuf + inpos, PSYNC, inlen - inpos) : NULL;
+        if (!f)
+        {
+            inpos = inlen;
+            return (0);
+        }
+        inpos = f - inbuf;
+
+        r = checkFrame(f, inlen - inpos);
+        if (r > 0)
+        {
+            inpos += r;
+            if (f[1] == BROKTOK)
+                return (2);
+            rpkt = f;
+            return (1);
+        }
+        if (r < 0)
+        {
+            inpos += -r;
+            continue;
+        }
+
+        /* runs off the end of what we have, keep it for next time */
+        rpktlen = inlen - inpos;
+        memcpy(pktbuf, f, rpktlen);
+        inpos = inlen;
+        return (0);
+    }
 }
 
-/* read from ttyfd into rpkt until we have a packet or see BROKTOK or timeout.
- * nto is number of ACKWT periods to wait before considering it a timeout.
+/* set rpkt to the next packet from the lan, unless we see BROKTOK or time out.
+ * ms is how long to wait for each read before considering it a timeout.
  * "what" is a string of what we are hoping to read for printing and fr is
  *    the node address from which we anticipate a packet, for verbose.
  * return 0 if read normal packet, else -1 if anything else.
+ * N.B. rpkt may point into inbuf so is only good until we are called again.
  */
-static int readLANpacket(char *what, int nto, int fr)
+static int readLANpacket(char *what, int ms, int fr)
 {
-    Byte d;
-    int n;
-
-    /* new packet */
-    rpktlen = 0;
+    sawbroktok = 0;
 
-    /* repeat until know what is going on */
     while (1)
     {
-        if (readLANchar(nto, &d) < 0)
+        switch (decodeLAN())
         {
-            daemonLog("Time out waiting for %s from %d\n", what, fr);
+        case 1:
+            return (0);
+        case 2:
+            if (verbose > 3)
+                daemonLog("Received BROKTOK back from %d\n", fr);
+            sawbroktok = 1;
             return (-1);
         }
 
-        if (d == PSYNC)
-        {
-            /* saw SYNC -- always start over */
-            rpkt[PB_SYNC] = PSYNC;
-            rpktlen = 1;
-        }
-        else
+        if (readLAN(ms) < 0)
         {
-            /* handle bytes subsequent to known-good SYNC */
-            switch (rpktlen)
-            {
-            case 0: /* just garbage */
-                break;
-            case 1: /* To or token */
-                if (d == BROKTOK)
-                {
-                    if (verbose > 3)
-                        daemonLog("Received BROKTOK back from %d\n", fr);
-                    return (-1);
-                }
-                if (ISNTOK(d))
-                {
-                    rpktlen = 0; /* start over */
-                }
-                else
-                {
-                    rpkt[PB_TO] = d; /* continue with normal pkt */
-                    rpktlen = 2;
-                }
-                break;
-            case 2: /* From */
-                rpkt[PB_FR] = d;
-                rpktlen = 3;
-                break;
-            case 3: /* Info */
-                rpkt[PB_INFO] = d;
-                rpktlen = 4;
-                break;
-            case 4: /* Data Count */
-                if (d > PMXDAT)
-                {
-                    daemonLog("Preposterous data count: %d\n", d);
-                    dump(rpkt, 5);
-                    rpktlen = 0; /* must be illegal */
-                }
-                else
-                {
-                    rpkt[PB_COUNT] = d;
-                    rpktlen = 5;
-                }
-                break;
-            case 5:                /* Header Checksum */
-                rpkt[PB_HCHK] = d; /* proposed header checksum */
-                rpktlen = 6;
-                n = chkSum(rpkt, PB_NHCHK);
-                if (n == d)
-                {                            /* if good checksum */
-                    if (rpkt[PB_COUNT] == 0) /*   if control packet */
-                        return (0);          /*     good to go */
-                }
-                else
-                {
-                    daemonLog("Bad header chksum: 0x%02x vs 0x%02x\n", n, rpkt[PB_HCHK]);
-                    dump(rpkt, rpktlen);
-                    rpktlen = 0; /* start over */
-                }
-                break;
-            case 6:                /* Data Checksum */
-                rpkt[PB_DCHK] = d; /* claimed data checksum */
-                rpktlen = 7;       /* now collect data */
-                break;
-            default:                 /* gathering data */
-                rpkt[rpktlen++] = d; /* another byte of data */
-                if (rpktlen >= rpkt[PB_COUNT] + PB_DATA)
-                { /* if have all */
-                    n = chkSum(&rpkt[PB_DATA], rpkt[PB_COUNT]);
-                    if (n == rpkt[PB_DCHK]) /* if good data */
-                        return (0);         /*   good to go */
-                    else
-                    {
-                        daemonLog("Bad data chksum from %d: 0x%02x vs 0x%02x\n", rpkt[PB_FR], n, rpkt[PB_DCHK]);
-                        dump(rpkt, rpktlen);
-                        rpktlen = 0; /* start over */
-                    }
-                }
-                break;
-            }
+            daemonLog("Time out after %d ms waiting for %s from %d\n", ms, what, fr);
+            return (-1);
         }
     }
 }
@@ -1075,6 +1702,13 @@ static void rpktDispatch()
             dump(rpkt, pktSize(rpkt));
             /* "response" is to deprive sender of ACK */
         }
+        else if (HA2CIP(haddr)->why == FOR_VAR)
+        {
+            /* var clients only speak binary frames so just discard */
+            daemonLog("Discarding %s packet from %d to Var host %d\n", p2tstr((Pkt *)rpkt), netaddr, haddr);
+            dump(rpkt, pktSize(rpkt));
+            sendAck();
+        }
         else if (seq == rseq[netaddr][haddr])
         {
             /* dup */
@@ -1125,6 +1759,12 @@ static void rpktDispatch()
         }
         break;
 
+    case PT_ACK:
+        /* late, for a packet we have since resent or given up on */
+        if (verbose)
+            daemonLog("Late ACK from node %d to host %d seq 0x%x\n", netaddr, haddr, seq >> PSQ_SHIFT);
+        break;
+
     default:
         /* just log and close client, any any */
         daemonLog("%s is unsupported from node %d to host %d\n", p2tstr((Pkt *)rpkt), netaddr, haddr);
@@ -1138,27 +1778,78 @@ static void rpktDispatch()
  * build xpkt from cfd and send it, wait for ACK.
  */
 static void clientMsg(int cfd)
+{
+    if (CFD2CIP(cfd)->why == FOR_VAR)
+    {
+        varMsg(cfd); /* does its own sending */
+        return;
+    }
+
+    if (buildXPkt(cfd) < 0)
+        return;
+
+    (void)sendXpkt(); /* closes if trouble and logs */
+}
+
+/* build xpkt from the shell, boot or serial client on cfd.
+ * return 0 if ok to send xpkt, else -1.
+ */
+static int buildXPkt(int cfd)
 {
     switch (CFD2CIP(cfd)->why)
     {
     case FOR_BOOT:
-        if (buildBootXPkt(cfd) < 0)
-            return;
-        break;
+        return (buildBootXPkt(cfd));
     case FOR_SHELL:
-        if (buildShellXPkt(cfd) < 0)
-            return;
-        break;
+        return (buildShellXPkt(cfd));
     case FOR_SERIAL:
-        if (buildSerialXPkt(cfd) < 0)
-            return;
-        break;
+        return (buildSerialXPkt(cfd));
     default:
         daemonLog("Bogus why field %d from %d\n", CFD2CIP(cfd)->why, CFD2HA(cfd));
-        return;
+        return (-1);
     }
+}
 
-    (void)sendXpkt(); /* closes if trouble and logs */
+/* like clientMsg() but for a node with a window: gather up to n of cip's
+ * packets, as many as it has ready, and send them with sendWindow().
+ * return number of packets sent.
+ */
+static int clientWindow(CInfo *cip, int n)
+{
+    int cfd = cip->cfd;
+    int nw = 0;
+
+    if (n > window[cip->toaddr])
+        n = window[cip->toaddr];
+
+    while (nw < n && buildXPkt(cfd) == 0)
+    {
+        int t = xpkt[PB_INFO] & PT_MASK;
+
+        if (t != PT_SHELL && t != PT_BOOTREC && t != PT_SERDATA)
+        {
+            /* KILL or INTR go alone, after any before them */
+            if (sendWindow(nw) == 0)
+                (void)sendXpkt();
+            return (nw + 1);
+        }
+        memcpy(wpkt[nw++], xpkt, pktSize(xpkt));
+
+        /* boot client sends its next record only once told the size of this
+         * one, which we do now rather than when it is ACKed.
+         */
+        if (t == PT_BOOTREC && writeI(cfd, &xpkt[PB_COUNT], 1) < 0)
+        {
+            daemonLog("Boot client %d for %d disappeared! %s\n", CIP2HA(cip), cip->toaddr, strerror(errno));
+            closecfd(cfd);
+        }
+
+        if (!cip->inuse || cip->cfd != cfd || !isReady(cfd, t == PT_BOOTREC ? WINGAPMS : 0))
+            break;
+    }
+
+    (void)sendWindow(nw);
+    return (nw);
 }
 
 /* read client cfd with shell chat and create xpkt.
@@ -1331,6 +2022,143 @@ static int buildSerialXPkt(int cfd)
     return (0);
 }
 
+/* read client cfd with one binary GETVAR/SETVAR request, send it and reply.
+ * nodes found by probeVar() not to support these are told VAR_NOSUP at once
+ *   so the client falls back to its shell. others that do not ack a request
+ *   are told VAR_ERR, since that is just a lost packet.
+ */
+static void varMsg(int cfd)
+{
+    CInfo *cip = CFD2CIP(cfd);
+    int haddr = CIP2HA(cip);
+    int toaddr = cip->toaddr;
+    Byte reply[VARHDR + VARVSZ];
+    Byte req[PMXDAT];
+    Byte hdr[VARHDR];
+    int t, n, l;
+
+    /* read request header then its data */
+    n = readN(cfd, hdr, VARHDR);
+    if (n > 0)
+    {
+        if (hdr[1] == 0 || hdr[1] > PMXDAT)
+        {
+            daemonLog("Bogus %d-byte Var request from host %d\n", hdr[1], haddr);
+            closecfd(cfd);
+            return;
+        }
+        n = readN(cfd, req, hdr[1]);
+    }
+    if (n <= 0)
+    {
+        if (n < 0)
+            daemonLog("Host %d socket %d read error: %s. KILLing node %d\n", haddr, cfd, strerror(errno), toaddr);
+        else if (verbose)
+            daemonLog("EOF from Var host %d.. sending KILL to node %d\n", haddr, toaddr);
+        closecfd(cfd);
+        buildCtrlPkt(haddr, toaddr, PT_KILL);
+        (void)sendXpkt();
+        return;
+    }
+
+    t = hdr[0];
+    reply[0] = VAR_OK;
+    reply[1] = 0;
+
+    l = memchr(req, '\0', hdr[1]) ? strlen((char *)req) + 1 : 0;
+    if ((t != PT_GETVAR && t != PT_SETVAR) || l == 0 || l + 2 * (hdr[1] - l) > PMXDAT)
+    {
+        daemonLog("Bogus Var request type %d from host %d\n", t, haddr);
+        reply[0] = VAR_ERR;
+    }
+    else if (probeVar(haddr, toaddr) < 0)
+    {
+        reply[0] = VAR_NOSUP;
+    }
+    else
+    {
+        if (verbose > 2)
+            daemonLog("%s %s from host %d to %d\n", t == PT_GETVAR ? "GETVAR" : "SETVAR", (char *)req, haddr, toaddr);
+
+        n = varXpkt(haddr, toaddr, t, req, hdr[1]);
+        if (n < 0)
+        {
+            daemonLog("Node %d did not answer %s from host %d\n", toaddr, t == PT_GETVAR ? "GETVAR" : "SETVAR", haddr);
+            reply[0] = VAR_ERR;
+        }
+        else if (t == PT_GETVAR)
+        {
+            unsigned v = (req[0] & 0x80) ? ~0U : 0U;
+            int i;
+
+            for (i = 0; i < n; i++)
+                v = (v << 8) | req[i];
+            reply[1] = VARVSZ;
+            reply[2] = v >> 24;
+            reply[3] = v >> 16;
+            reply[4] = v >> 8;
+            reply[5] = v;
+        }
+    }
+
+    if (writeI(cfd, reply, VARHDR + reply[1]) < 0)
+    {
+        daemonLog("Var host %d disappeared! %s\n", haddr, strerror(errno));
+        closecfd(cfd);
+    }
+}
+
+/* send GETVAR/SETVAR t from haddr to toaddr with the name, and any binary
+ * value after it, in req[len]. a GETVAR value comes back in req.
+ * return bytes of value back, 0 for SETVAR, else -1 if not acked or bad.
+ */
+static int varXpkt(int haddr, int toaddr, int t, Byte req[], int len)
+{
+    Byte *dp = &xpkt[PB_DATA];
+    int l = strlen((char *)req) + 1;
+    int n;
+
+    /* name is plain text but a binary value must be escaped */
+    memcpy(dp, req, l);
+    n = l + escData(dp + l, req + l, len - l);
+
+    xpkt[PB_SYNC] = PSYNC;
+    xpkt[PB_TO] = toaddr;
+    xpkt[PB_FR] = haddr;
+    xpkt[PB_INFO] = t | XSEQ(toaddr);
+    xpkt[PB_COUNT] = n;
+    xpkt[PB_DCHK] = chkSum(dp, n);
+    xpkt[PB_HCHK] = chkSum(xpkt, PB_NHCHK);
+
+    if (sendVarXpkt() < 0)
+        return (-1);
+    if (t != PT_GETVAR)
+        return (0);
+
+    /* value comes back big-endian and escaped in the ACK data */
+    n = unescData(req, &rpkt[PB_DATA], rpkt[PB_COUNT]);
+    return (n <= 0 || n > VARVSZ ? -1 : n);
+}
+
+/* find once after each boot whether node to acks GETVAR/SETVAR, by asking
+ * it from ha for its clock. old firmware just ignores them, so VARTRY
+ * tries tell, and the answer stands until the node is booted again.
+ * return varsup[to].
+ */
+static int probeVar(int ha, int to)
+{
+    Byte req[PMXDAT];
+
+    if (varsup[to])
+        return (varsup[to]);
+
+    strcpy((char *)req, "clock");
+    varsup[to] = varXpkt(ha, to, PT_GETVAR, req, sizeof("clock")) > 0 ? 1 : -1;
+    if (varsup[to] < 0)
+        daemonLog("Node %d does not support GETVAR/SETVAR.. clients will use shell\n", to);
+    return (varsup[to]);
+}
+
 /* compute check sum on the given array */
 int chkSum(Byte p[], int n)
 {
@@ -1345,6 +2173,53 @@ int chkSum(Byte p[], int n)
     return (sum);
 }
 
+/* copy n bytes of binary data from src to dst escaping PSYNC and PESC.
+ * dst must have room for 2*n.
+ * return bytes in dst.
+ */
+static int escData(Byte dst[], Byte src[], int n)
+{
+    int l;
+
+    for (l = 0; n > 0; --n, src++)
+    {
+        if (*src == PSYNC)
+        {
+            dst[l++] = PESC;
+            dst[l++] = PESYNC;
+        }
+        else if (*src == PESC)
+        {
+            dst[l++] = PESC;
+            dst[l++] = PEESC;
+        }
+        else
+            dst[l++] = *src;
+    }
+
+    return (l);
+}
+
+/* undo escData() from n bytes of src into dst.
+ * return bytes in dst, else -1 if src is not a valid escaped sequence.
+ */
+static int unescData(Byte dst[], Byte src[], int n)
+{
+    int l;
+
+    for (l = 0; n > 0; --n, src++)
+    {
+        if (*src != PESC)
+            dst[l++] = *src;
+        else if (--n > 0 && (*++src == PESYNC || *src == PEESC))
+            dst[l++] = *src == PESYNC ? PSYNC : PESC;
+        else
+            return (-1);
+    }
+
+    return (l);
+}
+
 /* send an ACK packet for what is in rpkt.
  * record sequence in rseq[] and start timer.
  * we don't expect _this_ to be acked.
@@ -1437,12 +2312,25 @@ static int ack4xpkt(void)
     return (-1);
 }
 
-/* wait for packet from LAN.
- * return 0 if ack for xpkt, else -1.
+/* send xpkt on the given retry and wait for its ACK, as long as nlearn
+ * RTT samples say, see ackTimeout().
+ * return 0 if acked, else -1.
  */
-static int wait4ACK(void)
+static int sendWait4ACK(int try, int nlearn)
 {
-    return (!readLANpacket("ACK", 1, xpkt[PB_TO]) && !ack4xpkt() ? 0 : -1);
+    int to = xpkt[PB_TO];
+    double t0 = msNow();
+    int n = pktSize(xpkt);
+
+    sendPkt(xpkt, try);
+    if (readLANpacket("ACK", ackTimeout(to, n, try, nlearn), to) < 0 || ack4xpkt() < 0)
+        return (-1);
+
+    /* learn how quick it is from first tries, less the time on the wire */
+    if (try == 0 && to <= MAXNA)
+        rttSample(&nodetime[to].acksrtt, &nodetime[to].ackvar, &nodetime[to].nack,
+                  msNow() - t0 - WIREMS(n + PB_HSZ));
+    return (0);
 }
 
 /* send xpkt and wait for ACK, retrying as necessary.
@@ -1455,20 +2343,118 @@ static int sendXpkt(void)
     int i;
 
     /* send and retry as necessary */
+    for (i = 0; i <= MAXRTY; i++)
+        if (sendWait4ACK(i, NRTTLEARN) == 0)
+            return (0);
+
+    /* sorry */
+    restartNode(to);
+    return (-1);
+}
+
+/* send the nw packets in wpkt[], all to one node, back to back, then collect
+ * their ACKs, resending just those not acked, retrying as necessary.
+ * if time out, restart the node as sendXpkt() does.
+ * return 0 if ok else -1.
+ */
+static int sendWindow(int nw)
+{
+    char acked[WINMAX];
+    int nleft = nw;
+    int i, to;
+
+    if (nw == 0)
+        return (0);
+    to = wpkt[0][PB_TO];
+    memset(acked, 0, sizeof(acked));
+
     for (i = 0; i <= MAXRTY; i++)
     {
-        sendPkt(xpkt, i);
-        if (wait4ACK() == 0)
+        int nbytes = 0;
+        int j;
+
+        for (j = 0; j < nw; j++)
+        {
+            if (!acked[j])
+            {
+                sendPkt(wpkt[j], i);
+                nbytes += pktSize(wpkt[j]);
+                nwinpkts++;
+                if (i > 0)
+                    nwinresent++;
+            }
+        }
+
+        /* gather ACKs until all in or the LAN goes quiet */
+        while (nleft > 0 && !readLANpacket("window ACK", ackTimeout(to, nbytes, i, NRTTLEARN), to))
+        {
+            if ((j = ack4wpkt(nw)) >= 0 && !acked[j])
+            {
+                acked[j] = 1;
+                nleft--;
+            }
+        }
+        if (nleft == 0)
             return (0);
     }
 
     /* sorry */
+    restartNode(to);
+    return (-1);
+}
+
+/* return index of the packet in wpkt[nw] for which rpkt is an ACK, else -1 */
+static int ack4wpkt(int nw)
+{
+    int netaddr = rpkt[PB_FR];
+    int seq = rpkt[PB_INFO] & PSQ_MASK;
+    int i;
+
+    if ((rpkt[PB_INFO] & PT_MASK) != PT_ACK)
+    {
+        daemonLog("Unexpected %s from %d to %d\n", p2tstr((Pkt *)rpkt), netaddr, rpkt[PB_TO]);
+        return (-1);
+    }
+
+    for (i = 0; i < nw; i++)
+    {
+        if (netaddr == wpkt[i][PB_TO] && seq == (wpkt[i][PB_INFO] & PSQ_MASK))
+        {
+            if (verbose)
+                daemonLog("Saw window ACK packet: from %d to %d seq 0x%x\n", netaddr, rpkt[PB_TO], seq >> PSQ_SHIFT);
+            return (i);
+        }
+    }
+
+    return (-1);
+}
+
+/* node to has stopped answering: break its clients, forget it and reboot it */
+static void restartNode(int to)
+{
     daemonLog("Restarting node %d after %d tries.\n", to, MAXRTY + 1);
     breakConnections(to);
     livenodes[to] = 0;
     buildCtrlPkt(MAXNA + 1, to, PT_REBOOT);
     sendPkt(xpkt, 0);
     sendPkt(xpkt, 0); /* no ACK so repeat for good measure */
+}
+
+/* like sendXpkt() but for GETVAR/SETVAR, which old firmware just ignores.
+ * these only touch RAM so need none of the MAXRTY budget flash erase does:
+ *   give up after VARTRY tries, and do not reboot the node. each waits as
+ *   long as the node's RTT says from its first sample, as the PING when
+ *   the client connected, so old firmware is found out in a few RTTs.
+ * return 0 if ok else -1.
+ */
+static int sendVarXpkt(void)
+{
+    int i;
+
+    for (i = 0; i < VARTRY; i++)
+        if (sendWait4ACK(i, 1) == 0)
+            return (0);
+
     return (-1);
 }
 
@@ -1510,6 +2496,10 @@ void sendPkt(Byte pkt[], int try)
 {
     int npkt = pktSize(pkt);
 
+    /* node will want the token to answer anything but an ACK */
+    if (pkt[PB_TO] <= MAXNA && (pkt[PB_INFO] & PT_MASK) != PT_ACK)
+        nodetime[pkt[PB_TO]].owed = 1;
+
     if (verbose)
     {
         daemonLog("Sending %s packet: %d data from %d to %d seq 0x%x retry %d\n", p2tstr((Pkt *)pkt), pkt[PB_COUNT],
@@ -1531,6 +2521,7 @@ static void sendCurToken()
 
     tpkt[0] = PSYNC;
     tpkt[1] = curtoken;
+    toksentms = msNow();
 
     if (verbose > 3)
         daemonLog("Sending token to node %d\n", tok2addr(curtoken));
@@ -1556,6 +2547,7 @@ static void closecfd(int cfd)
     /* close real fd */
     (void)close(cfd);
     cip->inuse = 0;
+    cip->ready = 0;
 
     /* remove from clset, if claims to be in */
     if (cip->cfdset)
@@ -1685,11 +2677,36 @@ static char *why2str(OpenWhy why)
         return ("FOR_REBOOT");
     case FOR_SERIAL:
         return ("FOR_SERIAL");
+    case FOR_VAR:
+        return ("FOR_VAR");
     default:
         return ("FOR_???");
     }
 }
 
+/* given a CSIPri return a descriptive string */
+static char *pri2str(CSIPri pri)
+{
+    switch (pri)
+    {
+    case CSI_PRI_CTRL:
+        return ("CTRL");
+    case CSI_PRI_SHELL:
+        return ("SHELL");
+    case CSI_PRI_BULK:
+        return ("BULK");
+    default:
+        return ("???");
+    }
+}
+
+/* ask mainLoop() to log the scheduler metrics */
+static void onStatsSig(int dummy)
+{
+    signal(SIGUSR1, onStatsSig);
+    statsflag = 1;
+}
+
 /* increment verbose, modulo MAXV+1 */
 static void onVerboseSig(int dummy)
 {
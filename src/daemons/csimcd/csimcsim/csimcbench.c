@@ -0,0 +1,172 @@
+/* measure csi_rix() round trips through a real csimcd, typically one talking
+ * to csimcsim. one connection plays telescoped, asking node 0 its clock at
+ * CSI_PRI_CTRL and timing each answer, while loader processes keep every
+ * other node busy with interactive-class queries whose answers they check.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csimc.h"
+
+#define HOST "127.0.0.1" /* where csimcd runs */
+#define NWARM 10          /* queries before timing starts */
+#define CONNMS 5000       /* ms to wait for loaders to start */
+
+/* what each loader reports, in memory shared with us */
+typedef struct
+{
+    volatile long nq;   /* queries answered */
+    volatile long nbad; /* answers which were wrong */
+} Load;
+
+static void loader(int port, int addr, Load *lp);
+static int cmpd(const void *p1, const void *p2);
+static double msNow(void);
+
+int main(int ac, char *av[])
+{
+    int port = ac > 1 ? atoi(av[1]) : CSIMCPORT;
+    int nnodes = ac > 2 ? atoi(av[2]) : 8;
+    int nq = ac > 3 ? atoi(av[3]) : 500;
+    int nload = ac > 4 ? atoi(av[4]) : 0;
+    Load *load;
+    pid_t *pids;
+    double *dt, t0, t1, elapsed;
+    long lq0 = 0, lq1 = 0, lbad = 0;
+    int fd, i, nstarted;
+
+    if (nnodes < 1 || nnodes > NNODES || nq < 1 || nload < 0)
+    {
+        fprintf(stderr, "Usage: %s [port [nodes [queries [loaders]]]]\n", av[0]);
+        exit(1);
+    }
+
+    dt = malloc(nq * sizeof(double));
+    pids = malloc((nload + 1) * sizeof(pid_t));
+    load = mmap(NULL, (nload + 1) * sizeof(Load), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (!dt || !pids || load == MAP_FAILED)
+    {
+        fprintf(stderr, "No memory\n");
+        exit(1);
+    }
+
+    /* loaders spread over the other nodes, or share node 0 if it is alone */
+    for (i = 0; i < nload; i++)
+    {
+        int addr = nnodes > 1 ? 1 + i % (nnodes - 1) : 0;
+
+        if ((pids[i] = fork()) == 0)
+            loader(port, addr, &load[i]);
+        if (pids[i] < 0)
+        {
+            perror("fork");
+            exit(1);
+        }
+    }
+
+    /* wait until each loader has had an answer */
+    t0 = msNow();
+    do
+    {
+        for (nstarted = i = 0; i < nload; i++)
+            nstarted += load[i].nq > 0;
+        if (nstarted < nload)
+            usleep(10000);
+    } while (nstarted < nload && msNow() - t0 < CONNMS);
+    if (nstarted < nload)
+        fprintf(stderr, "Only %d of %d loaders running\n", nstarted, nload);
+
+    fd = csi_popen(HOST, port, 0, CSI_PRI_CTRL);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Can not connect to csimcd on port %d\n", port);
+        exit(1);
+    }
+    for (i = 0; i < NWARM; i++)
+        (void)csi_rix(fd, "=clock;");
+
+    for (i = 0; i < nload; i++)
+        lq0 += load[i].nq;
+    t0 = msNow();
+    for (i = 0; i < nq; i++)
+    {
+        double t = msNow();
+
+        if (csi_rix(fd, "=clock;") < 0)
+        {
+            fprintf(stderr, "Query %d failed\n", i);
+            exit(1);
+        }
+        dt[i] = msNow() - t;
+    }
+    t1 = msNow();
+    for (i = 0; i < nload; i++)
+    {
+        lq1 += load[i].nq;
+        lbad += load[i].nbad;
+    }
+
+    for (i = 0; i < nload; i++)
+    {
+        kill(pids[i], SIGKILL);
+        waitpid(pids[i], NULL, 0);
+    }
+
+    qsort(dt, nq, sizeof(double), cmpd);
+    elapsed = (t1 - t0) / 1000;
+    printf("%d nodes, %d loaders\n", nnodes, nload);
+    printf("ctrl csi_rix: median %.1f p90 %.1f p99 %.1f max %.1f ms, %.1f/s\n", dt[nq / 2], dt[nq * 9 / 10],
+           dt[nq * 99 / 100], dt[nq - 1], nq / elapsed);
+    if (nload > 0)
+        printf("load csi_rix: %.1f/s, %ld wrong\n", (lq1 - lq0) / elapsed, lbad);
+
+    return (lbad ? 1 : 0);
+}
+
+/* query node addr forever, checking each answer is what we set */
+static void loader(int port, int addr, Load *lp)
+{
+    int fd = csi_open(HOST, port, addr);
+    int pid = getpid();
+    int k;
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "Loader can not connect to node %d\n", addr);
+        exit(1);
+    }
+
+    for (k = 1;; k++)
+    {
+        int v = (pid * 1000 + k) & 0xffffff;
+
+        if (csi_rix(fd, "v%d=%d;=v%d;", pid, v, pid) != v)
+            lp->nbad++;
+        lp->nq++;
+    }
+}
+
+/* compare two doubles for qsort */
+static int cmpd(const void *p1, const void *p2)
+{
+    double d1 = *(double *)p1;
+    double d2 = *(double *)p2;
+
+    return (d1 < d2 ? -1 : d1 > d2);
+}
+
+/* return a monotonic ms clock */
+static double msNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3 + ts.tv_nsec / 1e6);
+}
@@ -0,0 +1,986 @@
+/* simulate a LAN of CSIMC nodes on a pty so csimcd can be run, tested and
+ * measured without hardware. we print the name of the slave side, which
+ * csimcd opens as its tty, then answer for each simulated node as the
+ * firmware would: ACK its packets, pass the token back, run a little of the
+ * shell language and serve GETVAR/SETVAR.
+ *
+ * the pty itself is instant so we model the wire: every byte takes 10 bits
+ * at the baud rate in whichever direction, and a node waits a turnaround
+ * time before it talks. ACKs for packets sent back to back wait until the
+ * host has finished sending, as they would on the shared bus. optionally
+ * bytes are corrupted and ACKs and tokens are lost.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "csimc.h"
+
+#define DEFBAUD 38400 /* default wire rate */
+#define DEFTURN 5     /* default ms before a node answers */
+#define NODEACKMS 50  /* ms a node waits for csimcd to ACK its packet */
+#define NVARS 64      /* variables per node */
+#define VNAMSZ 16     /* longest variable name, with its '\0' */
+#define SHELLSZ 256   /* longest statement */
+#define OUTSZ 4096    /* shell output queued per node per host */
+#define NACKQ 16      /* ACKs waiting for the bus */
+
+/* one node variable */
+typedef struct
+{
+    char name[VNAMSZ];
+    int v;
+} Var;
+
+/* one simulated node */
+typedef struct
+{
+    int live;                  /* set if we answer for this address */
+    double clock0;             /* ms when the node clock read 0 */
+    Var vars[NVARS];           /* variables, in order of first use */
+    int nvars;                 /* used vars[] */
+    char stmt[NADDR][SHELLSZ]; /* statement so far from each host */
+    int stmtlen[NADDR];        /* bytes in stmt[] */
+    char out[NADDR][OUTSZ];    /* shell output not yet sent to each host */
+    int outlen[NADDR];         /* bytes in out[] */
+    Word seen;                 /* seqs lately received, for finding dups */
+    Byte txseq;                /* seq of our last packet */
+    Byte unacked[PMXLEN];      /* our packet csimcd has not ACKed */
+    int nunacked;              /* bytes in unacked[], 0 if none */
+    int ntok, npkts, ndups;    /* tokens, packets and dups received */
+} Node;
+
+static void usage(void);
+static void setNodes(char *list);
+static int openPty(void);
+static int getPkt(Byte pkt[], int ms);
+static int getByte(Byte *bp, int ms);
+static void busy(int nbytes);
+static void rxPkt(Byte pkt[]);
+static void rxToken(int addr);
+static int waitACK(Node *np);
+static void queueACK(Byte pkt[], Byte data[], int n);
+static void flushACKs(void);
+static void txBytes(Byte buf[], int n);
+static int buildPkt(Byte pkt[], int to, int fr, int info, Byte data[], int n);
+static void shellIn(Node *np, int fr, Byte data[], int n);
+static void shellStmt(Node *np, int fr, char *s);
+static void shellOut(Node *np, int fr, char *fmt, ...);
+static int expr(Node *np, char **sp, int *vp);
+static int term(Node *np, char **sp, int *vp);
+static int factor(Node *np, char **sp, int *vp);
+static int getName(char **sp, char name[VNAMSZ]);
+static int getVar(Node *np, char *name);
+static void setVar(Node *np, char *name, int v);
+static void resetNode(Node *np);
+static int chkSum(Byte p[], int n);
+static int escData(Byte dst[], Byte src[], int n);
+static int unescData(Byte dst[], Byte src[], int n);
+static int chance(double p);
+static double msNow(void);
+
+static Node nodes[NNODES];     /* the LAN */
+static int ptyfd;              /* master side of the pty */
+static double bytems;          /* ms each byte is on the wire */
+static double busfree;         /* msNow() when the wire is next quiet */
+static int turnms = DEFTURN;   /* ms a node waits before talking */
+static double ber;             /* probability each bit is wrong */
+static double ackloss;         /* probability we lose each ACK we send */
+static double tokloss;         /* probability a node misses its token */
+static int novar;              /* set to act as firmware without GETVAR */
+static int verbose;            /* set to log to stderr */
+static Byte ackq[NACKQ][PMXLEN]; /* ACKs waiting for the bus */
+static int ackqlen[NACKQ];       /* bytes in each ackq[] */
+static int nackq;                /* used ackq[] */
+static char *me;
+
+int main(int ac, char *av[])
+{
+    int baud = DEFBAUD;
+    long seed = time(NULL);
+    Byte pkt[PMXLEN];
+
+    me = av[0];
+
+    while ((--ac > 0) && ((*++av)[0] == '-'))
+    {
+        char *s;
+        for (s = av[0] + 1; *s != '\0'; s++)
+            switch (*s)
+            {
+            case 'a':
+                if (ac < 2)
+                    usage();
+                ackloss = atof(*++av);
+                ac--;
+                break;
+            case 'b':
+                if (ac < 2)
+                    usage();
+                baud = atoi(*++av);
+                ac--;
+                break;
+            case 'e':
+                if (ac < 2)
+                    usage();
+                ber = atof(*++av);
+                ac--;
+                break;
+            case 'k':
+                if (ac < 2)
+                    usage();
+                tokloss = atof(*++av);
+                ac--;
+                break;
+            case 'l':
+                if (ac < 2)
+                    usage();
+                turnms = atoi(*++av);
+                ac--;
+                break;
+            case 's':
+                if (ac < 2)
+                    usage();
+                seed = atol(*++av);
+                ac--;
+                break;
+            case 'V':
+                novar++;
+                break;
+            case 'v':
+                verbose++;
+                break;
+            default:
+                usage();
+            }
+    }
+
+    /* ac remaining args starting at av[0] */
+    if (ac != 1 || baud < 0 || turnms < 0)
+        usage();
+
+    setNodes(av[0]);
+    bytems = baud > 0 ? 10000.0 / baud : 0;
+    srand48(seed);
+    ptyfd = openPty();
+
+    /* serve forever: tokens and packets as they come, queued ACKs as soon
+     * as the host stops talking.
+     */
+    while (1)
+    {
+        int ms = -1;
+
+        if (nackq > 0)
+        {
+            ms = (int)(busfree + turnms - msNow()) + 1;
+            if (ms < 1)
+                ms = 1;
+        }
+
+        switch (getPkt(pkt, ms))
+        {
+        case 0:
+            if (nackq > 0)
+                flushACKs();
+            break;
+        case 1:
+            rxPkt(pkt);
+            break;
+        case 2:
+            rxToken(tok2addr(pkt[PB_TO]));
+            break;
+        }
+    }
+
+    return (0);
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [options] nodes\n", me);
+    fprintf(stderr, "Purpose: simulate a CSIMC LAN on a pty for csimcd\n");
+    fprintf(stderr, "nodes:     addresses to answer for, such as 0-7 or 0,2,5\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, " -a p:      lose each ACK we send with probability p\n");
+    fprintf(stderr, " -b baud:   wire rate; 0 for infinite; default is %d\n", DEFBAUD);
+    fprintf(stderr, " -e ber:    corrupt each bit either way with probability ber\n");
+    fprintf(stderr, " -k p:      miss each token with probability p\n");
+    fprintf(stderr, " -l ms:     node turnaround time; default is %d\n", DEFTURN);
+    fprintf(stderr, " -s seed:   seed for the losses; default is the time\n");
+    fprintf(stderr, " -V:        act as firmware without GETVAR/SETVAR\n");
+    fprintf(stderr, " -v:        log traffic to stderr\n");
+    fprintf(stderr, "Prints the pty for csimcd -t, then runs until killed.\n");
+
+    exit(1);
+}
+
+/* mark each node in list live, or exit if list makes no sense */
+static void setNodes(char *list)
+{
+    char *s = list;
+
+    while (*s)
+    {
+        char *e;
+        int a = strtol(s, &e, 10);
+        int b = a;
+
+        if (e == s)
+            usage();
+        if (*e == '-')
+        {
+            s = e + 1;
+            b = strtol(s, &e, 10);
+            if (e == s)
+                usage();
+        }
+        if (a < 0 || b > MAXNA || a > b)
+            usage();
+        for (; a <= b; a++)
+        {
+            nodes[a].live = 1;
+            resetNode(&nodes[a]);
+        }
+        s = *e == ',' ? e + 1 : e;
+        if (*e && *e != ',')
+            usage();
+    }
+}
+
+/* open a raw pty, print the name of its slave and return the master fd.
+ * we keep the slave open too so csimcd may come and go.
+ * exit if trouble.
+ */
+static int openPty()
+{
+    struct termios tio;
+    char name[64];
+    int fd, sfd;
+
+    memset(&tio, 0, sizeof(tio));
+    cfmakeraw(&tio);
+    if (openpty(&fd, &sfd, name, &tio, NULL) < 0)
+    {
+        fprintf(stderr, "%s: pty: %s\n", me, strerror(errno));
+        exit(1);
+    }
+
+    printf("%s\n", name);
+    fflush(stdout);
+
+    return (fd);
+}
+
+/* read the next packet or token from the wire into pkt[].
+ * return 1 if packet, 2 if token, 0 if nothing whole arrived within ms.
+ * bad checksums are skipped, as a node would.
+ */
+static int getPkt(Byte pkt[], int ms)
+{
+    double end = msNow() + ms;
+    int n = 0, need = PB_HSZ;
+    Byte b;
+
+    while (getByte(&b, ms < 0 ? -1 : (int)(end - msNow())) == 0)
+    {
+        if (b == PSYNC)
+            n = 0, need = PB_HSZ; /* start over whatever we had */
+        else if (n == 0)
+            continue; /* not synced */
+        pkt[n++] = b;
+
+        /* a token is just SYNC and the address */
+        if (n == 2 && (ISNTOK(b) || b == BROKTOK))
+        {
+            busy(2);
+            return (2);
+        }
+
+        if (n == PB_HSZ)
+        {
+            if (chkSum(pkt, PB_NHCHK) != pkt[PB_HCHK])
+            {
+                if (verbose)
+                    fprintf(stderr, "bad header chksum\n");
+                n = 0;
+                continue;
+            }
+            if (pkt[PB_COUNT] > PMXDAT)
+            {
+                n = 0;
+                continue;
+            }
+            if (pkt[PB_COUNT])
+                need = PB_NZHSZ + pkt[PB_COUNT];
+        }
+
+        if (n == need)
+        {
+            busy(n);
+            if (need > PB_HSZ && chkSum(pkt + PB_DATA, pkt[PB_COUNT]) != pkt[PB_DCHK])
+            {
+                if (verbose)
+                    fprintf(stderr, "bad data chksum from %d\n", pkt[PB_FR]);
+                n = 0;
+                continue;
+            }
+            return (1);
+        }
+    }
+
+    return (0);
+}
+
+/* read one byte from the wire, through any bit errors.
+ * return 0 if ok, -1 if none within ms.
+ */
+static int getByte(Byte *bp, int ms)
+{
+    static Byte inbuf[256];
+    static int nin, nextin;
+
+    if (nextin == nin)
+    {
+        struct pollfd pfd;
+
+        pfd.fd = ptyfd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, ms < 0 ? -1 : ms) <= 0)
+            return (-1);
+        nin = read(ptyfd, inbuf, sizeof(inbuf));
+        nextin = 0;
+        if (nin <= 0)
+        {
+            nin = 0;
+            return (-1);
+        }
+    }
+
+    *bp = inbuf[nextin++];
+    if (ber > 0 && chance(8 * ber))
+        *bp ^= 1 << (lrand48() % 8);
+    return (0);
+}
+
+/* the wire carries nbytes more, starting when it is next quiet */
+static void busy(int nbytes)
+{
+    double now = msNow();
+
+    if (busfree < now)
+        busfree = now;
+    busfree += nbytes * bytems;
+}
+
+/* act on a packet from the host */
+static void rxPkt(Byte pkt[])
+{
+    int to = pkt[PB_TO], fr = pkt[PB_FR];
+    int type = pkt[PB_INFO] & PT_MASK;
+    int seq = pkt[PB_INFO] >> PSQ_SHIFT;
+    int n = pkt[PB_COUNT];
+    Byte *data = pkt + PB_DATA;
+    Node *np;
+    int i;
+
+    if (to == BRDCA && type == PT_REBOOT)
+    {
+        for (i = 0; i < NNODES; i++)
+            if (nodes[i].live)
+                resetNode(&nodes[i]);
+        return;
+    }
+    if (to >= NNODES || !nodes[to].live || fr >= NADDR)
+        return;
+    np = &nodes[to];
+
+    if (type == PT_ACK)
+    {
+        /* csimcd ACKing a packet of ours late; waitACK() gave up on it */
+        if (np->nunacked && seq == np->unacked[PB_INFO] >> PSQ_SHIFT)
+            np->nunacked = 0;
+        return;
+    }
+
+    np->npkts++;
+    if (verbose)
+        fprintf(stderr, "node %d: type %d seq %d count %d from %d\n", to, type, seq, n, fr);
+
+    switch (type)
+    {
+    case PT_REBOOT:
+        resetNode(np);
+        return; /* no ACK from a node which is rebooting */
+    case PT_PING:
+        np->seen = 0; /* new connection, new sequence */
+        queueACK(pkt, NULL, 0);
+        return;
+    case PT_GETVAR:
+    case PT_SETVAR:
+        if (novar)
+            return; /* old firmware ignores them */
+        break;
+    }
+
+    /* every packet is ACKed, but a resent one is not acted on again.
+     * the sequence is per node so any of the last WINMAX may be resent.
+     */
+    if (np->seen & (1 << seq))
+    {
+        np->ndups++;
+        if (type != PT_GETVAR)
+        {
+            queueACK(pkt, NULL, 0);
+            return;
+        }
+    }
+    np->seen |= 1 << seq;
+    for (i = 1; i <= 8; i++)
+        np->seen &= ~(1 << ((seq + i) & 0xf));
+
+    switch (type)
+    {
+    case PT_SHELL:
+        shellIn(np, fr, data, n);
+        break;
+    case PT_INTR:
+    case PT_KILL:
+        np->stmtlen[fr] = 0;
+        np->outlen[fr] = 0;
+        break;
+    case PT_GETVAR:
+    case PT_SETVAR:
+    {
+        Byte val[VARVSZ], eval[2 * VARVSZ];
+        char *name = (char *)data;
+        int l = strnlen(name, n);
+        int v;
+
+        if (l == n)
+            return; /* no '\0', no ACK */
+        if (type == PT_SETVAR)
+        {
+            if (unescData(val, data + l + 1, n - l - 1) != VARVSZ)
+                return;
+            setVar(np, name, (int)((unsigned)val[0] << 24 | val[1] << 16 | val[2] << 8 | val[3]));
+            queueACK(pkt, NULL, 0);
+        }
+        else
+        {
+            v = getVar(np, name);
+            val[0] = v >> 24;
+            val[1] = v >> 16;
+            val[2] = v >> 8;
+            val[3] = v;
+            queueACK(pkt, eval, escData(eval, val, VARVSZ));
+        }
+        return;
+    }
+    default:
+        break; /* BOOTREC, SERDATA etc are just ACKed */
+    }
+
+    queueACK(pkt, NULL, 0);
+}
+
+/* node addr has the token: send it whatever shell output it has, one
+ * packet at a time each once ACKed, then pass the token back.
+ */
+static void rxToken(int addr)
+{
+    Node *np = &nodes[addr];
+    Byte pkt[PMXLEN];
+    int fr;
+
+    if (addr >= NNODES || !np->live)
+        return;
+    np->ntok++;
+    if (tokloss > 0 && chance(tokloss))
+        return;
+
+    if (nackq > 0)
+        flushACKs();
+    usleep(turnms * 1000);
+
+    /* finish the one csimcd missed first, with its same seq */
+    if (np->nunacked)
+    {
+        txBytes(np->unacked, np->nunacked);
+        if (waitACK(np) < 0)
+            goto done;
+    }
+
+    for (fr = NNODES; fr < NADDR; fr++)
+        while (np->outlen[fr] > 0)
+        {
+            int n = np->outlen[fr] > PMXDAT ? PMXDAT : np->outlen[fr];
+
+            np->txseq = (np->txseq + 1) & 0xf;
+            np->nunacked = buildPkt(pkt, fr, addr, PT_SHELL | np->txseq << PSQ_SHIFT, (Byte *)np->out[fr], n);
+            memcpy(np->unacked, pkt, np->nunacked);
+            memmove(np->out[fr], np->out[fr] + n, np->outlen[fr] - n);
+            np->outlen[fr] -= n;
+            txBytes(pkt, np->nunacked);
+            if (waitACK(np) < 0)
+                goto done;
+        }
+
+done:
+    pkt[0] = PSYNC;
+    pkt[1] = BROKTOK;
+    txBytes(pkt, 2);
+}
+
+/* wait for csimcd to ACK np's unacked packet, acting on anything else
+ * which arrives meanwhile.
+ * return 0 if ACKed, else -1 leaving it to be sent again next token.
+ */
+static int waitACK(Node *np)
+{
+    double end = msNow() + NODEACKMS + 2 * np->nunacked * bytems;
+    Byte pkt[PMXLEN];
+    int r;
+
+    while ((r = getPkt(pkt, (int)(end - msNow()))) != 0)
+    {
+        if (r == 1)
+            rxPkt(pkt);
+        if (!np->nunacked)
+            return (0);
+    }
+
+    return (-1);
+}
+
+/* queue an ACK for pkt, with n bytes of data, to go when the bus is quiet */
+static void queueACK(Byte pkt[], Byte data[], int n)
+{
+    if (ackloss > 0 && chance(ackloss))
+        return;
+    if (nackq == NACKQ)
+        flushACKs();
+    ackqlen[nackq] = buildPkt(ackq[nackq], pkt[PB_FR], pkt[PB_TO], PT_ACK | (pkt[PB_INFO] & PSQ_MASK), data, n);
+    nackq++;
+}
+
+/* send all queued ACKs, after the turnaround from the last we heard */
+static void flushACKs()
+{
+    double wait = busfree + turnms - msNow();
+    int i;
+
+    if (wait > 0)
+        usleep((int)(wait * 1000));
+    for (i = 0; i < nackq; i++)
+        txBytes(ackq[i], ackqlen[i]);
+    nackq = 0;
+}
+
+/* put n bytes on the wire, through any bit errors, and wait while they go */
+static void txBytes(Byte buf[], int n)
+{
+    Byte out[2 * PMXLEN];
+    int i;
+
+    memcpy(out, buf, n);
+    if (ber > 0)
+        for (i = 0; i < n; i++)
+            if (chance(8 * ber))
+                out[i] ^= 1 << (lrand48() % 8);
+
+    if (write(ptyfd, out, n) != n)
+    {
+        fprintf(stderr, "%s: write: %s\n", me, strerror(errno));
+        exit(1);
+    }
+
+    busy(n);
+    if (bytems > 0)
+        usleep((int)(n * bytems * 1000));
+}
+
+/* build a packet into pkt[] with n bytes of data.
+ * return its total length.
+ */
+static int buildPkt(Byte pkt[], int to, int fr, int info, Byte data[], int n)
+{
+    pkt[PB_SYNC] = PSYNC;
+    pkt[PB_TO] = to;
+    pkt[PB_FR] = fr;
+    pkt[PB_INFO] = info;
+    pkt[PB_COUNT] = n;
+    pkt[PB_HCHK] = chkSum(pkt, PB_NHCHK);
+    if (n == 0)
+        return (PB_HSZ);
+    memcpy(pkt + PB_DATA, data, n);
+    pkt[PB_DCHK] = chkSum(pkt + PB_DATA, n);
+    return (PB_NZHSZ + n);
+}
+
+/* add shell text from host fr to np and run each whole statement */
+static void shellIn(Node *np, int fr, Byte data[], int n)
+{
+    char *stmt = np->stmt[fr];
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        int c = data[i];
+
+        if (c == ';' || c == '\n' || c == '\r')
+        {
+            stmt[np->stmtlen[fr]] = '\0';
+            shellStmt(np, fr, stmt);
+            np->stmtlen[fr] = 0;
+        }
+        else if (np->stmtlen[fr] < SHELLSZ - 1)
+            stmt[np->stmtlen[fr]++] = c;
+    }
+}
+
+/* run the statement s from host fr on np.
+ * we know only the bits of the language the host software uses:
+ *   =expr           print its value
+ *   name = expr     assignment
+ *   snap()          print clock mpos epos mvel iedge ilevel, as basic.cmc
+ *   printf("fmt", expr, ...)  with %d only
+ * expressions are integers and variables with + - * / % and ().
+ */
+static void shellStmt(Node *np, int fr, char *s)
+{
+    char name[VNAMSZ];
+    char *s0 = s;
+    int v;
+
+    while (*s == ' ' || *s == '\t')
+        s++;
+    if (*s == '\0')
+        return;
+
+    if (*s == '=')
+    {
+        s++;
+        if (expr(np, &s, &v) == 0 && *s == '\0')
+        {
+            shellOut(np, fr, "%d\n", v);
+            return;
+        }
+    }
+    else if (!strncmp(s, "snap()", 6))
+    {
+        shellOut(np, fr, "%d %d %d %d %d %d\n", getVar(np, "clock"), getVar(np, "mpos"), getVar(np, "epos"),
+                 getVar(np, "mvel"), getVar(np, "iedge"), getVar(np, "ilevel"));
+        return;
+    }
+    else if (!strncmp(s, "printf(\"", 8))
+    {
+        char buf[OUTSZ / 4], *bp = buf;
+        char *f = s + 8;
+
+        s = strchr(f, '"');
+        if (s)
+        {
+            *s++ = '\0';
+            while (*f && bp < buf + sizeof(buf) - 16)
+            {
+                if (f[0] == '\\' && f[1] == 'n')
+                    *bp++ = '\n', f += 2;
+                else if (f[0] == '%' && f[1] == 'd')
+                {
+                    while (*s == ' ')
+                        s++;
+                    if (*s++ != ',' || expr(np, &s, &v) < 0)
+                        break;
+                    bp += sprintf(bp, "%d", v);
+                    f += 2;
+                }
+                else
+                    *bp++ = *f++;
+            }
+            *bp = '\0';
+            if (*f == '\0')
+            {
+                shellOut(np, fr, "%s", buf);
+                return;
+            }
+        }
+    }
+    else if (getName(&s, name) == 0)
+    {
+        while (*s == ' ')
+            s++;
+        if (*s++ == '=' && expr(np, &s, &v) == 0 && *s == '\0')
+        {
+            setVar(np, name, v);
+            return;
+        }
+    }
+
+    shellOut(np, fr, "syntax error: %s\n", s0);
+}
+
+/* queue printf-style output on np for host fr */
+static void shellOut(Node *np, int fr, char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(np->out[fr] + np->outlen[fr], OUTSZ - np->outlen[fr], fmt, ap);
+    va_end(ap);
+
+    if (n >= OUTSZ - np->outlen[fr])
+        n = OUTSZ - np->outlen[fr] - 1; /* host is not reading, lose it */
+    np->outlen[fr] += n;
+}
+
+/* evaluate the expression at *sp into *vp, leaving *sp after it.
+ * return 0 if ok, else -1.
+ */
+static int expr(Node *np, char **sp, int *vp)
+{
+    int v, r;
+    char op;
+
+    if (term(np, sp, &v) < 0)
+        return (-1);
+    while (1)
+    {
+        while (**sp == ' ')
+            (*sp)++;
+        op = **sp;
+        if (op != '+' && op != '-')
+            break;
+        (*sp)++;
+        if (term(np, sp, &r) < 0)
+            return (-1);
+        v = op == '+' ? v + r : v - r;
+    }
+    *vp = v;
+    return (0);
+}
+
+/* a product of factors */
+static int term(Node *np, char **sp, int *vp)
+{
+    int v, r;
+    char op;
+
+    if (factor(np, sp, &v) < 0)
+        return (-1);
+    while (1)
+    {
+        while (**sp == ' ')
+            (*sp)++;
+        op = **sp;
+        if (op != '*' && op != '/' && op != '%')
+            break;
+        (*sp)++;
+        if (factor(np, sp, &r) < 0)
+            return (-1);
+        if (op == '*')
+            v *= r;
+        else if (r == 0)
+            return (-1);
+        else
+            v = op == '/' ? v / r : v % r;
+    }
+    *vp = v;
+    return (0);
+}
+
+/* a number, variable, negation or parenthesised expression */
+static int factor(Node *np, char **sp, int *vp)
+{
+    char name[VNAMSZ];
+    char *e;
+
+    while (**sp == ' ')
+        (*sp)++;
+
+    if (**sp == '-')
+    {
+        (*sp)++;
+        if (factor(np, sp, vp) < 0)
+            return (-1);
+        *vp = -*vp;
+        return (0);
+    }
+    if (**sp == '(')
+    {
+        (*sp)++;
+        if (expr(np, sp, vp) < 0)
+            return (-1);
+        while (**sp == ' ')
+            (*sp)++;
+        if (**sp != ')')
+            return (-1);
+        (*sp)++;
+        return (0);
+    }
+    if (getName(sp, name) == 0)
+    {
+        *vp = getVar(np, name);
+        return (0);
+    }
+
+    *vp = strtol(*sp, &e, 0);
+    if (e == *sp)
+        return (-1);
+    *sp = e;
+    return (0);
+}
+
+/* copy the identifier at *sp to name[] and move *sp past it.
+ * return 0 if there was one, else -1.
+ */
+static int getName(char **sp, char name[VNAMSZ])
+{
+    char *s = *sp;
+    int n = 0;
+
+    if (!(*s == '_' || (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')))
+        return (-1);
+    while (*s == '_' || (*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') || (*s >= '0' && *s <= '9'))
+    {
+        if (n < VNAMSZ - 1)
+            name[n++] = *s;
+        s++;
+    }
+    name[n] = '\0';
+    *sp = s;
+    return (0);
+}
+
+/* return the value of np's variable name; the clock runs, unknowns are 0 */
+static int getVar(Node *np, char *name)
+{
+    int i;
+
+    if (!strcmp(name, "clock"))
+        return ((int)(msNow() - np->clock0));
+    for (i = 0; i < np->nvars; i++)
+        if (!strcmp(np->vars[i].name, name))
+            return (np->vars[i].v);
+    return (0);
+}
+
+/* set np's variable name to v, creating it if need be */
+static void setVar(Node *np, char *name, int v)
+{
+    int i;
+
+    if (!strcmp(name, "clock"))
+    {
+        np->clock0 = msNow() - v;
+        return;
+    }
+    for (i = 0; i < np->nvars; i++)
+        if (!strcmp(np->vars[i].name, name))
+            break;
+    if (i == NVARS)
+        return;
+    if (i == np->nvars)
+    {
+        strncpy(np->vars[i].name, name, VNAMSZ - 1);
+        np->nvars++;
+    }
+    np->vars[i].v = v;
+}
+
+/* np has just booted */
+static void resetNode(Node *np)
+{
+    int ntok = np->ntok, npkts = np->npkts, ndups = np->ndups;
+
+    memset(np, 0, sizeof(*np));
+    np->live = 1;
+    np->clock0 = msNow();
+    np->ntok = ntok;
+    np->npkts = npkts;
+    np->ndups = ndups;
+}
+
+/* compute check sum on the given array, as csimcd */
+static int chkSum(Byte p[], int n)
+{
+    Word sum;
+
+    for (sum = 0; n > 0; --n)
+        sum += *p++;
+    while (sum > 255)
+        sum = (sum & 0xff) + (sum >> 8);
+    if (sum == PSYNC)
+        sum = 1;
+    return (sum);
+}
+
+/* copy n bytes of binary data from src to dst escaping PSYNC and PESC.
+ * return bytes in dst.
+ */
+static int escData(Byte dst[], Byte src[], int n)
+{
+    int l;
+
+    for (l = 0; n > 0; --n, src++)
+    {
+        if (*src == PSYNC)
+        {
+            dst[l++] = PESC;
+            dst[l++] = PESYNC;
+        }
+        else if (*src == PESC)
+        {
+            dst[l++] = PESC;
+            dst[l++] = PEESC;
+        }
+        else
+            dst[l++] = *src;
+    }
+
+    return (l);
+}
+
+/* undo escData() from n bytes of src into dst.
+ * return bytes in dst, else -1 if src is not a valid escaped sequence.
+ */
+static int unescData(Byte dst[], Byte src[], int n)
+{
+    int l;
+
+    for (l = 0; n > 0; --n, src++)
+    {
+        if (*src != PESC)
+            dst[l++] = *src;
+        else if (--n > 0 && (*++src == PESYNC || *src == PEESC))
+            dst[l++] = *src == PESYNC ? PSYNC : PESC;
+        else
+            return (-1);
+    }
+
+    return (l);
+}
+
+/* return 1 with probability p */
+static int chance(double p)
+{
+    return (drand48() < p);
+}
+
+/* return a monotonic ms clock */
+static double msNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3 + ts.tv_nsec / 1e6);
+}
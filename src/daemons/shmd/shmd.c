@@ -2,7 +2,28 @@
  * on master machine: rund shmd -m
  * on each remote:    rund shmd -s <master>
  *
- * N.B. byte order and struct layout assumed the same on each end
+ * a slave normally subscribes: it sends WIRE_CODE once with the telwire.c
+ * version and layout it was built with, and the master then pushes frames
+ * whenever telescoped announces a change, and every updms regardless to
+ * keep time and the places which follow from it current. if the layouts
+ * match the frames carry raw bytes of TelStatShm, else if the versions
+ * match they carry its telwire.c encoding, else the master hangs up.
+ * each frame is runs of bytes of that image, see shmd.h. a keyframe holds
+ * the whole image and is sent on subscribing and every KEYMS after that; a
+ * DELTA_CODE frame holds only the bytes which differ from what that slave
+ * was last sent.
+ * with -r a slave instead asks with REQ_CODE every updms and gets back the
+ * first REQLEN raw bytes of TelStatShm each time. that is all of it as it
+ * was before seq, gen and waiters were added, so either end may predate them.
+ * SUB_CODE subscribes to raw frames regardless, for slaves which predate
+ * WIRE_CODE.
+ *
+ * the master queues output to each client and never waits for one. a
+ * subscriber with output still queued is skipped, so the next frame it
+ * gets covers everything since; one which takes nothing for WRTMS, or
+ * lets OUTQMAX build up, is dropped.
+ *
+ * N.B. REQ_CODE and SUB_CODE assume the same layout on each end
  */
 
 #include <errno.h>
@@ -10,13 +31,16 @@
 #include <math.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ipc.h>
 #include <sys/param.h>
+#include <sys/epoll.h>
 #include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -35,28 +59,73 @@
 #include "strops.h"
 #include "telenv.h"
 #include "telstatshm.h"
+#include "telwire.h"
+
+#include "shmd.h"
+
+#define DEFMS 100     /* default update ms */
+#define KEYMS 10000   /* ms between keyframes to each subscriber */
+#define WRTMS 1000    /* drop a client which takes nothing this long */
+#define OUTQMAX 16384 /* drop a client with this much output queued */
+#define RUNGAP 4      /* merge runs separated by fewer equal bytes than this */
+#define NEVS 64       /* epoll events handled per wait */
 
-#define DEFPORT 7624 /* default tcp port */
-#define DEFMS 100    /* default slave-side update ms */
+/* state kept by the master for each client */
+typedef struct
+{
+    int fd;              /* connection */
+    unsigned char in[WIRE_REQLEN]; /* request not yet complete */
+    int inlen;                     /* bytes in in[] */
+    int sub;                       /* set once subscribed */
+    int wire;                      /* set if sent encoded, else raw */
+    unsigned char last[IMGLEN];    /* image of shm as this subscriber has it */
+    double lastsent;     /* ms of last frame */
+    double lastkey;      /* ms of last keyframe */
+    char outq[OUTQMAX];  /* output not yet written */
+    int outlen;          /* bytes in outq */
+    double stalled;      /* ms when outq last became non-empty */
+    long nframes;        /* frames sent */
+    long nbytes;         /* bytes sent */
+    long nskipped;       /* frames skipped because still busy */
+} Client;
 
-#define REQ_CODE 'R' /* client requests shm returned */
 static void usage(void);
 static void masterMode(void);
 static void slaveMode(void);
 static int setupAsMaster(void);
-static int newClient(int acceptfd);
-static int handleClientRequest(int fd);
+static void newClients(int acceptfd);
+static void handleClientRequest(Client *cp);
+static void delClient(Client *cp);
+static void pushFrames(int changed);
+static void subscribe(Client *cp, int wire);
+static int sendFrame(Client *cp, unsigned char *img, int len, int key);
+static int mkRuns(unsigned char *old, unsigned char *new, int n, unsigned char *buf);
+static int queueOut(Client *cp, void *buf, int n);
+static int flushOut(Client *cp);
+static void setWantOut(Client *cp, int on);
+static void *shmWatcher(void *dummy);
 static void shmConnect(void);
-static void slaveMode(void);
+static void pollMode(int fd);
+static void subMode(int fd);
+static void applyRuns(unsigned char *img, int len, unsigned char *buf, int n);
+static void readAll(int fd, void *buf, int n);
+static double nowms(void);
 static int setupAsSlave(void);
 
 static TelStatShm *telstatshmp; /* shared mem status segment */
 static int port = DEFPORT;      /* tcp port to use */
 static int updms = DEFMS;       /* slave update period */
 static int mflag;               /* set if we are to be the master */
+static int rflag;               /* set if slave is to poll with REQ_CODE */
+static int eflag;               /* set if slave wants encoded frames regardless */
 static int vflag;               /* set if want verbose */
 static char *master;            /* if set, we r client connected here */
 static char *me;                /* our program name */
+static Client **clients;        /* master's clients, by fd */
+static int nclients;            /* room in clients[] */
+static int nsubs;               /* number of clients subscribed */
+static int epfd;                /* master's epoll set */
+static int shmpipe[2];          /* shmWatcher() writes here when shm changes */
 
 int main(int ac, char *av[])
 {
@@ -68,6 +137,9 @@ int main(int ac, char *av[])
         for (s = av[0] + 1; *s != '\0'; s++)
             switch (*s)
             {
+            case 'e':
+                eflag++;
+                break;
             case 'm':
                 mflag++;
                 break;
@@ -77,6 +149,9 @@ int main(int ac, char *av[])
                 port = atoi(*++av);
                 ac--;
                 break;
+            case 'r':
+                rflag++;
+                break;
             case 's':
                 if (ac < 2)
                     usage();
@@ -117,10 +192,12 @@ static void usage()
     fprintf(stderr, "Usage: %s [options]\n", me);
     fprintf(stderr, "Purpose: provide remote access to Talon shared memory status\n");
     fprintf(stderr, "Options:\n");
+    fprintf(stderr, " -e:        slave asks for encoded frames even if layouts match\n");
     fprintf(stderr, " -m:        run as master on real system\n");
     fprintf(stderr, " -p port:   use tcp <port>; default is %d\n", DEFPORT);
+    fprintf(stderr, " -r:        slave polls instead of subscribing, for old masters\n");
     fprintf(stderr, " -s master: run as slave, connect to node <master>\n");
-    fprintf(stderr, " -u ms:     slave updates every <ms>; default is %d\n", DEFMS);
+    fprintf(stderr, " -u ms:     update at least every <ms>; default is %d\n", DEFMS);
     fprintf(stderr, " -v:        verbose\n");
 
     exit(1);
@@ -131,52 +208,97 @@ static void usage()
  */
 static void masterMode()
 {
+    struct epoll_event ev;
+    pthread_t tid;
     int acceptfd;
-    fd_set clients;
-    int maxfdp1;
 
     shmConnect();
     acceptfd = setupAsMaster();
-    FD_ZERO(&clients);
-    FD_SET(acceptfd, &clients);
-    maxfdp1 = acceptfd + 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    /* hear about changes from a thread watching shm */
+    if (pipe(shmpipe) < 0)
+    {
+        daemonLog("pipe: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (pthread_create(&tid, NULL, shmWatcher, NULL) != 0)
+    {
+        daemonLog("can not start shm watcher\n");
+        exit(1);
+    }
+    pthread_detach(tid);
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        daemonLog("epoll_create: %s\n", strerror(errno));
+        exit(1);
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = acceptfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, acceptfd, &ev) < 0)
+    {
+        daemonLog("epoll_ctl: %s\n", strerror(errno));
+        exit(1);
+    }
+    ev.data.fd = shmpipe[0];
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, shmpipe[0], &ev) < 0)
+    {
+        daemonLog("epoll_ctl: %s\n", strerror(errno));
+        exit(1);
+    }
 
     while (1)
     {
-        fd_set fds;
+        struct epoll_event evs[NEVS];
+        int changed = 0;
         int i, n;
 
-        fds = clients;
-        if ((n = select(maxfdp1, &fds, NULL, NULL, NULL)) < 0)
+        /* wake at least every updms while anyone is subscribed */
+        if ((n = epoll_wait(epfd, evs, NEVS, nsubs > 0 ? updms : -1)) < 0)
         {
-            daemonLog("select: %s\n", strerror(errno));
+            if (errno == EINTR)
+                continue;
+            daemonLog("epoll_wait: %s\n", strerror(errno));
             exit(1);
         }
 
-        while (n)
+        for (i = 0; i < n; i++)
         {
-            for (i = 0; i < maxfdp1; i++)
+            int fd = evs[i].data.fd;
+            Client *cp;
+
+            if (fd == shmpipe[0])
+            {
+                char buf[64];
+                (void)read(fd, buf, sizeof(buf));
+                changed = 1;
+                continue;
+            }
+            if (fd == acceptfd)
+            {
+                newClients(acceptfd);
+                continue;
+            }
+
+            /* N.B. an earlier event this time may have closed it */
+            if (fd >= nclients || !(cp = clients[fd]))
+                continue;
+            if (evs[i].events & EPOLLOUT)
             {
-                if (FD_ISSET(i, &fds))
+                if (flushOut(cp) < 0)
                 {
-                    if (i == acceptfd)
-                    {
-                        int newfd = newClient(acceptfd);
-                        FD_SET(newfd, &clients);
-                        if (newfd + 1 > maxfdp1)
-                            maxfdp1 = newfd + 1;
-                    }
-                    else
-                    {
-                        if (handleClientRequest(i) < 0)
-                            FD_CLR(i, &clients);
-                    }
-
-                    n--;
-                    break;
+                    daemonLog("write %d: %s\n", fd, strerror(errno));
+                    delClient(cp);
+                    continue;
                 }
             }
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                handleClientRequest(cp);
         }
+
+        pushFrames(changed);
     }
 }
 
@@ -212,144 +334,469 @@ static int setupAsMaster()
         exit(1);
     }
 
-    /* willing to accept connections with a backlog of 5 pending */
-    if (listen(serv_fd, 5) < 0)
+    /* willing to accept connections with a backlog of 64 pending */
+    if (listen(serv_fd, 64) < 0)
     {
         daemonLog("listen: %s\n", strerror(errno));
         exit(1);
     }
 
+    /* so newClients() can take all that are waiting */
+    if (fcntl(serv_fd, F_SETFL, O_NONBLOCK) < 0)
+    {
+        daemonLog("O_NONBLOCK: %s\n", strerror(errno));
+        exit(1);
+    }
+
     /* serv_fd is ready */
     return (serv_fd);
 }
 
-/* new client connecting on acceptfd.
- * return its new private fd, else exit
+/* accept all new clients waiting on acceptfd.
+ * exit if real trouble.
  */
-static int newClient(int acceptfd)
+static void newClients(int acceptfd)
 {
-    struct sockaddr_in cli_socket;
-    int cli_len, cli_fd;
+    while (1)
+    {
+        struct sockaddr_in cli_socket;
+        struct epoll_event ev;
+        socklen_t cli_len;
+        Client *cp;
+        int cli_fd;
+
+        /* get a private connection to new client */
+        cli_len = sizeof(cli_socket);
+        cli_fd = accept(acceptfd, (struct sockaddr *)&cli_socket, &cli_len);
+        if (cli_fd < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED)
+                return;
+            daemonLog("accept: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        /* make nonblocking so we never get hung up */
+        if (fcntl(cli_fd, F_SETFL, O_NONBLOCK) < 0)
+        {
+            daemonLog("O_NONBLOCK: %s\n", strerror(errno));
+            exit(1);
+        }
 
-    /* get a private connection to new client */
-    cli_len = sizeof(cli_socket);
-    cli_fd = accept(acceptfd, (struct sockaddr *)&cli_socket, &cli_len);
-    if (cli_fd < 0)
+        /* room for it */
+        if (cli_fd >= nclients)
+        {
+            int newn = cli_fd + 64;
+            clients = (Client **)realloc(clients, newn * sizeof(Client *));
+            if (!clients)
+            {
+                daemonLog("no memory for %d clients\n", newn);
+                exit(1);
+            }
+            memset(clients + nclients, 0, (newn - nclients) * sizeof(Client *));
+            nclients = newn;
+        }
+        if (!(cp = (Client *)calloc(1, sizeof(Client))))
+        {
+            daemonLog("no memory for client\n");
+            exit(1);
+        }
+        cp->fd = cli_fd;
+        clients[cli_fd] = cp;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = cli_fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, cli_fd, &ev) < 0)
+        {
+            daemonLog("epoll_ctl: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        /* ok */
+        if (vflag)
+        {
+            long addr = ntohl(cli_socket.sin_addr.s_addr);
+            daemonLog("New client at IP %d.%d.%d.%d on fd %d\n", 0xff & (addr >> 24), 0xff & (addr >> 16),
+                      0xff & (addr >> 8), 0xff & (addr >> 0), cli_fd);
+        }
+    }
+}
+
+/* handle whatever client cp has sent us.
+ * close it if EOF or error.
+ */
+static void handleClientRequest(Client *cp)
+{
+    TelStatShm shm;
+    int n;
+
+    n = read(cp->fd, cp->in + cp->inlen, sizeof(cp->in) - cp->inlen);
+    if (n == 0)
     {
-        daemonLog("accept: %s\n", strerror(errno));
-        exit(1);
+        if (vflag)
+            daemonLog("EOF from fd %d\n", cp->fd);
+        delClient(cp);
+        return;
+    }
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR)
+            return;
+        daemonLog("Error from %d: %s\n", cp->fd, strerror(errno));
+        delClient(cp);
+        return;
     }
+    cp->inlen += n;
 
-    /* make nonblocking so we never get hung up */
-    if (fcntl(cli_fd, F_SETFL, O_NONBLOCK) < 0)
+    while (cp->inlen > 0)
     {
-        daemonLog("O_NONBLOCK: %s\n", strerror(errno));
-        exit(1);
+        int used = 1;
+
+        switch (cp->in[0])
+        {
+        case REQ_CODE:
+            (void)telshm_snapshot(telstatshmp, &shm);
+            if (queueOut(cp, &shm, REQLEN) < 0)
+            {
+                daemonLog("fd %d not keeping up\n", cp->fd);
+                delClient(cp);
+                return;
+            }
+            break;
+
+        case SUB_CODE:
+            subscribe(cp, 0);
+            break;
+
+        case WIRE_CODE:
+            if (cp->inlen < WIRE_REQLEN)
+                return; /* rest is on its way */
+            used = WIRE_REQLEN;
+            if (GET32(cp->in + 5) == telwire_layout())
+            {
+                subscribe(cp, 0);
+            }
+            else if (GET32(cp->in + 1) == TELWIRE_VERSION)
+            {
+                subscribe(cp, 1);
+            }
+            else
+            {
+                daemonLog("fd %d uses wire version %u, we use %d\n", cp->fd, GET32(cp->in + 1), TELWIRE_VERSION);
+                delClient(cp);
+                return;
+            }
+            break;
+
+        default:
+            daemonLog("Bogus request code from %d: 0x%x\n", cp->fd, cp->in[0]);
+            delClient(cp);
+            return;
+        }
+
+        cp->inlen -= used;
+        memmove(cp->in, cp->in + used, cp->inlen);
     }
+}
 
-    /* ok */
+/* client cp wants frames, encoded if wire else raw.
+ * its first frame goes out from pushFrames() right after this.
+ */
+static void subscribe(Client *cp, int wire)
+{
+    if (cp->sub)
+        return;
+    cp->sub = 1;
+    cp->wire = wire;
+    cp->lastkey = -KEYMS;
+    nsubs++;
     if (vflag)
+        daemonLog("fd %d subscribed, %s\n", cp->fd, wire ? "encoded" : "raw");
+}
+
+/* close client cp and forget all about it */
+static void delClient(Client *cp)
+{
+    if (cp->sub)
     {
-        long addr = ntohl(cli_socket.sin_addr.s_addr);
-        daemonLog("New client at IP %d.%d.%d.%d on fd %d\n", 0xff & (addr >> 24), 0xff & (addr >> 16),
-                  0xff & (addr >> 8), 0xff & (addr >> 0), cli_fd);
+        if (vflag)
+            daemonLog("fd %d sent %ld frames, %ld bytes, %.0f bytes/frame, %ld skipped\n", cp->fd, cp->nframes,
+                      cp->nbytes, cp->nframes ? (double)cp->nbytes / cp->nframes : 0.0, cp->nskipped);
+        nsubs--;
     }
-    return (cli_fd);
+    clients[cp->fd] = NULL;
+    close(cp->fd); /* also removes it from epfd */
+    free(cp);
 }
 
-/* handle request from client on fd.
- * return 0 if ok, -1 if EOF or error.
+/* send each subscriber whatever it needs now, and drop any client which
+ * has been unable to take anything for too long.
+ * changed is set if shm has changed, else we send only to those not sent
+ *   anything for updms.
  */
-static int handleClientRequest(int fd)
+static void pushFrames(int changed)
 {
-    char c;
+    unsigned char wimg[TELWIRE_LEN];
+    TelStatShm now;
+    int havenow = 0, havewire = 0;
+    double t = nowms();
+    int fd;
+
+    for (fd = 0; fd < nclients; fd++)
+    {
+        Client *cp = clients[fd];
+        int key, ret;
+
+        if (!cp)
+            continue;
+
+        /* still busy with the last frame? */
+        if (cp->outlen > 0)
+        {
+            if (t - cp->stalled > WRTMS)
+            {
+                daemonLog("fd %d stalled, dropping\n", fd);
+                delClient(cp);
+            }
+            else if (cp->sub && changed)
+            {
+                cp->nskipped++;
+            }
+            continue;
+        }
+
+        if (!cp->sub)
+            continue;
+        key = t - cp->lastkey >= KEYMS;
+        if (!changed && !key && t - cp->lastsent < updms)
+            continue;
+
+        /* snapshot and encode at most once for everyone */
+        if (!havenow)
+        {
+            (void)telshm_snapshot(telstatshmp, &now);
+            havenow = 1;
+        }
+        if (cp->wire)
+        {
+            if (!havewire)
+            {
+                telwire_encode(&now, wimg);
+                havewire = 1;
+            }
+            ret = sendFrame(cp, wimg, TELWIRE_LEN, key);
+        }
+        else
+        {
+            ret = sendFrame(cp, (unsigned char *)&now, SHMLEN, key);
+        }
+        if (ret < 0)
+        {
+            daemonLog("write %d: %s\n", fd, strerror(errno));
+            delClient(cp);
+            continue;
+        }
+        cp->lastsent = t;
+        if (key)
+            cp->lastkey = t;
+    }
+}
+
+/* send to subscriber cp the portion of img[len] it does not yet have, or
+ * all of it if key. send nothing if it is already up to date.
+ * return 0 if ok, else -1.
+ */
+static int sendFrame(Client *cp, unsigned char *img, int len, int key)
+{
+    unsigned char buf[MAXFRAME];
+    unsigned char *runs = buf + FRAMEHDR;
     int n;
 
-    n = read(fd, &c, 1);
-    if (n == 0)
+    if (key)
     {
-        if (vflag)
-            daemonLog("EOF from fd %d\n", fd);
-        close(fd);
-        return (-1);
+        PUT16(runs, 0);
+        PUT16(runs + 2, len);
+        memcpy(runs + RUNHDR, img, len);
+        n = RUNHDR + len;
+        buf[0] = cp->wire ? WKEY_CODE : KEY_CODE;
     }
-    if (n < 0)
+    else
     {
-        daemonLog("Error from %d: %s\n", fd, strerror(errno));
-        close(fd);
+        n = mkRuns(cp->last, img, len, runs);
+        if (n == 0)
+            return (0);
+        buf[0] = DELTA_CODE;
+    }
+    buf[1] = 0;
+    PUT16(buf + 2, n);
+    n += FRAMEHDR;
+
+    if (queueOut(cp, buf, n) < 0)
         return (-1);
+    memcpy(cp->last, img, len);
+    cp->nframes++;
+    cp->nbytes += n;
+    return (0);
+}
+
+/* put in buf the runs of new[] which differ from old[], each n long.
+ * runs closer than RUNGAP are sent as one since each costs RUNHDR anyway.
+ * return total length of buf, 0 if old and new are the same.
+ */
+static int mkRuns(unsigned char *old, unsigned char *new, int n, unsigned char *buf)
+{
+    int i, j, end;
+    int len = 0;
+
+    for (i = 0; i < n; i = end)
+    {
+        if (old[i] == new[i])
+        {
+            end = i + 1;
+            continue;
+        }
+        for (end = j = i + 1; j < n && j - end < RUNGAP; j++)
+            if (old[j] != new[j])
+                end = j + 1;
+
+        PUT16(buf + len, i);
+        PUT16(buf + len + 2, end - i);
+        memcpy(buf + len + RUNHDR, new + i, end - i);
+        len += RUNHDR + end - i;
     }
 
-    /* 1 char -- must be REQ_CODE for now */
-    if (c != REQ_CODE)
+    return (len);
+}
+
+/* send n bytes of buf to cp, writing what we can now and queueing the rest.
+ * return 0 if ok, else -1 if error or no room to queue.
+ */
+static int queueOut(Client *cp, void *buf, int n)
+{
+    int w = 0;
+
+    if (cp->outlen == 0)
     {
-        daemonLog("Bogus request code from %d: 0x%x\n", fd, c);
-        close(fd);
-        return (-1);
+        w = write(cp->fd, buf, n);
+        if (w < 0)
+        {
+            if (errno != EAGAIN && errno != EINTR)
+                return (-1);
+            w = 0;
+        }
+        if (w == n)
+            return (0);
     }
-    if (write(fd, telstatshmp, sizeof(TelStatShm)) < 0)
+
+    if (cp->outlen + n - w > OUTQMAX)
     {
-        daemonLog("write %d: %s\n", fd, strerror(errno));
-        close(fd);
+        errno = ENOBUFS;
         return (-1);
     }
+    memcpy(cp->outq + cp->outlen, (char *)buf + w, n - w);
+    if (cp->outlen == 0)
+    {
+        cp->stalled = nowms();
+        setWantOut(cp, 1);
+    }
+    cp->outlen += n - w;
+    return (0);
+}
 
-    /* ok */
+/* write as much of cp's queued output as it will take now.
+ * return 0 if ok, else -1.
+ */
+static int flushOut(Client *cp)
+{
+    int w;
+
+    if (cp->outlen == 0)
+        return (0);
+    w = write(cp->fd, cp->outq, cp->outlen);
+    if (w < 0)
+        return (errno == EAGAIN || errno == EINTR ? 0 : -1);
+
+    cp->outlen -= w;
+    memmove(cp->outq, cp->outq + w, cp->outlen);
+    if (cp->outlen == 0)
+        setWantOut(cp, 0);
+    else if (w > 0)
+        cp->stalled = nowms();
     return (0);
 }
 
+/* set whether epoll is to tell us when cp can take more output */
+static void setWantOut(Client *cp, int on)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = on ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.fd = cp->fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, cp->fd, &ev) < 0)
+    {
+        daemonLog("epoll_ctl: %s\n", strerror(errno));
+        exit(1);
+    }
+}
+
+/* thread that waits for telescoped to change shm and says so on shmpipe.
+ * N.B. touches nothing else.
+ */
+static void *shmWatcher(void *dummy)
+{
+    unsigned int gen = telstatshmp->gen;
+
+    while (1)
+        if (telshm_wait(telstatshmp, &gen, 0, -1) > 0 && write(shmpipe[1], "", 1) < 0)
+            break;
+
+    return (NULL);
+}
+
 /* connect to telstatshm, creating if necessary.
  * exit if trouble.
  */
 static void shmConnect()
 {
-    int len = sizeof(TelStatShm);
-    int shmid;
-    long addr;
-
-    /* open/create */
-    shmid = shmget(TELSTATSHMKEY, len, 0664);
-    if (shmid < 0)
-    {
-        if (vflag)
-            daemonLog("no existing shm -- trying to create\n");
-        shmid = shmget(TELSTATSHMKEY, len, 0664 | IPC_CREAT);
-        if (shmid < 0)
-        {
-            daemonLog("shm: %s\n", strerror(errno));
-            exit(1);
-        }
-    }
+    int old;
 
-    /* connect */
-    addr = (long)shmat(shmid, (void *)0, 0);
-    if (addr == -1)
+    /* open/create, replacing one left by an older version */
+    telstatshmp = telshm_attach(1, &old);
+    if (!telstatshmp)
     {
-        daemonLog("shmat: %s", strerror(errno));
+        daemonLog("shm: %s\n", telshm_error());
         exit(1);
     }
-
-    /* global */
-    telstatshmp = (TelStatShm *)addr;
+    if (old)
+        daemonLog("Replaced old shm of different size\n");
     if (vflag)
         daemonLog("connected to shm. Size = %d\n", sizeof(TelStatShm));
 }
 
 /* run as slave connected to master/port.
- * create new TelStatShm.
- * query master every udphz.
+ * create new TelStatShm and keep it current.
  */
 static void slaveMode()
 {
-    char c = REQ_CODE;
-    TelStatShm tmpshm;
-    char *ptr;
-    int tot, n;
     int fd;
 
     shmConnect();
     fd = setupAsSlave();
 
+    if (rflag)
+        pollMode(fd);
+    else
+        subMode(fd);
+}
+
+/* query master every updms. */
+static void pollMode(int fd)
+{
+    char c = REQ_CODE;
+    TelStatShm tmpshm;
+
     while (1)
     {
         if (write(fd, &c, 1) < 0)
@@ -357,20 +804,134 @@ static void slaveMode()
             daemonLog("write: %s\n", strerror(errno));
             exit(1);
         }
-        ptr = (char *)&tmpshm;
-        for (tot = 0; tot < sizeof(TelStatShm); tot += n)
+        readAll(fd, &tmpshm, REQLEN);
+        telshm_publish(telstatshmp, &tmpshm); /* all at once */
+        usleep(updms * 1000);
+    }
+}
+
+/* subscribe and apply each frame the master pushes.
+ * we keep our own image so each frame reaches shm as one change.
+ */
+static void subMode(int fd)
+{
+    unsigned char req[WIRE_REQLEN];
+    unsigned char hdr[FRAMEHDR];
+    unsigned char buf[MAXFRAME];
+    unsigned char img[IMGLEN];
+    TelStatShm tmpshm;
+    int len = 0; /* image length, 0 until first keyframe */
+    int wire = 0;
+    int n;
+
+    req[0] = WIRE_CODE;
+    PUT32(req + 1, TELWIRE_VERSION);
+    PUT32(req + 5, eflag ? 0 : telwire_layout());
+    if (write(fd, req, sizeof(req)) < 0)
+    {
+        daemonLog("write: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    memset(&tmpshm, 0, sizeof(tmpshm));
+    while (1)
+    {
+        readAll(fd, hdr, FRAMEHDR);
+        n = GET16(hdr + 2);
+        if (n > (int)sizeof(buf))
+        {
+            daemonLog("Bogus frame length from master: %d\n", n);
+            exit(1);
+        }
+        readAll(fd, buf, n);
+
+        switch (hdr[0])
+        {
+        case KEY_CODE:
+            wire = 0;
+            len = SHMLEN;
+            break;
+        case WKEY_CODE:
+            if (!wire && vflag)
+                daemonLog("Master is sending encoded frames\n");
+            wire = 1;
+            len = TELWIRE_LEN;
+            break;
+        case DELTA_CODE:
+            if (!len)
+                continue; /* can not happen, but deltas need a base */
+            break;
+        default:
+            daemonLog("Bogus frame type from master: 0x%x\n", hdr[0]);
+            exit(1);
+        }
+
+        applyRuns(img, len, buf, n);
+        if (wire)
+            telwire_decode(img, &tmpshm);
+        else
+            memcpy(&tmpshm, img, SHMLEN);
+        telshm_publish(telstatshmp, &tmpshm);
+    }
+}
+
+/* apply the n bytes of runs in buf to img[len].
+ * exit if they make no sense.
+ */
+static void applyRuns(unsigned char *img, int len, unsigned char *buf, int n)
+{
+    int i, off, rl;
+
+    for (i = 0; i < n; i += RUNHDR + rl)
+    {
+        off = i + RUNHDR <= n ? GET16(buf + i) : 0;
+        rl = i + RUNHDR <= n ? GET16(buf + i + 2) : n;
+        if (i + RUNHDR + rl > n || off + rl > len)
+        {
+            daemonLog("Bogus run from master: %d bytes at %d\n", rl, off);
+            exit(1);
+        }
+        memcpy(img + off, buf + i + RUNHDR, rl);
+    }
+}
+
+/* read exactly n bytes from fd into buf.
+ * exit if trouble, rund will start us again.
+ */
+static void readAll(int fd, void *buf, int n)
+{
+    char *ptr = (char *)buf;
+    int tot, r;
+
+    for (tot = 0; tot < n; tot += r)
+    {
+        if ((r = read(fd, ptr + tot, n - tot)) < 0)
         {
-            if ((n = read(fd, ptr + tot, sizeof(TelStatShm) - tot)) < 0)
+            if (errno == EINTR)
             {
-                daemonLog("read: %s\n", strerror(errno));
-                exit(1);
+                r = 0;
+                continue;
             }
+            daemonLog("read: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (r == 0)
+        {
+            daemonLog("EOF from master\n");
+            exit(1);
         }
-        memcpy(telstatshmp, &tmpshm, sizeof(TelStatShm)); /* all at once */
-        usleep(updms * 1000);
     }
 }
 
+/* return a monotonic time in ms */
+static double nowms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6);
+}
+
 /* connect to the master shmd.
  * exit if trouble, else return the fd.
  */
@@ -0,0 +1,43 @@
+/* what shmd master and slaves say to each other.
+ * see shmd.c for how these are used.
+ *
+ * all counts on the wire are little-endian. TelStatShm itself is sent
+ * either as raw bytes, only when both ends lay it out identically, or
+ * encoded by telwire.c.
+ */
+
+#define DEFPORT 7624 /* default tcp port */
+
+/* requests from client to master */
+#define REQ_CODE 'R'  /* client requests raw shm returned */
+#define SUB_CODE 'S'  /* client subscribes to raw frames */
+#define WIRE_CODE 'W' /* client subscribes; followed by version and layout */
+#define WIRE_REQLEN 9 /* bytes in a WIRE_CODE request */
+
+/* frame types from master to subscribers */
+#define KEY_CODE 'K'   /* frame holds all of shm, raw */
+#define WKEY_CODE 'k'  /* frame holds all of shm, encoded */
+#define DELTA_CODE 'D' /* frame holds changes since the last frame */
+
+#define SHMLEN ((int)offsetof(TelStatShm, gen))  /* raw portion we send, see telshm.c */
+#define IMGLEN MAX(SHMLEN, TELWIRE_LEN)          /* room for shm either way */
+
+/* REQ_CODE replies are sizeof(TelStatShm) as it was before seq, gen and
+ * waiters were added: SHMLEN padded out to the alignment of the struct.
+ */
+#define SHMALIGN ((int)__alignof__(TelStatShm))
+#define REQLEN ((SHMLEN + SHMALIGN - 1) / SHMALIGN * SHMALIGN)
+#define MAXFRAME (FRAMEHDR + 2 * IMGLEN + RUNHDR) /* worst case frame size */
+
+/* each frame is FRAMEHDR bytes: the type, unused, then a 2-byte length of
+ * the runs which follow. each run is RUNHDR bytes: a 2-byte offset into
+ * the image of shm, a 2-byte length, then that many bytes.
+ */
+#define FRAMEHDR 4
+#define RUNHDR 4
+
+/* little-endian 16 and 32 bit counts at unsigned char *p */
+#define GET16(p) ((p)[0] | (p)[1] << 8)
+#define PUT16(p, v) ((p)[0] = (v), (p)[1] = (v) >> 8)
+#define GET32(p) ((unsigned int)GET16(p) | (unsigned int)GET16((p) + 2) << 16)
+#define PUT32(p, v) (PUT16(p, (v)&0xffff), PUT16((p) + 2, (v) >> 16))
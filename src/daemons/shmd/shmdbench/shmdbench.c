@@ -0,0 +1,335 @@
+/* measure how quickly a shmd master fans changes out to many subscribers.
+ * we play telescoped, changing shm and announcing it, and many slaves at
+ * once, timing how long each takes to see the change.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/param.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "telstatshm.h"
+#include "telwire.h"
+
+#include "../shmd.h"
+
+#define TIMEOUTMS 2000 /* give up on a change after this long */
+
+/* one simulated slave */
+typedef struct
+{
+    int fd;             /* connection to master */
+    unsigned char in[MAXFRAME];  /* input not yet a whole frame */
+    int inlen;                   /* bytes in in[] */
+    unsigned char img[IMGLEN];   /* image of shm as sent */
+    int wire;                    /* set if img is encoded, else raw */
+    TelStatShm copy;             /* shm as we have it */
+    int nframes;        /* frames received */
+    double seen;        /* ms when copy first showed the current change */
+} Slave;
+
+static void change(TelStatShm *tp, int stamp);
+static TelStatShm *shmConnect(void);
+static int slaveConnect(int port, int encoded, int slow);
+static int readFrames(Slave *sp);
+static int cmpd(const void *p1, const void *p2);
+static double nowms(void);
+
+int main(int ac, char *av[])
+{
+    int port = ac > 1 ? atoi(av[1]) : DEFPORT;
+    int nslaves = ac > 2 ? atoi(av[2]) : 200;
+    int nchanges = ac > 3 ? atoi(av[3]) : 200;
+    int nslow = ac > 4 ? atoi(av[4]) : 0;
+    int encoded = ac > 5 ? atoi(av[5]) : 0;
+    struct epoll_event ev, *evs;
+    double *dly, *all;
+    int nlat = 0, nlost = 0, ndropped = 0;
+    TelStatShm *tp;
+    Slave *slaves;
+    int *slowfds;
+    int epfd;
+    int i, c;
+
+    if (nslaves <= 0 || nchanges <= 0 || nslow < 0)
+    {
+        fprintf(stderr, "Usage: %s [port [nslaves [nchanges [nslow [encoded]]]]]\n", av[0]);
+        exit(1);
+    }
+
+    tp = shmConnect();
+    slaves = (Slave *)calloc(nslaves, sizeof(Slave));
+    slowfds = (int *)calloc(nslow + 1, sizeof(int));
+    evs = (struct epoll_event *)calloc(nslaves, sizeof(struct epoll_event));
+    dly = (double *)calloc(nslaves * nchanges, sizeof(double));
+    all = (double *)calloc(nchanges, sizeof(double));
+    if (!slaves || !slowfds || !evs || !dly || !all)
+    {
+        fprintf(stderr, "No memory\n");
+        exit(1);
+    }
+    if ((epfd = epoll_create1(0)) < 0)
+    {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    /* subscribe everyone. slow ones have tiny buffers, ask for many
+     * whole copies and never read any of them.
+     */
+    for (i = 0; i < nslaves; i++)
+    {
+        slaves[i].fd = slaveConnect(port, encoded, 0);
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &slaves[i];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, slaves[i].fd, &ev) < 0)
+        {
+            perror("epoll_ctl");
+            exit(1);
+        }
+    }
+    for (i = 0; i < nslow; i++)
+    {
+        char reqs[4000];
+
+        slowfds[i] = slaveConnect(port, 0, 1);
+        memset(reqs, REQ_CODE, sizeof(reqs));
+        (void)write(slowfds[i], reqs, sizeof(reqs));
+    }
+
+    /* wait for everyone's keyframe */
+    for (i = 0; i < nslaves; i++)
+    {
+        double t0 = nowms();
+        while (slaves[i].nframes == 0)
+        {
+            if (readFrames(&slaves[i]) < 0 || nowms() - t0 > TIMEOUTMS)
+            {
+                fprintf(stderr, "Slave %d got no keyframe\n", i);
+                exit(1);
+            }
+            usleep(1000);
+        }
+    }
+
+    printf("%d slaves, %d slow, %d changes, %s\n", nslaves, nslow, nchanges, encoded ? "encoded" : "raw");
+
+    for (c = 0; c < nchanges; c++)
+    {
+        int stamp = tp->telstateidx + 1;
+        int nleft = nslaves;
+        double t0;
+
+        change(tp, stamp);
+        t0 = nowms();
+        telshm_notify(tp);
+
+        while (nleft > 0 && nowms() - t0 < TIMEOUTMS)
+        {
+            int n = epoll_wait(epfd, evs, nslaves, 100);
+
+            for (i = 0; i < n; i++)
+            {
+                Slave *sp = (Slave *)evs[i].data.ptr;
+
+                if (readFrames(sp) < 0)
+                {
+                    fprintf(stderr, "Slave on fd %d lost its connection\n", sp->fd);
+                    exit(1);
+                }
+                if (sp->copy.telstateidx == stamp && sp->seen < t0)
+                {
+                    sp->seen = nowms();
+                    dly[nlat++] = sp->seen - t0;
+                    nleft--;
+                }
+            }
+        }
+        nlost += nleft;
+        all[c] = nowms() - t0;
+
+        /* let the master go idle again so each change is separate */
+        usleep(20000);
+    }
+
+    /* see whether the master gave up on the slow ones */
+    usleep(1500000);
+    for (i = 0; i < nslow; i++)
+    {
+        char buf[4096];
+        int n;
+
+        fcntl(slowfds[i], F_SETFL, O_NONBLOCK);
+        while ((n = read(slowfds[i], buf, sizeof(buf))) > 0)
+            continue;
+        if (n == 0 || (n < 0 && errno == ECONNRESET))
+            ndropped++;
+    }
+
+    qsort(dly, nlat, sizeof(double), cmpd);
+    qsort(all, nchanges, sizeof(double), cmpd);
+    printf("%-12s %9s %9s %9s %9s\n", "ms", "min", "median", "99%", "max");
+    if (nlat > 0)
+        printf("%-12s %9.3f %9.3f %9.3f %9.3f\n", "per slave", dly[0], dly[nlat / 2], dly[nlat * 99 / 100],
+               dly[nlat - 1]);
+    printf("%-12s %9.3f %9.3f %9.3f %9.3f\n", "all slaves", all[0], all[nchanges / 2], all[nchanges * 99 / 100],
+           all[nchanges - 1]);
+    printf("%d of %d deliveries missing\n", nlost, nslaves * nchanges);
+    if (nslow > 0)
+        printf("%d of %d slow slaves dropped by master\n", ndropped, nslow);
+
+    return (nlost > 0);
+}
+
+/* change shm the way telescoped does when the mount is moving */
+static void change(TelStatShm *tp, int stamp)
+{
+    int i;
+
+    telshm_wbegin(tp);
+    for (i = 0; i < TEL_NM; i++)
+    {
+        tp->minfo[i].cpos = stamp * 1e-4 + i;
+        tp->minfo[i].dpos = stamp * 1e-4 + i;
+        tp->minfo[i].cvel = stamp * 1e-6;
+    }
+    tp->telstateidx = stamp;
+    telshm_wend(tp);
+}
+
+/* connect to telstatshm, creating if necessary */
+static TelStatShm *shmConnect()
+{
+    int shmid = shmget(TELSTATSHMKEY, sizeof(TelStatShm), 0664 | IPC_CREAT);
+    void *addr;
+
+    if (shmid < 0)
+    {
+        perror("shmget");
+        exit(1);
+    }
+    if ((addr = shmat(shmid, NULL, 0)) == (void *)-1)
+    {
+        perror("shmat");
+        exit(1);
+    }
+    return ((TelStatShm *)addr);
+}
+
+/* connect a new slave to the master on localhost and subscribe.
+ * if encoded ask for encoded frames, else raw.
+ * if slow make its receive buffer tiny and subscribe the old way.
+ * return fd, nonblocking.
+ */
+static int slaveConnect(int port, int encoded, int slow)
+{
+    unsigned char req[WIRE_REQLEN];
+    int rcvbuf = 1024;
+    struct sockaddr_in sa;
+    int fd, n;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket");
+        exit(1);
+    }
+    if (slow && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+    {
+        perror("SO_RCVBUF");
+        exit(1);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sa.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    req[0] = slow ? SUB_CODE : WIRE_CODE;
+    PUT32(req + 1, TELWIRE_VERSION);
+    PUT32(req + 5, encoded ? 0 : telwire_layout());
+    n = slow ? 1 : WIRE_REQLEN;
+    if (write(fd, req, n) != n)
+    {
+        perror("write");
+        exit(1);
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return (fd);
+}
+
+/* read what sp's master has sent and apply each whole frame to sp->copy.
+ * return 0 if ok, or -1 if EOF or error.
+ */
+static int readFrames(Slave *sp)
+{
+    int n;
+
+    while ((n = read(sp->fd, sp->in + sp->inlen, sizeof(sp->in) - sp->inlen)) > 0)
+    {
+        sp->inlen += n;
+        while (sp->inlen >= FRAMEHDR)
+        {
+            int len = FRAMEHDR + GET16(sp->in + 2);
+            int i;
+
+            if (len > (int)sizeof(sp->in))
+            {
+                fprintf(stderr, "Bogus frame length %d\n", len);
+                exit(1);
+            }
+            if (sp->inlen < len)
+                break;
+
+            if (sp->in[0] == WKEY_CODE)
+                sp->wire = 1;
+            else if (sp->in[0] == KEY_CODE)
+                sp->wire = 0;
+            for (i = FRAMEHDR; i < len; i += RUNHDR + GET16(sp->in + i + 2))
+                memcpy(sp->img + GET16(sp->in + i), sp->in + i + RUNHDR, GET16(sp->in + i + 2));
+            if (sp->wire)
+                telwire_decode(sp->img, &sp->copy);
+            else
+                memcpy(&sp->copy, sp->img, SHMLEN);
+
+            sp->inlen -= len;
+            memmove(sp->in, sp->in + len, sp->inlen);
+            sp->nframes++;
+        }
+    }
+
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR))
+        return (-1);
+    return (0);
+}
+
+static int cmpd(const void *p1, const void *p2)
+{
+    double d = *(double *)p1 - *(double *)p2;
+    return (d < 0 ? -1 : d > 0 ? 1 : 0);
+}
+
+/* return a monotonic time in ms */
+static double nowms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6);
+}
@@ -22,6 +22,7 @@
 #include "running.h"
 #include "strops.h"
 #include "telenv.h"
+#include "telring.h"
 #include "telstatshm.h"
 #include "virmc.h"
 
@@ -103,7 +104,7 @@ int axis_home(MotorInfo *mip, FifoId fid, int first)
         /* things seem to be proceeding all right. get status.
          * stop if see < 0, done when see 0, else just report.
          */
-        if (!csiIsReady(cfd))
+        if (!csiCfdReady(mip))
             return (1);
 
         if (csi_r(cfd, buf, sizeof(buf)) <= 0)
@@ -337,7 +338,7 @@ int axis_limits(MotorInfo *mip, FifoId fid, int first)
         /* things seem to be proceeding all right. get status if ready;
          * stop if see < 0, done when see 0, else just report.
          */
-        if (!csiIsReady(cfd))
+        if (!csiCfdReady(mip))
             return (1);
         if (csi_r(cfd, buf, sizeof(buf)) <= 0)
             return (1);
@@ -378,9 +379,17 @@ int axis_limits(MotorInfo *mip, FifoId fid, int first)
             recordLimit(mip, found[i]);
             if (mip->haveenc)
             {
-                /* get motor and enc positions to find scale */
-                motbeg[i] = csi_rix(cfd, "=mpos;");
-                encbeg[i] = csi_rix(cfd, "=epos;");
+                /* get motor and enc positions together to find scale */
+                CSISnap snap;
+
+                if (csi_snap(cfd, &snap) < 0)
+                {
+                    csiStop(mip, 1);
+                    fifoWrite(fid, -6, "Axis %d: can not read positions", axis);
+                    return (-1);
+                }
+                motbeg[i] = snap.mpos;
+                encbeg[i] = snap.epos;
             }
 
             /* turn around */
@@ -409,10 +418,15 @@ int axis_limits(MotorInfo *mip, FifoId fid, int first)
             if (mip->haveenc)
             {
                 /* get motor and enc again and compute/record scale */
-                int motend, encend;
-                motend = csi_rix(cfd, "=mpos;");
-                encend = csi_rix(cfd, "=epos;");
-                recordStep(mip, motend - motbeg[i], encend - encbeg[i]);
+                CSISnap snap;
+
+                if (csi_snap(cfd, &snap) < 0)
+                {
+                    csiStop(mip, 1);
+                    fifoWrite(fid, -6, "Axis %d: can not read positions", axis);
+                    return (-1);
+                }
+                recordStep(mip, snap.mpos - motbeg[i], snap.epos - encbeg[i]);
             }
 
             /* would like to back away but caller often issues stop and
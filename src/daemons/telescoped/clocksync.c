@@ -0,0 +1,109 @@
+/* model how a controller clock runs against ours.
+ *
+ * each snapshot tells us what a node clock read at about the middle of the
+ * round trip that fetched it. we fit a straight line, by least squares, to
+ * those at least CS_MINMS apart over the last CS_MAXN of them, so the offset
+ * and rate are known well enough to predict the node clock from ours between
+ * readings and to see one running fast or slow long before it is far off.
+ * the readings are each tens of ms uncertain, so we also find how uncertain
+ * the rate is from how far they scatter about the line.
+ * a reading far from the line means the clock was reset, so we start over.
+ */
+
+#include <math.h>
+
+#include "clocksync.h"
+
+static void fit(ClockSync *cs);
+
+/* forget all readings, as when the node clock is reset */
+void cs_reset(ClockSync *cs)
+{
+    cs->n = cs->next = 0;
+    cs->off = cs->last = cs->rms = 0;
+    cs->rate = cs->rse = 1;
+}
+
+/* add the reading node of the node clock taken at host, both ms.
+ * return 0 if it fits, else -1 if it was CS_JUMPMS or more off so the fit
+ *   starts over from it.
+ */
+int cs_add(ClockSync *cs, double host, double node)
+{
+    double last;
+    int prev;
+
+    if (cs->n > 0)
+    {
+        last = node - cs_predict(cs, host);
+        if (fabs(last) >= CS_JUMPMS)
+        {
+            cs_reset(cs);
+            cs_add(cs, host, node);
+            cs->last = last;
+            return (-1);
+        }
+        cs->last = last;
+
+        /* only keep those far enough apart to say something about rate */
+        prev = (cs->next + CS_MAXN - 1) % CS_MAXN;
+        if (host - cs->h0 - cs->h[prev] < CS_MINMS)
+            return (0);
+    }
+    else
+    {
+        cs->h0 = host;
+        cs->c0 = node;
+    }
+
+    cs->h[cs->next] = host - cs->h0;
+    cs->c[cs->next] = node - cs->c0;
+    cs->next = (cs->next + 1) % CS_MAXN;
+    if (cs->n < CS_MAXN)
+        cs->n++;
+    fit(cs);
+
+    return (0);
+}
+
+/* return what the node clock reads at host, ms */
+double cs_predict(ClockSync *cs, double host)
+{
+    return (cs->c0 + cs->off + cs->rate * (host - cs->h0));
+}
+
+/* fit off and rate to the readings held, and find how well they fit */
+static void fit(ClockSync *cs)
+{
+    double mh = 0, mc = 0, shh = 0, shc = 0, e2 = 0;
+    int i;
+
+    /* about the means, since h grows for as long as the clock is not reset */
+    for (i = 0; i < cs->n; i++)
+    {
+        mh += cs->h[i];
+        mc += cs->c[i];
+    }
+    mh /= cs->n;
+    mc /= cs->n;
+    for (i = 0; i < cs->n; i++)
+    {
+        shh += (cs->h[i] - mh) * (cs->h[i] - mh);
+        shc += (cs->h[i] - mh) * (cs->c[i] - mc);
+    }
+
+    /* with just one, assume it keeps time with us */
+    cs->rate = shh > 0 ? shc / shh : 1;
+    cs->off = mc - cs->rate * mh;
+
+    for (i = 0; i < cs->n; i++)
+    {
+        double e = cs->c[i] - cs->off - cs->rate * cs->h[i];
+
+        e2 += e * e;
+    }
+    cs->rms = sqrt(e2 / cs->n);
+
+    /* two points always fit, so until there are more rate could be anything */
+    cs->rse = cs->n > 2 ? sqrt(e2 / (cs->n - 2) / shh) : 1;
+}
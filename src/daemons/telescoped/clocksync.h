@@ -0,0 +1,30 @@
+/* include file for clocksync.c, which models how a controller clock runs
+ * against ours from timestamped readings of it.
+ */
+
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#define CS_MAXN 64     /* most readings fitted */
+#define CS_MINMS 1000  /* least host ms between readings fitted */
+#define CS_JUMPMS 250  /* a reading this far off the fit restarts it, ms */
+
+/* node clock = c0 + off + rate * (host - h0), all ms */
+typedef struct
+{
+    int n, next;        /* readings held, where the next goes */
+    double h[CS_MAXN];  /* host ms of each, less h0 */
+    double c[CS_MAXN];  /* node clock of each, less c0 */
+    double h0, c0;      /* first reading since the last restart */
+    double off, rate;   /* fit */
+    double rms;         /* rms difference of the readings from it, ms */
+    double rse;         /* standard error of rate */
+    double last;        /* difference of the latest reading from the fit before it, ms */
+} ClockSync;
+
+/* clocksync.c */
+extern void cs_reset(ClockSync *cs);
+extern int cs_add(ClockSync *cs, double host, double node);
+extern double cs_predict(ClockSync *cs, double host);
+
+#endif // CLOCKSYNC_H
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "P_.h"
@@ -15,12 +16,17 @@
 #include "cliserv.h"
 #include "configfile.h"
 #include "csimc.h"
+#include "linebuf.h"
 #include "misc.h"
 #include "running.h"
 #include "strops.h"
 #include "telenv.h"
+#include "telring.h"
+#include "telstats.h"
 #include "telstatshm.h"
+#include "virmc.h"
 
+#include "clocksync.h"
 #include "teled.h"
 
 /* info about each CSIMC connected.
@@ -28,6 +34,20 @@
  */
 CSIMCInfo csii[NNODES];
 
+/* values from the latest csiSnap() of each motor.
+ * index with mip - telstatshmp->minfo, or use MIPSNAP().
+ */
+CSISnap csisnap[TEL_NM];
+static double snapms[TEL_NM]; /* monotonic ms when each csisnap[] was taken */
+static ClockSync clksync[TEL_NM]; /* how each node clock runs against monoms() */
+
+/* readiness of each command channel from the last csiPollReady(), if polled */
+static char cfdpolled[TEL_NM];
+static char cfdready[TEL_NM];
+
+static double monoms(void);
+static void clockAdd(int i, double host);
+
 static char ipme[] = "127.0.0.1";
 static char *host;
 static int port = CSIMCPORT;
@@ -71,14 +91,14 @@ void csiInit()
     }
 }
 
-/* open addr using host and port.
+/* open addr using host and port, ahead of other csimcd clients.
  * return fd else -1.
  */
 int csiOpen(int addr)
 {
     if (!virtual_mode)
     {
-        return (csi_open(host, port, addr));
+        return (csi_popen(host, port, addr, CSI_PRI_CTRL));
     }
     else
     {
@@ -112,7 +132,7 @@ void csiiOpen(MotorInfo *mip)
     {
 
         int addr = mip->axis;
-        int fd;
+        int fd, v;
 
         fd = csiOpen(addr);
         if (fd < 0)
@@ -129,6 +149,13 @@ void csiiOpen(MotorInfo *mip)
             exit(1);
         }
         MIPSFD(mip) = fd;
+
+        /* find out here, off the control path, whether the node takes
+         * GETVAR/SETVAR, as csiSetvar() uses the shell until it is known to.
+         */
+        (void)csi_getvar(fd, "clock", &v);
+
+        fifoWatch(MIPCFD(mip), 1);
     }
 }
 
@@ -140,6 +167,7 @@ void csiiClose(MotorInfo *mip)
     if (!virtual_mode)
     {
 
+        fifoWatch(MIPCFD(mip), 0);
         csiClose(MIPCFD(mip));
         MIPCFD(mip) = 0;
 
@@ -155,6 +183,10 @@ int csiIsReady(int fd)
     {
         return 1;
     }
+    else if (lb_pending(fd))
+    {
+        return 1; /* csi_r() already has it */
+    }
     else
     {
 
@@ -175,6 +207,237 @@ int csiIsReady(int fd)
     }
 }
 
+/* csi_rix() the query cmd on fd, timing the round trip.
+ * return its reply.
+ */
+int csiRix(int fd, char *cmd)
+{
+    uint64_t t0 = telstats_now();
+    int v = csi_rix(fd, "%s", cmd);
+
+    tdstat(ST_CSIXCHG, t0);
+    return (v);
+}
+
+/* set name to v on fd with csi_setvar(), timing the round trip, once the
+ * node is known to take it. until then, rather than wait while csimcd finds
+ * out, just write the assignment to the shell, which runs it in turn.
+ * return 0 if ok, else -1.
+ */
+int csiSetvar(int fd, char *name, int v)
+{
+    uint64_t t0;
+    int s;
+
+    if (csi_hasvar(fd) <= 0)
+        return (csi_w(fd, "%s=%d;", name, v) < 0 ? -1 : 0);
+
+    t0 = telstats_now();
+    s = csi_setvar(fd, name, v);
+    tdstat(ST_CSIXCHG, t0);
+    return (s);
+}
+
+/* refresh MIPSNAP(mip) with one round trip on its status channel.
+ * return 0 if ok, else -1.
+ */
+int csiSnap(MotorInfo *mip)
+{
+    CSISnap *sp = MIPSNAP(mip);
+    uint64_t t0;
+    double m0;
+
+    if (virtual_mode)
+    {
+        sp->clock = vmcGetClock(mip->axis);
+        sp->mpos = sp->epos = vmcGetPosition(mip->axis);
+        sp->mvel = vmcGetVelocity(mip->axis);
+        sp->iedge = sp->ilevel = 0;
+        snapms[mip - telstatshmp->minfo] = monoms();
+        clockAdd(mip - telstatshmp->minfo, snapms[mip - telstatshmp->minfo]);
+        return (0);
+    }
+
+    t0 = telstats_now();
+    m0 = monoms();
+    if (csi_snap(MIPSFD(mip), sp) < 0)
+    {
+        tdlog("Axis %d: can not read snapshot", mip->axis);
+        return (-1);
+    }
+    tdstat(ST_CSISNAP, t0);
+
+    snapms[mip - telstatshmp->minfo] = monoms();
+    clockAdd(mip - telstatshmp->minfo, (m0 + snapms[mip - telstatshmp->minfo]) / 2);
+    return (0);
+}
+
+/* refresh csisnap[] of every motor we have with all queries in flight at
+ * once, so this takes as long as the slowest node rather than their sum.
+ * set ok[] to 1 for each motor whose snapshot is now current, else 0.
+ * return 0 if all ok, else -1.
+ */
+int csiSnapAll(int ok[TEL_NM])
+{
+    int fd[TEL_NM], mi[TEL_NM], got[TEL_NM];
+    CSISnap snap[TEL_NM];
+    int i, n, ret = 0;
+    uint64_t t0;
+    double m0, m1;
+
+    /* motors in use, including focus once it is open */
+    for (n = i = 0; i < TEL_NM; i++)
+    {
+        MotorInfo *mip = &telstatshmp->minfo[i];
+
+        ok[i] = 0;
+        if (!mip->have)
+            continue;
+        if (virtual_mode)
+        {
+            ok[i] = csiSnap(mip) == 0;
+            continue;
+        }
+        if (!MIPSFD(mip))
+            continue;
+        fd[n] = MIPSFD(mip);
+        mi[n++] = i;
+    }
+
+    t0 = telstats_now();
+    m0 = monoms();
+    if (n > 0 && csi_snapv(fd, snap, got, n) < 0)
+        ret = -1;
+    if (n > 0)
+        tdstat(ST_CSISNAP, t0);
+    m1 = monoms();
+
+    for (i = 0; i < n; i++)
+    {
+        MotorInfo *mip = &telstatshmp->minfo[mi[i]];
+
+        if (!got[i])
+        {
+            tdlog("Axis %d: can not read snapshot", mip->axis);
+            continue;
+        }
+        csisnap[mi[i]] = snap[i];
+        snapms[mi[i]] = m1;
+        clockAdd(mi[i], (m0 + m1) / 2);
+        ok[mi[i]] = 1;
+    }
+
+    return (ret);
+}
+
+/* return ms since MIPSNAP(mip) was last refreshed */
+double csiSnapAge(MotorInfo *mip)
+{
+    return (monoms() - snapms[mip - telstatshmp->minfo]);
+}
+
+/* forget how the clock of mip has been running, as when it is reset */
+void csiClockReset(MotorInfo *mip)
+{
+    cs_reset(&clksync[mip - telstatshmp->minfo]);
+}
+
+/* return what the clock of mip reads now, ms, from how it has been running
+ * against ours according to its snapshots.
+ */
+double csiClock(MotorInfo *mip)
+{
+    return (cs_predict(&clksync[mip - telstatshmp->minfo], monoms()));
+}
+
+/* set *ratep to the rate of the clock of mip against ours and *sep to its
+ * standard error.
+ * return 0 if found from a full CS_MAXN snapshots, else -1.
+ */
+int csiClockRate(MotorInfo *mip, double *ratep, double *sep)
+{
+    ClockSync *cs = &clksync[mip - telstatshmp->minfo];
+
+    *ratep = cs->rate;
+    *sep = cs->rse;
+    return (cs->n < CS_MAXN ? -1 : 0);
+}
+
+/* check the command channel of each motor that is homing or finding limits
+ * with one poll. results are used, once each, by csiCfdReady().
+ */
+void csiPollReady(void)
+{
+    int fd[TEL_NM], mi[TEL_NM], ready[TEL_NM];
+    int i, n;
+
+    if (virtual_mode)
+        return;
+
+    for (n = i = 0; i < TEL_NM; i++)
+    {
+        MotorInfo *mip = &telstatshmp->minfo[i];
+
+        cfdpolled[i] = 0;
+        if (mip->have && (mip->homing || mip->limiting) && MIPCFD(mip))
+        {
+            fd[n] = MIPCFD(mip);
+            mi[n++] = i;
+        }
+    }
+
+    if (n == 0)
+        return;
+    if (csi_ready(fd, ready, n, 0) < 0)
+    {
+        tdlog("poll(): %s\n", strerror(errno));
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        cfdpolled[mi[i]] = 1;
+        cfdready[mi[i]] = ready[i];
+    }
+}
+
+/* return 1 if the command channel of mip can be read, else 0.
+ * use the result of the last csiPollReady() if not already used.
+ */
+int csiCfdReady(MotorInfo *mip)
+{
+    int i = mip - telstatshmp->minfo;
+
+    if (cfdpolled[i])
+    {
+        cfdpolled[i] = 0;
+        return (cfdready[i]);
+    }
+
+    return (csiIsReady(MIPCFD(mip)));
+}
+
+/* add the clock in csisnap[i], which it read at host monotonic ms, to how
+ * that clock runs. the request and reply each take about as long so the
+ * middle of the round trip is best.
+ */
+static void clockAdd(int i, double host)
+{
+    ClockSync *cs = &clksync[i];
+
+    if (cs_add(cs, host, csisnap[i].clock) < 0)
+        tdlog("Axis %d: clock off by %.0f ms, restarting its model", telstatshmp->minfo[i].axis, cs->last);
+}
+
+/* current CLOCK_MONOTONIC in ms */
+static double monoms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3 + ts.tv_nsec / 1e6);
+}
+
 /* drain and discard any pending info from csimc fd */
 void csiDrain(int fd)
 {
@@ -183,6 +446,7 @@ void csiDrain(int fd)
 
         char buf[128];
 
+        lb_flush(fd);
         while (csiIsReady(fd) && read(fd, buf, sizeof(buf)) > 0)
             continue;
     }
@@ -216,9 +480,9 @@ void csiSetup(MotorInfo *mip)
         int cfd = MIPCFD(mip);
         double scale = mip->step / (2 * PI);
 
-        int old_msteps = csi_rix(cfd, "=msteps;");
-        int old_esteps = csi_rix(cfd, "=esteps;");
-        int old_esign = csi_rix(cfd, "=esign;");
+        int old_msteps = csiRix(cfd, "=msteps;");
+        int old_esteps = csiRix(cfd, "=esteps;");
+        int old_esign = csiRix(cfd, "=esign;");
         int new_msteps = mip->step;
         int new_esteps = mip->haveenc ? mip->estep : 0;
         int new_esign = mip->sign * mip->esign;
@@ -231,7 +495,7 @@ void csiSetup(MotorInfo *mip)
         }
         else
         {
-            mip->ishomed = csi_rix(cfd, "=h;");
+            mip->ishomed = csiRix(cfd, "=h;");
             //		tdlog("Setting Home Status to value of isHomed(), which is %d\n",mip->ishomed);
         }
 
@@ -8,10 +8,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ipc.h>
 #include <sys/param.h>
 #include <sys/shm.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -22,8 +24,11 @@
 #include "cliserv.h"
 #include "configfile.h"
 #include "csimc.h"
+#include "linebuf.h"
 #include "misc.h"
 #include "running.h"
+#include "telring.h"
+#include "telstats.h"
 #include "telstatshm.h"
 
 #include "teled.h"
@@ -48,11 +53,34 @@ static FifoInfo fifo[] = {
 };
 #define N_F (sizeof(fifo) / sizeof(fifo[0]))
 
+/* epoll tags for things other than fifos, which use their index */
+#define EV_TICK N_F       /* the control tick timerfd */
+#define EV_CSIMC (N_F + 1) /* a csimc command channel */
+
+static int epfd = -1; /* epoll set of fifos, tick timer and csimc fds */
+static int tickfd = -1; /* timerfd for control ticks */
+static int tickms;    /* period the timer is running at, ms, 0 if not yet */
+static int tickbusy;  /* whether tickms is for motion rather than idle */
+static double tnext;  /* monotonic ms when next tick is expected */
+static double tpoll;  /* monotonic ms when the handlers last polled */
+
+/* tick timing statistics since tickms last changed */
+static long nticks;   /* ticks serviced */
+static long nlate;    /* ticks missed entirely */
+static double jsum;   /* sum of tick lateness, ms */
+static double jmax;   /* worst tick lateness, ms */
+
 static void open_fifos(void);
 static void open_1fifo(FifoInfo *fip);
 static void close_1fifo(FifoInfo *fip);
 static void reopen_1fifo(FifoInfo *fip);
 static void set_shmtime(void);
+static int evFd(void);
+static void evAdd(int fd, int tag, int ctl);
+static void tickArm(void);
+static int tickRead(void);
+static void poll_all(void);
+static double monoms(void);
 
 /* write a code and new message to given fifo.
  * also log with tdlog() if code is < 0.
@@ -102,76 +130,113 @@ void init_fifos()
     open_fifos();
 }
 
-/* check for and dispatch all incoming messages.
- * then call all handlers for followup regardless.
+/* wait for and dispatch the next fifo message or csimc reply, and run each
+ * handler in polling mode when a control tick is due. ticks come every
+ * POLL_PERIOD ms while anything is moving, else every IDLE_PERIOD ms.
  * keep telstatshmp->now_mjd as current as possible.
  */
 void chk_fifos()
 {
+    struct epoll_event ev[N_F + 8];
     FifoInfo *fip;
-    struct timeval tv;
-    fd_set rfdset;
-    int maxfdp1;
-    int i, s;
-
-    /* initialize the select read mask of fds for which we care */
-    FD_ZERO(&rfdset);
-    maxfdp1 = 0;
+    int tick, csimc;
+    int wait;
+    int i, n;
+
+    /* run the timer at the rate for what we are doing now */
+    tickArm();
+
+    /* don't wait if a message is already buffered */
+    wait = -1;
     for (i = 0; i < N_F; i++)
+        if (lb_pending(fifo[i].fd[0]))
+            wait = 0;
+
+    n = epoll_wait(evFd(), ev, sizeof(ev) / sizeof(ev[0]), wait);
+    if (n < 0)
     {
-        FD_SET(fifo[i].fd[0], &rfdset);
-        if (fifo[i].fd[0] > maxfdp1)
-            maxfdp1 = fifo[i].fd[0];
+        if (errno != EINTR)
+            tdlog("epoll_wait(): %s", strerror(errno));
+        return; /* main will repeat -- we don't wanna die */
     }
-    maxfdp1++;
 
-    /* set up the max polling delay */
-    tv.tv_sec = 0;
-    tv.tv_usec = 2 * 1000000 / HZ; /* every other tick or so */
+    /* keep the track worker out while we work */
+    tel_lock();
 
-    /* call select, waiting for commands or timeout */
-    while ((s = select(maxfdp1, &rfdset, NULL, NULL, &tv)) < 0 && errno == EINTR)
-        continue;
-    if (s < 0)
+    /* buffered messages are ready too even if their fifo is empty */
+    for (i = 0; i < N_F; i++)
     {
-        tdlog("select(): %s", strerror(errno));
-        return; /* main will repeat -- we don't wanna die */
+        if (lb_pending(fifo[i].fd[0]))
+        {
+            ev[n].events = EPOLLIN;
+            ev[n++].data.u32 = i;
+        }
     }
 
-    /* dispatch any fifo messages */
-    for (fip = fifo; s > 0 && fip < &fifo[N_F]; fip++)
+    /* dispatch any fifo messages, at most one each per call */
+    for (i = 0; i < n; i++)
     {
-        if (FD_ISSET(fip->fd[0], &rfdset))
+        char msg[MAXLINE];
+        int j, s;
+
+        if (ev[i].data.u32 >= N_F)
+            continue;
+        fip = &fifo[ev[i].data.u32];
+        for (j = 0; j < i && ev[j].data.u32 != ev[i].data.u32; j++)
+            continue;
+        if (j < i)
+            continue; /* already did this one */
+
+        /* retreive new message */
+        s = serv_read(fip->fd, msg, sizeof(msg) - 1);
+        if (s < 0)
         {
-            char msg[MAXLINE];
-            int n;
-
-            /* retreive new message */
-            n = serv_read(fip->fd, msg, sizeof(msg) - 1);
-            if (n < 0)
-            {
-                tdlog("%s: read: %s", fip->name, msg);
-                reopen_1fifo(fip); /* exits if fails */
-                break;             /* need new select() */
-            }
-
-            /* keep time current */
-            set_shmtime();
-
-            /* dispatch */
-            (*fip->fp)(msg);
-
-            /* handled this one */
-            s--;
+            tdlog("%s: read: %s", fip->name, msg);
+            reopen_1fifo(fip); /* exits if fails */
+            tel_unlock();
+            return;
         }
+
+        /* keep time current */
+        set_shmtime();
+
+        /* dispatch */
+        (*fip->fp)(msg);
     }
 
-    /* then call each handler in polling mode (ie, w/o message) */
-    for (fip = fifo; fip < &fifo[N_F]; fip++)
+    /* then call each handler in polling mode if a tick is due. a csimc
+     * reply runs them early, but only once half a tick has passed since
+     * they last ran so the cycle still keeps to the tick.
+     */
+    tick = csimc = 0;
+    for (i = 0; i < n; i++)
     {
-        set_shmtime();    /* keep time current */
-        (*fip->fp)(NULL); /* general update poll */
+        if (ev[i].data.u32 == EV_TICK && tickRead() > 0)
+            tick = 1;
+        if (ev[i].data.u32 == EV_CSIMC)
+            csimc = 1;
+    }
+    if (tick || (csimc && monoms() - tpoll >= tickms / 2.0))
+    {
+        poll_all();
+        tpoll = monoms();
     }
+
+    /* let readers know if anything of interest changed */
+    telshm_notify(telstatshmp);
+
+    tel_unlock();
+}
+
+/* watch csimc command channel fd for replies, or stop watching if !on.
+ * a reply runs the handlers before the next tick if it is not too soon.
+ */
+void fifoWatch(int fd, int on)
+{
+    if (on)
+        evAdd(fd, EV_CSIMC, EPOLL_CTL_ADD);
+    else
+        (void)epoll_ctl(evFd(), EPOLL_CTL_DEL, fd, NULL);
 }
 
 /* create and attach all the fifos */
@@ -195,6 +260,7 @@ static void open_1fifo(FifoInfo *fip)
         tdlog("%s: %s", fip->name, msg);
         die();
     }
+    evAdd(fip->fd[0], fip - fifo, EPOLL_CTL_ADD);
 }
 
 /* close fifos for this channel */
@@ -215,5 +281,132 @@ static void reopen_1fifo(FifoInfo *fip)
 /* set current time in telstatshmp */
 static void set_shmtime()
 {
+    telshm_wbegin(telstatshmp);
     telstatshmp->now.n_mjd = mjd_now();
+    telshm_wend(telstatshmp);
+}
+
+/* call each handler in polling mode */
+static void poll_all()
+{
+    FifoInfo *fip;
+
+    for (fip = fifo; fip < &fifo[N_F]; fip++)
+    {
+        set_shmtime();    /* keep time current */
+        (*fip->fp)(NULL); /* general update poll */
+    }
+}
+
+/* return the epoll fd, creating it and the tick timer the first time.
+ * exit if trouble.
+ */
+static int evFd()
+{
+    if (epfd < 0)
+    {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0)
+        {
+            tdlog("epoll_create1(): %s", strerror(errno));
+            exit(1);
+        }
+        tickfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (tickfd < 0)
+        {
+            tdlog("timerfd_create(): %s", strerror(errno));
+            exit(1);
+        }
+        evAdd(tickfd, EV_TICK, EPOLL_CTL_ADD);
+    }
+
+    return (epfd);
+}
+
+/* add fd to the epoll set with the given tag.
+ * csimc channels are edge triggered since we only want to know something
+ * new has arrived, the handlers read it when they are ready.
+ * exit if trouble.
+ */
+static void evAdd(int fd, int tag, int ctl)
+{
+    struct epoll_event ev;
+
+    ev.events = tag == EV_CSIMC ? EPOLLIN | EPOLLET : EPOLLIN;
+    ev.data.u32 = tag;
+    if (epoll_ctl(evFd(), ctl, fd, &ev) < 0 && errno != EEXIST)
+    {
+        tdlog("epoll_ctl(%d): %s", fd, strerror(errno));
+        exit(1);
+    }
+}
+
+/* (re)start the tick timer if the period it should be running at changed.
+ * log the timing of the ticks at the old period, if any.
+ */
+static void tickArm()
+{
+    int busy = tel_busy() || focus_busy();
+    int ms = busy ? POLL_PERIOD : IDLE_PERIOD;
+    struct itimerspec its;
+
+    if (ms <= 0)
+        ms = 2 * 1000 / HZ; /* every other tick or so */
+    if (ms == tickms && busy == tickbusy)
+        return;
+
+    if (nticks > 0 && tickbusy)
+        tdlog("Ticks: %ld at %d ms, jitter mean %.2f max %.2f ms, %ld missed", nticks, tickms, jsum / nticks,
+              jmax, nlate);
+    nticks = nlate = 0;
+    jsum = jmax = 0;
+
+    its.it_value.tv_sec = its.it_interval.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = (ms % 1000) * 1000000;
+    if (timerfd_settime(tickfd, 0, &its, NULL) < 0)
+    {
+        tdlog("timerfd_settime(): %s", strerror(errno));
+        exit(1);
+    }
+    tickms = ms;
+    tickbusy = busy;
+    tnext = monoms() + ms;
+}
+
+/* consume the tick timer and account for how late it is.
+ * return number of expirations since last time, 0 if none after all.
+ */
+static int tickRead()
+{
+    unsigned long long nexp;
+    double late;
+
+    if (read(tickfd, &nexp, sizeof(nexp)) != sizeof(nexp) || nexp == 0)
+        return (0);
+
+    /* compare with when the latest expiration was due */
+    tnext += (nexp - 1) * tickms;
+    late = monoms() - tnext;
+    tnext += tickms;
+
+    nticks++;
+    nlate += nexp - 1;
+    telstats_add(telstatsp, ST_TICKLATE, late > 0 ? (uint64_t)(late * 1e6) : 0);
+    if (late > 0)
+    {
+        jsum += late;
+        if (late > jmax)
+            jmax = late;
+    }
+
+    return ((int)nexp);
+}
+
+/* return monotonic time in ms */
+static double monoms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3 + ts.tv_nsec / 1e6);
 }
@@ -22,6 +22,7 @@
 #include "running.h"
 #include "strops.h"
 #include "telenv.h"
+#include "telring.h"
 #include "telstatshm.h"
 #include "virmc.h"
 
@@ -93,6 +94,12 @@ void focus_msg(msg) char *msg;
         focus_offset(1, atof(msg));
 }
 
+/* return 1 if the focuser is working on an objective, else 0 */
+int focus_busy()
+{
+    return (active_func != NULL);
+}
+
 /* no new messages.
  * goose the current objective, if any.
  */
@@ -249,7 +256,7 @@ static void focus_stop(int first, ...)
     }
     else
     {
-        if (csi_rix(cfd, "=mvel;") != 0)
+        if (csiRix(cfd, "=mvel;") != 0)
             return;
     }
 
@@ -511,7 +518,9 @@ static void stopFocus(int fast)
     OMOT->dpos = OMOT->cpos;
 }
 
-/* read the raw value */
+/* read the raw value.
+ * reuse the snapshot tel.c took with the other axes this cycle if any.
+ */
 static void readFocus()
 {
     MotorInfo *mip = OMOT;
@@ -519,14 +528,11 @@ static void readFocus()
     if (!mip->have)
         return;
 
-    if (virtual_mode)
-    {
-        mip->raw = vmc_rix(mip->axis, "=mpos;");
-        mip->cpos = (2 * PI) * mip->sign * mip->raw / mip->step;
-    }
-    else
-    {
-        mip->raw = csi_rix(MIPSFD(mip), "=mpos;");
-        mip->cpos = (2 * PI) * mip->sign * mip->raw / mip->step;
-    }
+    if (csiSnapAge(mip) > SNAPFRESH && csiSnap(mip) < 0)
+        return;
+
+    telshm_wbegin(telstatshmp);
+    mip->raw = MIPSNAP(mip)->mpos;
+    mip->cpos = (2 * PI) * mip->sign * mip->raw / mip->step;
+    telshm_wend(telstatshmp);
 }
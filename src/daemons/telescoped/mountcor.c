@@ -15,6 +15,7 @@
 #include "csimc.h"
 #include "strops.h"
 #include "telenv.h"
+#include "telring.h"
 #include "telstatshm.h"
 
 #include "teled.h"
@@ -0,0 +1,298 @@
+/* track an earth satellite with a running telescoped and report how well
+ * the axes keep up with the target as the short track profiles are
+ * streamed to the controllers.
+ *
+ * the elements are read from a TLE but moved to a new epoch, and node if
+ * need be, so the satellite is well up throughout the run now whenever it
+ * is. they are then sent as a database line, which we crack back ourselves
+ * so we and telescoped follow just the same satellite.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "telstatshm.h"
+
+#define DEFTLE "../../../libs/astro/sattest/test.tle"
+#define SAMPMS 100   /* ms between samples of shm */
+#define STEPSECS 60  /* secs between orbit phases tried */
+#define CHKSECS 10   /* secs between checks along each */
+#define MAXCHK 200   /* most checks along each */
+#define NAX (TEL_RM + 1) /* axes which track */
+
+static int readTLE(char *fn, Obj *op);
+static double pickPass(Obj *op, Now *np, double t0, double secs, double minalt);
+static int altAz(Obj *op, Now *np, double t, double *altp, double *azp);
+static double sep(double alt1, double az1, double alt2, double az2);
+static TelStatShm *shmConnect(void);
+static void sendTel(char *telhome, char *msg);
+static double mjdNow(void);
+
+int main(int ac, char *av[])
+{
+    double dur = ac > 1 ? atof(av[1]) : 300;
+    double lead = ac > 2 ? atof(av[2]) : 60;
+    double minalt = degrad(ac > 3 ? atof(av[3]) : 20);
+    char *fn = ac > 4 ? av[4] : DEFTLE;
+    char *telhome = getenv("TELHOME");
+    char line[1024];
+    TelStatShm *tp, copy;
+    double ex[NAX], ex2[NAX], tex[NAX], dis = 0;
+    double t0, rate, lock = 0;
+    int nsamp = 0, nlost = 0, tracking = 0;
+    Now now;
+    Obj obj;
+    int i;
+
+    if (dur <= 0 || lead < 0 || !telhome)
+    {
+        fprintf(stderr, "Usage: TELHOME=dir %s [secs [lead [minalt [tle]]]]\n", av[0]);
+        exit(1);
+    }
+
+    if (readTLE(fn, &obj) < 0)
+        exit(1);
+
+    /* site from telescoped */
+    tp = shmConnect();
+    telshm_snapshot(tp, &copy);
+    now = copy.now;
+
+    /* the whole run, including the slew to it */
+    t0 = mjdNow();
+    rate = pickPass(&obj, &now, t0, lead + dur, minalt);
+    if (rate < 0)
+    {
+        fprintf(stderr, "%s never stays above %g degrees for %g secs\n", obj.o_name, raddeg(minalt), lead + dur);
+        exit(1);
+    }
+    db_write_line(&obj, line);
+    if (db_crack_line(line, &obj, NULL) < 0)
+    {
+        fprintf(stderr, "Can not crack %s\n", line);
+        exit(1);
+    }
+    printf("%s\n", line);
+    printf("Fastest %.3f deg/sec\n", raddeg(rate));
+
+    sendTel(telhome, line);
+
+    for (i = 0; i < NAX; i++)
+        ex[i] = ex2[i] = tex[i] = 0;
+    while (mjdNow() < t0 + (lead + dur) / SPD)
+    {
+        double alt, az;
+
+        usleep(SAMPMS * 1000);
+        telshm_snapshot(tp, &copy);
+
+        if (copy.telstate == TS_TRACKING)
+        {
+            if (!tracking && !lock)
+                lock = (mjdNow() - t0) * SPD;
+            tracking = 1;
+        }
+        else
+        {
+            if (tracking)
+                nlost++;
+            tracking = 0;
+            continue;
+        }
+
+        for (i = 0; i < NAX; i++)
+        {
+            double e;
+
+            if (!copy.minfo[i].have)
+                continue;
+            e = fabs(copy.minfo[i].cpos - copy.minfo[i].dpos);
+            if (e > ex[i])
+            {
+                ex[i] = e;
+                tex[i] = (mjdNow() - t0) * SPD;
+            }
+            ex2[i] += e * e;
+        }
+        nsamp++;
+
+        /* telescoped's target, which it found for its own clock */
+        now = copy.now;
+        if (altAz(&obj, &now, copy.now.n_mjd, &alt, &az) == 0 && sep(alt, az, copy.Dalt, copy.Daz) > dis)
+            dis = sep(alt, az, copy.Dalt, copy.Daz);
+    }
+
+    sendTel(telhome, "Stop");
+
+    if (!nsamp)
+    {
+        printf("Never had tracking lock\n");
+        exit(1);
+    }
+    printf("Tracking lock after %.1f secs, lost %d times\n", lock, nlost);
+    for (i = 0; i < NAX; i++)
+        if (copy.minfo[i].have)
+            printf("Axis %d: worst %8.2f arcsec at %5.1f secs, rms %8.2f\n", i, raddeg(ex[i]) * 3600, tex[i],
+                   raddeg(sqrt(ex2[i] / nsamp)) * 3600);
+    printf("Target differs by at most %.2f arcsec\n", raddeg(dis) * 3600);
+
+    return (0);
+}
+
+/* read the first TLE in fn into op.
+ * return 0 if ok else -1 after saying why.
+ */
+static int readTLE(char *fn, Obj *op)
+{
+    char l1[128], l2[128];
+    FILE *fp;
+    int ok;
+
+    fp = fopen(fn, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+        return (-1);
+    }
+    ok = fgets(l1, sizeof(l1), fp) && fgets(l2, sizeof(l2), fp) && db_tle("sattrack", l1, l2, op) == 0;
+    fclose(fp);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: no TLE\n", fn);
+        return (-1);
+    }
+    return (0);
+}
+
+/* move the epoch of op, and its node if that is not enough, such that it
+ * stays above minalt from t0 for secs, moving as fast as we can find.
+ * return the fastest it moves, rads/sec, or -1 if never.
+ */
+static double pickPass(Obj *op, Now *np, double t0, double secs, double minalt)
+{
+    double period = 1 / op->es_n;  /* days */
+    double raan0 = op->es_raan, best = -1;
+    double bestep = 0, bestraan = 0;
+    double alt[MAXCHK + 1], az[MAXCHK + 1];
+    int nchk = secs / CHKSECS;
+    double tau, node;
+    int i;
+
+    if (nchk > MAXCHK)
+        nchk = MAXCHK;
+    if (nchk < 2)
+        nchk = 2;
+
+    for (node = 0; node < 360 && best < 0; node += 10)
+    {
+        op->es_raan = fmod(raan0 + node, 360);
+        for (tau = 0; tau < period; tau += STEPSECS / SPD)
+        {
+            double fastest = 0;
+
+            /* tau after the epoch at t0. the ends and middle first, cheaply */
+            op->es_epoch = t0 - tau;
+            if (altAz(op, np, t0, &alt[0], &az[0]) < 0 || alt[0] < minalt ||
+                altAz(op, np, t0 + secs / 2 / SPD, &alt[1], &az[1]) < 0 || alt[1] < minalt ||
+                altAz(op, np, t0 + secs / SPD, &alt[1], &az[1]) < 0 || alt[1] < minalt)
+                continue;
+            for (i = 1; i <= nchk; i++)
+            {
+                if (altAz(op, np, t0 + secs / SPD * i / nchk, &alt[i], &az[i]) < 0 || alt[i] < minalt)
+                    break;
+                if (sep(alt[i - 1], az[i - 1], alt[i], az[i]) > fastest)
+                    fastest = sep(alt[i - 1], az[i - 1], alt[i], az[i]);
+            }
+            if (i <= nchk)
+                continue;
+            fastest /= secs / nchk;
+            if (fastest > best)
+            {
+                best = fastest;
+                bestep = op->es_epoch;
+                bestraan = op->es_raan;
+            }
+        }
+    }
+
+    op->es_epoch = bestep;
+    op->es_raan = bestraan;
+    return (best);
+}
+
+/* find the apparent alt and az of op from np at MJD t.
+ * return 0 if ok, else -1.
+ */
+static int altAz(Obj *op, Now *np, double t, double *altp, double *azp)
+{
+    np->n_mjd = t;
+    if (obj_cir(np, op) < 0)
+        return (-1);
+    *altp = op->s_alt;
+    *azp = op->s_az;
+    return (0);
+}
+
+/* return the angle between two places, rads */
+static double sep(double alt1, double az1, double alt2, double az2)
+{
+    double c = sin(alt1) * sin(alt2) + cos(alt1) * cos(alt2) * cos(az1 - az2);
+
+    return (acos(c > 1 ? 1 : c < -1 ? -1 : c));
+}
+
+/* attach to telescoped's status segment */
+static TelStatShm *shmConnect()
+{
+    int shmid = shmget(TELSTATSHMKEY, sizeof(TelStatShm), 0);
+    void *addr;
+
+    if (shmid < 0)
+    {
+        perror("shmget: is telescoped running?");
+        exit(1);
+    }
+    addr = shmat(shmid, NULL, SHM_RDONLY);
+    if (addr == (void *)-1)
+    {
+        perror("shmat");
+        exit(1);
+    }
+    return ((TelStatShm *)addr);
+}
+
+/* send msg to telescoped */
+static void sendTel(char *telhome, char *msg)
+{
+    char fn[1024];
+    FILE *fp;
+
+    snprintf(fn, sizeof(fn), "%s/comm/Tel.in", telhome);
+    fp = fopen(fn, "w");
+    if (!fp)
+    {
+        fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+        exit(1);
+    }
+    fprintf(fp, "%s\n", msg);
+    fclose(fp);
+}
+
+/* return the MJD now */
+static double mjdNow()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (25567.5 + (tv.tv_sec + tv.tv_usec / 1e6) / SPD);
+}
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -24,10 +25,13 @@
 #include "running.h"
 #include "strops.h"
 #include "telenv.h"
+#include "telring.h"
+#include "telstats.h"
 #include "telstatshm.h"
 #include "virmc.h"
 
 #include "teled.h"
+#include "trackpath.h"
 
 /* handy loop "for each motor" we deal with here */
 #define FEM(p) for ((p) = HMOT; (p) <= RMOT; (p)++)
@@ -38,6 +42,7 @@ static void (*active_func)(int first, ...);
 
 /* one of these... */
 static void tel_poll(void);
+static void pushRing(void);
 static void tel_reset(int first);
 static void tel_home(int first, ...);
 static void tel_limits(int first, ...);
@@ -56,14 +61,20 @@ static int dbformat(char *msg, Obj *op, double *drap, double *ddecp);
 static void initCfg(void);
 static void hd2xyr(double ha, double dec, double *xp, double *yp, double *rp);
 static void xyr2altaz(double x, double y, double r, double *alt, double *az);
-static void readRaw(void);
+static int readRaw(void);
 static void mkCook(void);
 static void dummyTarg(void);
 static void stopTel(int fast);
 static int onTarget(MotorInfo **mipp);
 static int atTarget(void);
 static int trackObj(Obj *op, int first);
+static int trackObj1(Obj *op, int first);
+static void renewTrack(Now *np, Obj *op);
 static void findAxes(Now *np, Obj *op, double *xp, double *yp, double *rp);
+static void findHADec(Now *np, Obj *op, double *hap, double *decp);
+static void pathHADec(double t, double v[TP_NV], void *arg);
+static void pathXYR(int ms, double v[TK_NV], void *arg);
+static void refractHADec(Now *np, double *hap, double *decp);
 static int chkLimits(int wrapok, double *xp, double *yp, double *rp);
 static void jogTrack(int first, char dircode);
 static void jogSlew(int first, char dircode);
@@ -77,15 +88,80 @@ static double ACQUIREDELT; /* how far moved in 1sec before settled */
 static double FGUIDEVEL;   /* fine jogging motion rate, rads/sec */
 static double CGUIDEVEL;   /* coarse jogging motion rate, rads/sec */
 static int TRACKINT;       /* tracking interval for each e/mtrack, secs */
+static double TRACKMAS;    /* track path error allowed, mas. 0 reduces all */
+static double TRACKTOL;    /* track point interpolation error allowed, mas */
+static int TRACKKNOTS;     /* most track points the controllers hold */
+static int TRACKSTREAM;    /* e/mtrack interval for earth satellites, secs */
+
+#define PPTRACK 60                   /* number of positions to e/mtrack */
+#define MAS (PI / 180 / 3600 / 1000) /* rads per milliarcsec */
+#define TRACKLAP 2                   /* profile intervals each overlaps the next */
+#define TRACKSAMP (2 * (PPTRACK - 1) + 1) /* samples of each profile placing points */
+
+/* what pathHADec() needs */
+typedef struct
+{
+    Now *np; /* as the site but with no atmosphere */
+    Obj *op;
+    int bg; /* lock around each reduction */
+} PathArg;
 
-#define PPTRACK 60 /* number of positions to e/mtrack */
+/* what pathXYR() needs */
+typedef struct
+{
+    Now *np;       /* the site */
+    Obj *op;       /* target */
+    TrackPath *tp; /* its path above the atmosphere, else NULL to reduce op */
+    double mjd0;   /* start of the profile */
+    int bg;        /* lock around each point */
+} XYRArg;
+
+/* one e/mtrack sequence */
+typedef struct
+{
+    double mjd0;               /* time of first position */
+    int gen;                   /* trackgen it was made for */
+    int n;                     /* positions */
+    int ms[TK_MAXN];           /* time of each after mjd0, ms */
+    double xyr[NMOT][TK_MAXN]; /* positions of each axis, rads */
+} TrackProfile;
+
+static void buildTrack(Now *np, Obj *op);
+static void computeTrack(TrackProfile *tpp, Now *np, Obj *op, int secs, int bg);
+static void loadTrack(TrackProfile *tpp, int clock0[NMOT]);
+static void bgRequest(Now *np, Obj *op);
+static int bgTake(TrackProfile *tpp);
+static void *trackWorker(void *dummy);
+
+/* the next profile, made by trackWorker() while the current one runs */
+static struct
+{
+    pthread_mutex_t lock; /* guards the rest */
+    pthread_cond_t go;    /* signalled when want is set */
+    int want;             /* set when now and obj are a new request */
+    int done;             /* set when prof is its answer */
+    Now now;              /* site, from when the profile starts */
+    Obj obj;              /* target */
+    int secs;             /* trackint of the request */
+    int gen;              /* trackgen of the request */
+    TrackProfile prof;    /* answer */
+} bg = {.lock = PTHREAD_MUTEX_INITIALIZER, .go = PTHREAD_COND_INITIALIZER};
+
+static pthread_mutex_t tellock = PTHREAD_MUTEX_INITIALIZER; /* see tel_lock() */
 
 /* offsets to apply to target object location, if any */
 static double r_offset; /* delta ra to be added */
 static double d_offset; /* delta dec to be added */
 
 #define MAXJITTER 10.0 /* max clock vs host difference */
+#define CLKSIGMA 5.0    /* standard errors a clock rate error must exceed */
+#define CLKWARN 1e-4    /* clock rate error worth logging */
 static double strack;  /* when current e/mtrack started */
+static double ntrack;  /* when the next e/mtrack starts */
+static int trackgen;   /* changes with each new track */
+static int trackint;   /* secs each e/mtrack of this track spans */
+static double trackrenew; /* secs each is used before the next */
+static int clkwarned;  /* set once a clock rate error is logged this track */
 
 int tel_ishomed(void);
 
@@ -133,11 +209,19 @@ void tel_msg(msg) char *msg;
     }
 }
 
+/* return 1 if the telescope is working on an objective, else 0 */
+int tel_busy()
+{
+    return (active_func != NULL);
+}
+
 /* no new messages.
  * goose the current objective, if any, else just update cooked position.
  */
 static void tel_poll()
 {
+    uint64_t t0 = telstats_now();
+
     if (virtual_mode)
     {
         MotorInfo *mip;
@@ -156,6 +240,38 @@ static void tel_poll()
         mkCook();
         dummyTarg();
     }
+
+    pushRing();
+    tdstat(ST_POLL, t0);
+}
+
+/* add the state as of this cycle to the telemetry ring */
+static void pushRing()
+{
+    TelRingRec r;
+    int i;
+
+    if (!telringp)
+        return;
+
+    r.n_mjd = telstatshmp->now.n_mjd;
+    r.mdha = telstatshmp->mdha;
+    r.mddec = telstatshmp->mddec;
+    r.telstate = telstatshmp->telstate;
+    r.telstateidx = telstatshmp->telstateidx;
+    for (i = 0; i < TEL_NM; i++)
+    {
+        MotorInfo *mip = &telstatshmp->minfo[i];
+        TelRingMot *rmp = &r.mot[i];
+
+        rmp->raw = mip->raw;
+        rmp->pad = 0;
+        rmp->cpos = mip->cpos;
+        rmp->dpos = mip->dpos;
+        rmp->cvel = mip->cvel;
+    }
+
+    telring_push(telringp, &r);
 }
 
 /* stop and reread config files */
@@ -280,6 +396,7 @@ static void tel_home(int first, ...)
     }
 
     /* continue to seek home on each axis still not done */
+    csiPollReady();
     FEM(mip)
     {
         i = mip - &telstatshmp->minfo[0];
@@ -400,6 +517,7 @@ static void tel_limits(int first, ...)
     }
 
     /* continue to seek limits on each axis still not done */
+    csiPollReady();
     FEM(mip)
     {
         i = mip - &telstatshmp->minfo[0];
@@ -609,6 +727,7 @@ static void tel_altaz(int first, ...)
         active_func = tel_altaz;
 
         /* set new raw destination */
+        telshm_wbegin(telstatshmp);
         HMOT->dpos = x;
         DMOT->dpos = y;
         RMOT->dpos = r;
@@ -627,6 +746,7 @@ static void tel_altaz(int first, ...)
         ap_as(np, J2000, &ra, &dec);
         telstatshmp->DJ2kRA = ra;
         telstatshmp->DJ2kDec = dec;
+        telshm_wend(telstatshmp);
 
         /* issue move command to each axis */
         FEM(mip)
@@ -715,6 +835,7 @@ static void tel_hadec(int first, ...)
         active_func = tel_hadec;
 
         /* set raw destination */
+        telshm_wbegin(telstatshmp);
         HMOT->dpos = x;
         DMOT->dpos = y;
         RMOT->dpos = r;
@@ -734,6 +855,7 @@ static void tel_hadec(int first, ...)
         ap_as(np, J2000, &ra, &dec);
         telstatshmp->DJ2kRA = ra;
         telstatshmp->DJ2kDec = dec;
+        telshm_wend(telstatshmp);
 
         /* issue move command to each axis */
         FEM(mip)
@@ -795,27 +917,18 @@ static void tel_stop(int first, ...)
 
     if (first)
     {
-        /* issue stops */
+        /* issue stops, check on them next time */
         stopTel(0);
         active_func = tel_stop;
+        return;
     }
 
     /* wait for all to be stopped */
+    readRaw();
     FEM(mip)
     {
-        if (mip->have)
-        {
-            if (virtual_mode)
-            {
-                if (vmcGetVelocity(mip->axis) != 0)
-                    return;
-            }
-            else
-            {
-                if (csi_rix(MIPCFD(mip), "=mvel;") != 0)
-                    return;
-            }
-        }
+        if (mip->have && MIPSNAP(mip)->mvel != 0)
+            return;
     }
 
     /* if get here, everything has stopped */
@@ -823,7 +936,6 @@ static void tel_stop(int first, ...)
     telstatshmp->telstateidx++;
     active_func = NULL;
     fifoWrite(Tel_Id, 0, "Stop complete");
-    readRaw();
 }
 
 /* respond to a request for jogging.
@@ -859,30 +971,152 @@ static int dbformat(char *msg, Obj *op, double *drap, double *ddecp)
  */
 static void buildTrack(Now *np, Obj *op)
 {
-    double *x, *y, *r;
-    double *xyr[NMOT];
-    double mjd0;
-    MotorInfo *mip;
+    static TrackProfile prof;
+    int clock0[NMOT];
+    uint64_t t0 = telstats_now();
     int i;
 
-    /* malloc each then store so we can effectively access them via a mip */
-    x = (double *)malloc(PPTRACK * sizeof(double));
-    y = (double *)malloc(PPTRACK * sizeof(double));
-    r = (double *)malloc(PPTRACK * sizeof(double));
-    xyr[TEL_HM] = x;
-    xyr[TEL_DM] = y;
-    xyr[TEL_RM] = r;
+    computeTrack(&prof, np, op, trackint, 0);
+    for (i = 0; i < NMOT; i++)
+        clock0[i] = 0;
+    loadTrack(&prof, clock0);
+
+    tdstat(ST_BUILDTRACK, t0);
+}
+
+/* install the profile that starts at ntrack, from trackWorker() if it is
+ * ready else computed now. rather than reset the clocks, which would leave
+ * the old profile running against the new clock until the new one arrived,
+ * each axis is given the clock it will read at ntrack according to how it
+ * has been running against ours, so the new profile takes over from the old
+ * one within their overlap without a gap. strack moves to when the typical
+ * clock read 0 so drift is still taken up each profile.
+ * it is ok to modify np->n_mjd.
+ */
+static void renewTrack(Now *np, Obj *op)
+{
+    static TrackProfile prof;
+    int clock0[NMOT];
+    uint64_t t0 = telstats_now();
+    double now = mjd_now();
+    MotorInfo *mip;
 
-    /* build list of PPTRACK values beginning at mjd */
-    mjd0 = mjd;
-    for (i = 0; i < PPTRACK; i++)
+    if (!bgTake(&prof))
     {
-        mjd = mjd0 + i * TRACKINT / (PPTRACK * SPD);
-        findAxes(np, op, &x[i], &y[i], &r[i]);
-        (void)chkLimits(1, &x[i], &y[i], &r[i]); /* let limit protect */
+        tdlog("Next track profile not ready, computing it now");
+        np->n_mjd = ntrack;
+        computeTrack(&prof, np, op, trackint, 0);
     }
 
-    /* send to each controller */
+    FEM(mip)
+    {
+        if (mip->have)
+            clock0[mip - telstatshmp->minfo] = floor(csiClock(mip) + (ntrack - now) * SPD * 1000 + .5);
+    }
+    mip = HMOT->have ? HMOT : DMOT;
+    strack = now - csiClock(mip) / (SPD * 1000.);
+
+    loadTrack(&prof, clock0);
+
+    /* start on the next */
+    ntrack += trackrenew / SPD;
+    np->n_mjd = ntrack;
+    bgRequest(np, op);
+
+    tdstat(ST_RENEWTRACK, t0);
+}
+
+/* fill tpp with positions for op from np across secs. with TRACKTOL
+ * they are only as close as needed to keep the lines the controllers move
+ * along between them within it, else PPTRACK evenly.
+ * if bg we are trackWorker() so hold tel_lock() only while using libastro
+ * or anything the control loop may change, one reduction at a time.
+ * it is ok to modify np->n_mjd.
+ */
+static void computeTrack(TrackProfile *tpp, Now *np, Obj *op, int secs, int bg)
+{
+    int span = 1000 * (PPTRACK - 1) * secs / PPTRACK;
+    TrackKnots tk;
+    TrackPath tp;
+    PathArg pa;
+    XYRArg xa;
+    Now now0;
+    int i, fit;
+
+    /* fit the path above the atmosphere from a few full reductions, see
+     * trackpath.c, then refract each point just as obj_cir() would since
+     * refraction is neither smooth enough nor costly. earth satellites, which
+     * move too quickly, and any path that will not fit are reduced at every
+     * point as before.
+     */
+    tpp->mjd0 = mjd;
+    fit = 0;
+    if (TRACKMAS > 0 && op->o_type != EARTHSAT)
+    {
+        now0 = *np;
+        now0.n_pressure = 0;
+        pa.np = &now0;
+        pa.op = op;
+        pa.bg = bg;
+        fit = tp_fit(&tp, tpp->mjd0, span / (SPD * 1000), TRACKMAS * MAS, pathHADec, &pa) == 0;
+        if (!fit)
+        {
+            if (bg)
+                tel_lock();
+            tdlog("Track path off by %.1f mas after %d reductions, reducing every point", tp.err / MAS, tp.nfull);
+            if (bg)
+                tel_unlock();
+        }
+    }
+
+    xa.np = np;
+    xa.op = op;
+    xa.tp = fit ? &tp : NULL;
+    xa.mjd0 = tpp->mjd0;
+    xa.bg = bg;
+
+    /* e/mtrack only take points evenly spaced, as loadTrack() checks, the
+     * virtual controllers take them anywhere.
+     */
+    if (TRACKTOL > 0)
+    {
+        if (tp_knots(&tk, span, TRACKSAMP, TRACKTOL * MAS, TRACKKNOTS, !virtual_mode, pathXYR, &xa) < 0)
+        {
+            if (bg)
+                tel_lock();
+            tdlog("Track points off by %.1f mas with %d of them", tk.err / MAS, tk.n);
+            if (bg)
+                tel_unlock();
+        }
+    }
+    else
+    {
+        tk.n = PPTRACK;
+        for (i = 0; i < PPTRACK; i++)
+        {
+            tk.ms[i] = i * floor(1000. * secs / PPTRACK + .5);
+            pathXYR(tk.ms[i], tk.v[i], &xa);
+        }
+    }
+
+    tpp->n = tk.n;
+    for (i = 0; i < tk.n; i++)
+    {
+        tpp->ms[i] = tk.ms[i];
+        tpp->xyr[TEL_HM][i] = tk.v[i][TEL_HM];
+        tpp->xyr[TEL_DM][i] = tk.v[i][TEL_DM];
+        tpp->xyr[TEL_RM][i] = tk.v[i][TEL_RM];
+    }
+}
+
+/* send tpp to each controller, starting when its clock reads clock0[] ms,
+ * and set its timeout to trackint.
+ */
+static void loadTrack(TrackProfile *tpp, int clock0[NMOT])
+{
+    MotorInfo *mip;
+    int i;
+
     FEM(mip)
     {
         double scale;
@@ -895,56 +1129,182 @@ static void buildTrack(Now *np, Obj *op)
         if (virtual_mode)
         {
 
-            xyrp = xyr[mip - telstatshmp->minfo];
+            xyrp = tpp->xyr[mip - telstatshmp->minfo];
             //	    tdlog ("Creating track profile:");
-            vmcSetTrackPath(mip->axis, PPTRACK, 0, 1000.0 * TRACKINT / PPTRACK + 0.5, xyrp);
+            vmcSetTimeout(mip->axis, trackint * 1000);
+            vmcSetTrackPath(mip->axis, tpp->n, clock0[mip - telstatshmp->minfo], tpp->ms, xyrp);
         }
         else
         {
 
-            xyrp = xyr[mip - telstatshmp->minfo];
+            char buf[TK_MAXN * 16 + 64];
+            CSIBlkStats bs;
+            int l;
+
+            xyrp = tpp->xyr[mip - telstatshmp->minfo];
             cfd = MIPCFD(mip);
-            //	    tdlog ("Creating track profile:");
+
+            /* e/mtrack take one interval for all the points. that holds
+             * only because computeTrack() asks tp_knots() for even knots
+             * whenever !virtual_mode, so refuse any that are not.
+             */
+            for (i = 2; i < tpp->n && tpp->ms[i] == i * tpp->ms[1]; i++)
+                continue;
+            if (i < tpp->n)
+            {
+                tdlog("Axis %d: track points are not evenly spaced", mip->axis);
+                continue;
+            }
+
+            /* format the whole command first then hand it over in one write
+             * so csimcd can fill each packet instead of sending one per value.
+             * the timeout goes with it rather than costing a round trip of
+             * its own each time a profile is renewed.
+             */
+            l = sprintf(buf, "timeout=%d;", trackint * 1000);
             if (mip->haveenc)
             {
                 scale = mip->esign * mip->estep / (2 * PI);
-                csi_w(cfd, "etrack");
-                //		printf ("etrack");
+                l += sprintf(buf + l, "etrack");
             }
             else
             {
                 scale = mip->sign * mip->step / (2 * PI);
-                csi_w(cfd, "mtrack");
-                //		printf ("mtrack");
+                l += sprintf(buf + l, "mtrack");
             }
-            csi_w(cfd, "(0,%.0f", 1000. * TRACKINT / PPTRACK + .5);
-            //	    printf ("(0,%.0f", 1000.*TRACKINT/PPTRACK+.5);
+            l += sprintf(buf + l, "(%d,%d", clock0[mip - telstatshmp->minfo], tpp->ms[1]);
+            for (i = 0; i < tpp->n; i++)
+                l += sprintf(buf + l, ",%.0f", scale * xyrp[i] + .5);
+            l += sprintf(buf + l, ");");
 
-            /* TODO: pack into longer commands */
-            for (i = 0; i < PPTRACK; i++)
+            if (csi_wblk(cfd, buf, l, &bs) < 0)
             {
-                csi_w(cfd, ",%.0f", scale * xyrp[i] + .5);
-                //		printf (",%.0f", scale*xyrp[i]+.5);
+                tdlog("Axis %d: track upload failed: %s", mip->axis, strerror(errno));
+                continue;
             }
-            csi_w(cfd, ");");
-            //	    printf (");\n");
+            tdlog("Axis %d: track upload %d bytes, %d packets, %d writes, %.2f ms", mip->axis, bs.nbytes, bs.npkts,
+                  bs.nwrites, bs.ms);
 
         } // !virtual_mode
     }
     fflush(stdout);
+}
+
+/* ask trackWorker() for the profile of op starting at np */
+static void bgRequest(Now *np, Obj *op)
+{
+    static pthread_t tid;
+
+    pthread_mutex_lock(&bg.lock);
+    bg.now = *np;
+    bg.obj = *op;
+    bg.secs = trackint;
+    bg.gen = trackgen;
+    bg.want = 1;
+    bg.done = 0;
+    pthread_cond_signal(&bg.go);
+    pthread_mutex_unlock(&bg.lock);
+
+    /* start it the first time */
+    if (!tid)
+    {
+        if (pthread_create(&tid, NULL, trackWorker, NULL) != 0)
+        {
+            tdlog("pthread_create(): %s", strerror(errno));
+            die();
+        }
+        pthread_detach(tid);
+    }
+}
+
+/* copy to tpp the profile trackWorker() made for the current track at
+ * ntrack, if it is done.
+ * return 1 if so, else 0.
+ */
+static int bgTake(TrackProfile *tpp)
+{
+    int ok;
+
+    pthread_mutex_lock(&bg.lock);
+    ok = bg.done && bg.prof.gen == trackgen && bg.prof.mjd0 == ntrack;
+    if (ok)
+        *tpp = bg.prof;
+    bg.done = 0;
+    pthread_mutex_unlock(&bg.lock);
+
+    return (ok);
+}
+
+/* thread to compute each profile bgRequest() asks for while the control
+ * loop carries on with the current one.
+ */
+static void *trackWorker(void *dummy)
+{
+    static TrackProfile prof;
+    Now now;
+    Obj obj;
+    int secs;
+    uint64_t t0;
+
+    pthread_mutex_lock(&bg.lock);
+    while (1)
+    {
+        while (!bg.want)
+            pthread_cond_wait(&bg.go, &bg.lock);
+        bg.want = 0;
+        now = bg.now;
+        obj = bg.obj;
+        secs = bg.secs;
+        prof.gen = bg.gen;
+        pthread_mutex_unlock(&bg.lock);
+
+        t0 = telstats_now();
+        computeTrack(&prof, &now, &obj, secs, 1);
+        tdstat(ST_BGTRACK, t0);
+
+        /* keep it unless asked for another meanwhile */
+        pthread_mutex_lock(&bg.lock);
+        if (!bg.want)
+        {
+            bg.prof = prof;
+            bg.done = 1;
+        }
+    }
+
+    return (NULL);
+}
 
-    /* done */
-    free((void *)x);
-    free((void *)y);
-    free((void *)r);
+/* lock out trackWorker() from libastro and the state of the mount.
+ * the control loop holds this while it works and releases it to wait.
+ */
+void tel_lock()
+{
+    pthread_mutex_lock(&tellock);
 }
 
-/* if first or TRACKINT has expired and needs refreshed compute and load a new
- *   tracking profile.
+/* let trackWorker() proceed again */
+void tel_unlock()
+{
+    pthread_mutex_unlock(&tellock);
+}
+
+/* if first compute and load a new tracking profile, else swap in the next
+ *   one as it is due.
  * also always handle jogginf, limit checks, telstat info, whether on track.
  * return -1 when tracking is just not possible, 0 when ok to keep trying.
  */
 static int trackObj(Obj *op, int first)
+{
+    uint64_t t0 = telstats_now();
+    int ret;
+
+    ret = trackObj1(op, first);
+    tdstat(ST_TRACKOBJ, t0);
+    return (ret);
+}
+
+/* the work of trackObj(), which times it */
+static int trackObj1(Obj *op, int first)
 {
     Now *np = &telstatshmp->now; /* pointer to live one */
     Now now = telstatshmp->now;  /* stable and changeable copy */
@@ -953,8 +1313,8 @@ static int trackObj(Obj *op, int first)
     int clocknow;
     MotorInfo *mip;
 
-    /* download tracking profile if new or expired */
-    if (first || mjd > strack + TRACKINT / SPD)
+    /* download tracking profile if new */
+    if (first)
     {
         /* sync all clocks to 0 */
         /* N.B. use MIPSFD to insure precedes main loop clock reads */
@@ -968,78 +1328,76 @@ static int trackObj(Obj *op, int first)
                 }
                 else
                 {
-                    csi_w(MIPSFD(mip), "clock=0;");
+                    csiSetvar(MIPSFD(mip), "clock", 0);
                 }
+                csiClockReset(mip);
             }
         }
+        clkwarned = 0;
 
-        /* record when this TRACKINT began */
+        /* record when this track began */
         strack = now.n_mjd;
 
-        /* set all timeouts to TRACKINT */
+        /* earth satellites move too fast for a whole TRACKINT to be worth
+         * planning so stream short profiles instead, each renewed half way
+         * so there is always half of one in hand.
+         */
+        if (op->o_type == EARTHSAT && TRACKSTREAM > 0)
+        {
+            trackint = TRACKSTREAM;
+            trackrenew = TRACKSTREAM / 2.0;
+        }
+        else
+        {
+            trackint = TRACKINT;
+            trackrenew = TRACKINT * (PPTRACK - TRACKLAP) / (double)PPTRACK;
+        }
+
+        /* reset any lingering track offset */
         FEM(mip)
         {
             if (mip->have)
             {
-                if (virtual_mode)
+                // make sure we're homed to begin with
+                char buf[128];
+                if (axisHomedCheck(mip, buf))
                 {
-                    vmcSetTimeout(mip->axis, TRACKINT * 1000);
+                    active_func = NULL;
+                    stopTel(0);
+                    fifoWrite(Tel_Id, -1, "Error: %s", buf);
+                    return -1;
                 }
-                else
+                if (virtual_mode)
                 {
-                    csi_w(MIPSFD(mip), "timeout=%d;", TRACKINT * 1000);
+                    vmcSetTrackingOffset(mip->axis, 0);
                 }
-            }
-        }
-
-        /* if just starting, reset any lingering track offset */
-        if (first)
-        {
-            FEM(mip)
-            {
-                if (mip->have)
+                else
                 {
-                    // make sure we're homed to begin with
-                    char buf[128];
-                    if (axisHomedCheck(mip, buf))
-                    {
-                        active_func = NULL;
-                        stopTel(0);
-                        fifoWrite(Tel_Id, -1, "Error: %s", buf);
-                        return -1;
-                    }
-                    if (virtual_mode)
-                    {
-                        vmcSetTrackingOffset(mip->axis, 0);
-                    }
-                    else
-                    {
-                        csi_w(MIPSFD(mip), "toffset=0;");
-                    }
+                    csiSetvar(MIPSFD(mip), "toffset", 0);
                 }
             }
         }
 
-        /* now build and install tracking profiles */
+        /* now build and install tracking profiles, and start on the next */
+        trackgen++;
         buildTrack(&now, op);
+        ntrack = strack + trackrenew / SPD;
+        now.n_mjd = ntrack;
+        bgRequest(&now, op);
     }
 
-    /* quick, get current value of typical clock.
+    /* update actual position info.
+     * the same snapshots also give the current value of a typical clock.
      * use this to compute desired to avoid host computer time jitter
      */
-    mip = HMOT->have ? HMOT : DMOT; /* surely we have one ! */
-    if (virtual_mode)
+    if (readRaw() < 0)
     {
-        clocknow = vmcGetClock(mip->axis);
-    }
-    else
-    {
-        clocknow = csi_rix(MIPSFD(mip), "=clock;");
+        stopTel(1);
+        return (-1);
     }
-
-    /* update actual position info */
-    readRaw();
     mkCook();
+    mip = HMOT->have ? HMOT : DMOT; /* surely we have one ! */
+    clocknow = MIPSNAP(mip)->clock;
 
     /* check axes */
     if (checkAxes() < 0)
@@ -1048,6 +1406,10 @@ static int trackObj(Obj *op, int first)
         return (-1);
     }
 
+    /* swap in the next profile once it starts, with the clocks just read */
+    if (mjd >= ntrack)
+        renewTrack(&now, op);
+
     /* find desired topocentric apparent place and axes @ clocknow */
     now.n_mjd = strack + clocknow / (SPD * 1000.);
     x = fabs(mjd - now.n_mjd) * SPD;
@@ -1058,12 +1420,42 @@ static int trackObj(Obj *op, int first)
         stopTel(0);
         return (-1);
     }
+
+    /* a clock running fast or slow drifts further until the next profile
+     * moves strack, so rather than wait until it is MAXJITTER off stop as
+     * soon as it is clear it would be by then. an error within CLKSIGMA
+     * standard errors is just the scatter of the snapshots; that is well
+     * beyond the usual 3 because we look again every cycle.
+     */
+    FEM(mip)
+    {
+        double rate, se, dx;
+
+        if (!mip->have)
+            continue;
+        if (csiClockRate(mip, &rate, &se) < 0 || fabs(rate - 1) <= CLKSIGMA * se)
+            continue;
+        dx = fabs(rate - 1) * (ntrack - mjd) * SPD;
+        if (x + dx > MAXJITTER)
+        {
+            fifoWrite(Tel_Id, -5, "Axis %d clock runs %.0f ppm off, would drift %g sec before next track", mip->axis,
+                      (rate - 1) * 1e6, x + dx);
+            stopTel(0);
+            return (-1);
+        }
+        if (fabs(rate - 1) > CLKWARN && !clkwarned)
+        {
+            tdlog("Axis %d clock runs %.0f ppm off", mip->axis, (rate - 1) * 1e6);
+            clkwarned = 1;
+        }
+    }
     findAxes(&now, op, &x, &y, &r);
     if (chkLimits(1, &x, &y, &r) < 0)
     {
         stopTel(0);
         return (-1);
     }
+    telshm_wbegin(telstatshmp);
     telstatshmp->Dalt = op->s_alt;
     telstatshmp->Daz = op->s_az;
     telstatshmp->DARA = ra = op->s_ra;
@@ -1078,6 +1470,7 @@ static int trackObj(Obj *op, int first)
     HMOT->dpos = x;
     DMOT->dpos = y;
     RMOT->dpos = r;
+    telshm_wend(telstatshmp);
 
     /* check progress, revert to hunting if lose track */
     switch (telstatshmp->telstate)
@@ -1115,6 +1508,14 @@ static int trackObj(Obj *op, int first)
 static void findAxes(Now *np, Obj *op, double *xp, double *yp, double *rp)
 {
     double ha, dec;
+
+    findHADec(np, op, &ha, &dec);
+    hd2xyr(ha, dec, xp, yp, rp);
+}
+
+/* find the apparent ha and dec of op at np, including any offsets */
+static void findHADec(Now *np, Obj *op, double *hap, double *decp)
+{
     Obj fobj;
 
     if (r_offset || d_offset)
@@ -1140,8 +1541,54 @@ static void findAxes(Now *np, Obj *op, double *xp, double *yp, double *rp)
 
     epoch = EOD;
     obj_cir(np, op);
-    aa_hadec(lat, op->s_alt, op->s_az, &ha, &dec);
-    hd2xyr(ha, dec, xp, yp, rp);
+    aa_hadec(lat, op->s_alt, op->s_az, hap, decp);
+}
+
+/* TPFunc for computeTrack() */
+static void pathHADec(double t, double v[TP_NV], void *arg)
+{
+    PathArg *pap = (PathArg *)arg;
+
+    if (pap->bg)
+        tel_lock();
+    pap->np->n_mjd = t;
+    findHADec(pap->np, pap->op, &v[0], &v[1]);
+    if (pap->bg)
+        tel_unlock();
+}
+
+/* TKFunc for computeTrack(): the axes ms into the profile */
+static void pathXYR(int ms, double v[TK_NV], void *arg)
+{
+    XYRArg *xap = (XYRArg *)arg;
+    Now *np = xap->np;
+
+    if (xap->bg)
+        tel_lock();
+    mjd = xap->mjd0 + ms / (SPD * 1000);
+    if (xap->tp)
+    {
+        double hd[TP_NV];
+
+        tp_eval(xap->tp, mjd, hd);
+        refractHADec(np, &hd[0], &hd[1]);
+        hd2xyr(hd[0], hd[1], &v[TEL_HM], &v[TEL_DM], &v[TEL_RM]);
+    }
+    else
+        findAxes(np, xap->op, &v[TEL_HM], &v[TEL_DM], &v[TEL_RM]);
+    (void)chkLimits(1, &v[TEL_HM], &v[TEL_DM], &v[TEL_RM]); /* let limit protect */
+    if (xap->bg)
+        tel_unlock();
+}
+
+/* refract the apparent ha and dec at np, as obj_cir() does */
+static void refractHADec(Now *np, double *hap, double *decp)
+{
+    double alt, az;
+
+    hadec_aa(lat, *hap, *decp, &alt, &az);
+    refract(pressure, temp, alt, &alt);
+    aa_hadec(lat, alt, az, hap, decp);
 }
 
 /* convert an ha/dec to scope x/y/r, allowing for mesh corrections.
@@ -1206,6 +1653,9 @@ static void mkCook()
     double lst, ra, ha, dec, alt, az;
     double mdha, mddec;
     double x, y, r;
+    uint64_t t0 = telstats_now();
+
+    telshm_wbegin(telstatshmp);
 
     /* handy axis values */
     x = HMOT->cpos;
@@ -1251,21 +1701,36 @@ static void mkCook()
     /* find position angle */
     tel_hadec2PA(ha, dec, tap, lat, &r);
     telstatshmp->CPA = r;
+    telshm_wend(telstatshmp);
+
+    tdstat(ST_MKCOOK, t0);
 }
 
-/* read the raw values */
-static void readRaw()
+/* take one snapshot of each axis, all at once, and update the raw values.
+ * the focus snapshot is taken too so focus.c can use it this cycle.
+ * return 0 if all ok, else -1 if any snapshot failed.
+ */
+static int readRaw()
 {
     MotorInfo *mip;
+    int ok[TEL_NM];
+    uint64_t t0 = telstats_now();
+    int ret;
 
+    ret = csiSnapAll(ok);
+
+    telshm_wbegin(telstatshmp);
     FEM(mip)
     {
-        if (!mip->have)
+        CSISnap *sp;
+
+        if (!mip->have || !ok[mip - telstatshmp->minfo])
             continue;
+        sp = MIPSNAP(mip);
 
         if (virtual_mode)
         {
-            mip->raw = vmcGetPosition(mip->axis);
+            mip->raw = sp->mpos;
             mip->cpos = (2 * PI) * mip->sign * mip->raw / mip->step;
         }
         else
@@ -1273,21 +1738,25 @@ static void readRaw()
             if (mip->haveenc)
             {
                 double draw;
-                int raw;
+                int raw = sp->epos;
 
                 /* just change by half-step if encoder changed by 1 */
-                raw = csi_rix(MIPSFD(mip), "=epos;");
                 draw = abs(raw - mip->raw) == 1 ? (raw + mip->raw) / 2.0 : raw;
                 mip->raw = raw;
                 mip->cpos = (2 * PI) * mip->esign * draw / mip->estep;
             }
             else
             {
-                mip->raw = csi_rix(MIPSFD(mip), "=mpos;");
+                mip->raw = sp->mpos;
                 mip->cpos = (2 * PI) * mip->sign * mip->raw / mip->step;
             }
         }
     }
+
+    telshm_wend(telstatshmp);
+
+    tdstat(ST_READRAW, t0);
+    return (ret);
 }
 
 /* issue a stop to all telescope axes */
@@ -1478,6 +1947,7 @@ static int chkLimits(int wrapok, double *xp, double *yp, double *rp)
 /* set all desireds to currents */
 static void dummyTarg()
 {
+    telshm_wbegin(telstatshmp);
     HMOT->dpos = HMOT->cpos;
     DMOT->dpos = DMOT->cpos;
     RMOT->dpos = RMOT->cpos;
@@ -1490,6 +1960,7 @@ static void dummyTarg()
     telstatshmp->Dalt = telstatshmp->Calt;
     telstatshmp->Daz = telstatshmp->Caz;
     telstatshmp->DPA = telstatshmp->CPA;
+    telshm_wend(telstatshmp);
 }
 
 /* called when get a j* jog command while TRACKING.
@@ -1664,7 +2135,11 @@ static void jogSlew(int first, char dircode)
     }
     else
     {
-        csi_w(MIPCFD(mip), "clock=0;");
+        /* on the status channel, as in trackObj1(), so no snapshot of the
+         * old clock is still to come once its model is reset.
+         */
+        csiSetvar(MIPSFD(mip), "clock", 0);
+        csiClockReset(mip);
         csi_w(MIPCFD(mip), "timeout=300000;");
         csi_w(MIPCFD(mip), "mtvel=%d;", CVELStp(mip));
     }
@@ -1804,6 +2279,13 @@ static void initCfg()
         {"LARGEXP", CFG_INT, &LARGEXP},
     };
 
+    static CfgEntry tdcfg2[] = {
+        {"TRACKMAS", CFG_DBL, &TRACKMAS},
+        {"TRACKTOL", CFG_DBL, &TRACKTOL},
+        {"TRACKKNOTS", CFG_INT, &TRACKKNOTS},
+        {"TRACKSTREAM", CFG_INT, &TRACKSTREAM},
+    };
+
     MotorInfo *mip;
     TelAxes *tap;
     int n;
@@ -1831,12 +2313,24 @@ static void initCfg()
         XP += (PI / 2);
     }
 
+    /* optional, default 1 mas, PPTRACK evenly, satellites each 10 secs */
+    TRACKMAS = 1;
+    TRACKTOL = 0;
+    TRACKKNOTS = PPTRACK;
+    TRACKSTREAM = 10;
+    (void)readCfgFile(1, tdcfn, tdcfg2, sizeof(tdcfg2) / sizeof(tdcfg2[0]));
+
     /* misc checks */
     if (TRACKINT <= 0)
     {
         tdlog("TRACKINT must be > 0\n");
         die();
     }
+    if (TRACKKNOTS < 2 || TRACKKNOTS > TK_MAXN)
+    {
+        tdlog("TRACKKNOTS must be 2 .. %d\n", TK_MAXN);
+        die();
+    }
 
     /* install H */
 
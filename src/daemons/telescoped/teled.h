@@ -1,3 +1,5 @@
+#include "telstats.h"
+
 /* ids for fifos.
  * N.B. see fifos[] in telescoped.c
  */
@@ -7,6 +9,24 @@ typedef enum
     Focus_Id
 } FifoId;
 
+/* stages timed in telstatsp.
+ * N.B. see names[] in init_stats()
+ */
+typedef enum
+{
+    ST_POLL,       /* tel_poll(), one whole control cycle */
+    ST_TRACKOBJ,   /* trackObj() */
+    ST_READRAW,    /* readRaw() */
+    ST_MKCOOK,     /* mkCook() */
+    ST_BUILDTRACK, /* buildTrack() */
+    ST_CSISNAP,    /* one csimc snapshot round trip, all axes */
+    ST_CSIXCHG,    /* any other csimc round trip, as csiRix() or csiSetvar() */
+    ST_TICKLATE,   /* how late each control tick was serviced */
+    ST_RENEWTRACK, /* renewTrack(), swapping in the next profile */
+    ST_BGTRACK,    /* computing the next profile in the background */
+    ST_N
+} StatId;
+
 /* CSIMC info */
 typedef struct
 {
@@ -16,6 +36,8 @@ typedef struct
 
 #define MIPCFD(mip) (csii[(int)((mip)->axis)].cfd) /* handy mip ==> cfd */
 #define MIPSFD(mip) (csii[(int)((mip)->axis)].sfd) /* handy mip ==> sfd */
+#define MIPSNAP(mip) (&csisnap[(mip)-telstatshmp->minfo]) /* mip ==> last snap */
+#define SNAPFRESH 10.0 /* ms a snapshot from this cycle is still current */
 
 /* axes.c */
 extern int axis_home(MotorInfo *mip, FifoId fid, int first);
@@ -26,6 +48,7 @@ extern int axisHomedCheck(MotorInfo *mip, char msgbuf[]);
 
 /* csimc.c */
 extern CSIMCInfo csii[NNODES];
+extern CSISnap csisnap[TEL_NM];
 extern void csiInit(void);
 extern void csiDrain(int fd);
 extern void csiSetup(MotorInfo *mip);
@@ -35,15 +58,27 @@ extern void csiiClose(MotorInfo *mip);
 extern int csiOpen(int addr);
 extern int csiClose(int addr);
 extern int csiIsReady(int fd);
+extern int csiRix(int fd, char *cmd);
+extern int csiSetvar(int fd, char *name, int v);
+extern int csiSnap(MotorInfo *mip);
+extern int csiSnapAll(int ok[TEL_NM]);
+extern double csiSnapAge(MotorInfo *mip);
+extern void csiClockReset(MotorInfo *mip);
+extern double csiClock(MotorInfo *mip);
+extern int csiClockRate(MotorInfo *mip, double *ratep, double *sep);
+extern void csiPollReady(void);
+extern int csiCfdReady(MotorInfo *mip);
 
 /* fifoio.c */
 extern void fifoWrite(FifoId f, int code, char *fmt, ...);
 extern void init_fifos(void);
 extern void chk_fifos(void);
+extern void fifoWatch(int fd, int on);
 extern void close_fifos(void);
 
 /* focus.c */
 extern void focus_msg(char *msg);
+extern int focus_busy(void);
 
 /* mountcor.c */
 extern void init_mount_cor(void);
@@ -51,11 +86,17 @@ extern void tel_mount_cor(double ha, double dec, double *dhap, double *ddecp);
 
 /* tel.c */
 extern void tel_msg(char *msg);
+extern int tel_busy(void);
+extern void tel_lock(void);
+extern void tel_unlock(void);
 
 /* telescoped.c */
 extern int DOSTOW;
 extern double STOWALT, STOWAZ, STOWTO;
+extern int POLL_PERIOD, IDLE_PERIOD;
 extern TelStatShm *telstatshmp;
+extern TelStats *telstatsp;
+extern TelRing *telringp;
 extern int virtual_mode;
 extern char tscfn[];
 extern char tdcfn[];
@@ -65,4 +106,5 @@ extern char dcfn[];
 extern void init_cfg(void);
 extern void allstop(void);
 extern void tdlog(char *fmt, ...);
+extern void tdstat(StatId id, uint64_t t0);
 extern void die(void);
@@ -42,11 +42,15 @@
 #include "running.h"
 #include "strops.h"
 #include "telenv.h"
+#include "telring.h"
+#include "telstats.h"
 #include "telstatshm.h"
 
 #include "teled.h"
 
 TelStatShm *telstatshmp; /* shared telescope info */
+TelStats *telstatsp;     /* shared timing statistics, NULL if none */
+TelRing *telringp;       /* shared per-cycle telemetry, NULL if none */
 int virtual_mode;        /* non-zero for virtual mode enabled */
 
 char tscfn[] = "archive/config/telsched.cfg";
@@ -58,6 +62,8 @@ static void usage(void);
 static void init_all(void);
 static void allreset(void);
 static void init_shm(void);
+static void init_stats(void);
+static void init_ring(void);
 static void init_tz(void);
 static void on_sig(int fake);
 static void main_loop(void);
@@ -68,6 +74,7 @@ static char *progname;
 // Global values read from config
 int DOSTOW;
 double STOWALT, STOWAZ, STOWTO;
+int POLL_PERIOD, IDLE_PERIOD; /* control tick period when moving and not, ms */
 
 int main(ac, av) int ac;
 char *av[];
@@ -190,6 +197,12 @@ void init_cfg()
     /* convert seconds to days */
     STOWTO /= SPD;
 
+    /* tick periods are optional */
+    POLL_PERIOD = 20;
+    (void)read1CfgEntry(1, tdcfn, "POLL_PERIOD", CFG_INT, &POLL_PERIOD, 0);
+    IDLE_PERIOD = 100;
+    (void)read1CfgEntry(1, tdcfn, "IDLE_PERIOD", CFG_INT, &IDLE_PERIOD, 0);
+
     /* basic defaults if no GPS or weather station */
     lng = -LONGITUDE;        /* we want rads +E */
     lat = LATITUDE;          /* we want rads +N */
@@ -200,6 +213,7 @@ void init_cfg()
 #undef NTSCFG
 }
 
+/* run forever, chk_fifos() waits for something to do */
 static void main_loop()
 {
     while (1)
@@ -230,6 +244,10 @@ static void init_all()
     /* connect to the telstatshm segment */
     init_shm();
 
+    /* and the timing statistics and telemetry */
+    init_stats();
+    init_ring();
+
     /* divine timezone */
     init_tz();
 
@@ -260,41 +278,65 @@ static void init_all()
 /* create the telstatshmp shared memory segment */
 static void init_shm()
 {
-    int len = sizeof(TelStatShm);
-    int shmid;
-    long addr;
-
-    /* open/create */
-    shmid = shmget(TELSTATSHMKEY, len, 0664);
-    if (shmid < 0)
-    {
-        if (errno == ENOENT)
-            shmid = shmget(TELSTATSHMKEY, len, 0664 | IPC_CREAT);
-        if (shmid < 0)
-        {
-            tdlog("shmget: %s", strerror(errno));
-            exit(1);
-        }
-    }
+    int old;
 
-    /* connect */
-    addr = (long)shmat(shmid, (void *)0, 0);
-    if (addr == -1)
+    /* open/create, replacing one left by an older version */
+    telstatshmp = telshm_attach(1, &old);
+    if (!telstatshmp)
     {
-        tdlog("shmat: %s", strerror(errno));
+        tdlog("shm: %s", telshm_error());
         exit(1);
     }
-
-    /* handy */
-    telstatshmp = (TelStatShm *)addr;
+    if (old)
+        tdlog("Replaced old shm of different size");
 
     /* always zero when we start */
-    memset((void *)addr, 0, len);
+    memset((void *)telstatshmp, 0, sizeof(TelStatShm));
 
     /* store the PID of this process */
     telstatshmp->telescoped_pid = getpid();
 }
 
+/* create the timing statistics segment and name each stage.
+ * we can run without it so just log if trouble.
+ */
+static void init_stats()
+{
+    static char *names[ST_N] = {
+        [ST_POLL] = "tel_poll",   [ST_TRACKOBJ] = "trackObj",     [ST_READRAW] = "readRaw",
+        [ST_MKCOOK] = "mkCook",   [ST_BUILDTRACK] = "buildTrack", [ST_CSISNAP] = "csimc snap",
+        [ST_CSIXCHG] = "csimc xchg", [ST_TICKLATE] = "tick late", [ST_RENEWTRACK] = "renewTrack",
+        [ST_BGTRACK] = "bg track",
+    };
+    int i;
+
+    telstatsp = telstats_open(1);
+    if (!telstatsp)
+    {
+        tdlog("Timing statistics not available: %s", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < ST_N; i++)
+        telstats_name(telstatsp, i, names[i]);
+}
+
+/* create the per-cycle telemetry ring.
+ * we can run without it so just log if trouble.
+ */
+static void init_ring()
+{
+    telringp = telring_open(1);
+    if (!telringp)
+        tdlog("Telemetry ring not available: %s", strerror(errno));
+}
+
+/* add the time since t0, from telstats_now(), as a sample of stage id */
+void tdstat(StatId id, uint64_t t0)
+{
+    telstats_add(telstatsp, id, telstats_now() - t0);
+}
+
 static void init_tz()
 {
     Now *np = &telstatshmp->now;
@@ -0,0 +1,419 @@
+/* compare track paths from ../trackpath.c with reducing every point, as
+ * buildTrack() did, for a variety of targets, sites and times. reports the
+ * worst difference in each axis, how many full reductions each took and the
+ * time for each way of building a profile. then, for an equatorial and an
+ * alt-az mount, compares PPTRACK even points with those tp_knots() places.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "telstatshm.h"
+
+#include "../trackpath.h"
+
+#define PPTRACK 60     /* points per profile, as tel.c */
+#define TRACKINT 1200  /* default profile span, secs, as telescoped.cfg */
+#define NSTARTS 24     /* profiles per target per site, across a day */
+#define MINALT 5.0     /* skip profiles which dip below this, degrees */
+#define MAXALT 89.0    /* nor place knots on those which pass above this */
+#define MAS (PI / 180 / 3600 / 1000) /* rads per milliarcsec */
+#define TRACKSAMP (2 * (PPTRACK - 1) + 1) /* samples tp_knots() takes, as tel.c */
+#define ESTEP 12976128 /* encoder counts per rev, as telescoped.cfg */
+#define CHKMS 2000     /* how often to check the knots, ms */
+#define NMOUNT 2       /* equatorial, alt-az */
+#define NWAY 3         /* PPTRACK even, fewest even, placed */
+#define MAXCHK 6000    /* most checks per profile */
+#define SNAP 2e-5      /* solve_sphere() snaps B within 1e-5 of this */
+
+/* what pathHADec() needs */
+typedef struct
+{
+    Now *np; /* as the site but with no atmosphere */
+    Obj *op;
+} PathArg;
+
+/* what pathXYR() needs */
+typedef struct
+{
+    Now *np;         /* the site */
+    Obj *op;         /* target, if no tp */
+    TrackPath *tp;   /* path fitted above the atmosphere, else NULL */
+    TelAxes *tap;    /* mount */
+    double v0[TK_NV]; /* first values */
+    int unwrap;       /* keep the rest continuous with v0 */
+    int snap;         /* set if the last is where solve_sphere() snaps */
+} XYRArg;
+
+/* results of the ways of placing knots on each mount */
+static struct
+{
+    long nprof, nknots, nbytes, nover;
+    double worst; /* mas */
+    double us;    /* placing them */
+} kstats[NMOUNT][NWAY];
+static long nsnap; /* checks skipped */
+
+static void findHADec(Now *np, Obj *op, double *hap, double *decp);
+static void pathXYR(int ms, double v[TK_NV], void *arg);
+static void knotTests(Now *np, Obj *op, TrackPath *tp, double mjd0, int trackint, double tolmas, int maxn);
+static int uploadBytes(TrackKnots *tk);
+static void pathHADec(double m, double v[TP_NV], void *arg);
+static void refractHADec(Now *np, double *hap, double *decp);
+static double diffAngle(double a, double b);
+static double usNow(void);
+
+static char *edb[] = {
+    "Polaris,f|S,2:31:49.1,89:15:51,2.0,2000",
+    "Vega,f|S,18:36:56.3,38:47:01,0.0,2000",
+    "Equator,f,6:00:00,0:00:00,5.0,2000",
+    "Southern,f,12:00:00,-60:00:00,5.0,2000",
+    "SigmaOct,f|S,21:08:46.9,-88:57:23,5.4,2000",
+};
+
+static struct
+{
+    char *name;
+    double latdeg; /* degrees */
+} sites[] = {
+    {"La Palma", 28.76},
+    {"Sutherland", -32.38},
+    {"equator", 0},
+    {"60N", 60},
+};
+
+int main(int ac, char *av[])
+{
+    double maxmas = ac > 1 ? atof(av[1]) : 1.0;
+    int trackint = ac > 2 ? atoi(av[2]) : TRACKINT;
+    double tolmas = ac > 3 ? atof(av[3]) : 50.0;
+    int maxn = ac > 4 ? atoi(av[4]) : PPTRACK;
+    double mjd0 = 54730.0; /* 2008 Sep 20 */
+    double span = (PPTRACK - 1) * trackint / (PPTRACK * SPD);
+    double tfull = 0, tfit = 0;
+    long nprof = 0, nfallback = 0, nfulls = 0;
+    Obj objs[8];
+    int nobjs = 0;
+    int s, o, k, i;
+
+    /* fixed stars and some planets. tel.c reduces earth satellites at
+     * every point regardless.
+     */
+    for (i = 0; i < sizeof(edb) / sizeof(edb[0]); i++)
+        if (db_crack_line(edb[i], &objs[nobjs], NULL) == 0)
+            nobjs++;
+    for (i = 0; i < 3; i++)
+    {
+        int codes[] = {SUN, MOON, JUPITER};
+        char *names[] = {"Sun", "Moon", "Jupiter"};
+
+        zero_mem(&objs[nobjs], sizeof(Obj));
+        objs[nobjs].o_type = PLANET;
+        strcpy(objs[nobjs].o_name, names[i]);
+        ((ObjPl *)&objs[nobjs])->pl_code = codes[i];
+        nobjs++;
+    }
+
+    printf("%d points over %d secs, allowing %g mas\n", PPTRACK, trackint, maxmas);
+    printf("%-10s %-11s %5s %6s %9s %9s %6s\n", "target", "site", "profs", "fallbk", "ha mas", "dec mas", "fulls");
+
+    for (o = 0; o < nobjs; o++)
+        for (s = 0; s < sizeof(sites) / sizeof(sites[0]); s++)
+        {
+            double worst[TP_NV] = {0, 0};
+            int np1 = 0, nfb = 0, nf = 0;
+
+            for (k = 0; k < NSTARTS; k++)
+            {
+                Now now, now0, *np = &now;
+                double ref[PPTRACK][TP_NV];
+                PathArg pa;
+                TrackPath tp;
+                double t0, t1, t2, lowest = 90, highest = 0;
+                int ok;
+
+                zero_mem(np, sizeof(now));
+                np->n_lat = degrad(sites[s].latdeg);
+                np->n_lng = degrad(-17.88);
+                np->n_temp = 10;
+                np->n_pressure = 1010;
+                np->n_elev = 2300 / ERAD;
+                np->n_epoch = EOD;
+
+                /* reduce every point, as was */
+                t0 = usNow();
+                for (i = 0; i < PPTRACK; i++)
+                {
+                    np->n_mjd = mjd0 + k / (double)NSTARTS + i * trackint / (PPTRACK * SPD);
+                    findHADec(np, &objs[o], &ref[i][0], &ref[i][1]);
+                    if (raddeg(objs[o].s_alt) < lowest)
+                        lowest = raddeg(objs[o].s_alt);
+                    if (raddeg(objs[o].s_alt) > highest)
+                        highest = raddeg(objs[o].s_alt);
+                }
+                t1 = usNow();
+                if (lowest < MINALT)
+                    continue;
+
+                /* fit the path above the atmosphere, interpolate, then refract */
+                now0 = now;
+                now0.n_pressure = 0;
+                pa.np = &now0;
+                pa.op = &objs[o];
+                ok = tp_fit(&tp, mjd0 + k / (double)NSTARTS, span, maxmas * MAS, pathHADec, &pa) == 0;
+                for (i = 0; ok && i < PPTRACK; i++)
+                {
+                    double v[TP_NV];
+                    int j;
+
+                    tp_eval(&tp, mjd0 + k / (double)NSTARTS + i * trackint / (PPTRACK * SPD), v);
+                    refractHADec(np, &v[0], &v[1]);
+                    for (j = 0; j < TP_NV; j++)
+                    {
+                        double e = fabs(diffAngle(v[j], ref[i][j])) / MAS;
+                        if (e > worst[j])
+                            worst[j] = e;
+                    }
+                }
+                t2 = usNow();
+
+                if (highest < MAXALT)
+                    knotTests(np, &objs[o], ok ? &tp : NULL, mjd0 + k / (double)NSTARTS, trackint, tolmas, maxn);
+
+                np1++;
+                nf += tp.nfull;
+                tfull += t1 - t0;
+                tfit += t2 - t1;
+                if (!ok)
+                {
+                    nfb++;
+                    tfit += t1 - t0; /* caller then reduces every point too */
+                }
+            }
+
+            if (np1 == 0)
+                continue;
+            printf("%-10s %-11s %5d %6d %9.4f %9.4f %6.1f\n", objs[o].o_name, sites[s].name, np1, nfb, worst[0],
+                   worst[1], (double)nf / np1);
+            nprof += np1;
+            nfallback += nfb;
+            nfulls += nf;
+        }
+
+    printf("%ld profiles, %ld fell back, %.1f full reductions each\n", nprof, nfallback, (double)nfulls / nprof);
+    printf("per profile: every point %.1f us, fitted %.1f us, %.1fx faster\n", tfull / nprof, tfit / nprof,
+           tfull / tfit);
+
+    printf("\nknots allowing %g mas, at most %d, checked each %d ms, %ld skipped\n", tolmas, maxn, CHKMS, nsnap);
+    printf("%-8s %-12s %6s %7s %9s %6s %7s\n", "mount", "knots", "each", "bytes", "worst mas", "over", "us");
+    for (s = 0; s < NMOUNT; s++)
+        for (k = 0; k < NWAY; k++)
+        {
+            char *mounts[] = {"equat", "alt-az"};
+            char *ways[] = {"PPTRACK even", "fewest even", "placed"};
+            long n = kstats[s][k].nprof;
+
+            printf("%-8s %-12s %6.1f %7.0f %9.1f %5.1f%% %7.1f\n", mounts[s], ways[k], (double)kstats[s][k].nknots / n,
+                   (double)kstats[s][k].nbytes / n, kstats[s][k].worst, 100.0 * kstats[s][k].nover / n,
+                   kstats[s][k].us / n);
+        }
+
+    return (0);
+}
+
+/* apparent ha and dec of op at np, as tel.c findAxes() */
+static void findHADec(Now *np, Obj *op, double *hap, double *decp)
+{
+    epoch = EOD;
+    obj_cir(np, op);
+    aa_hadec(lat, op->s_alt, op->s_az, hap, decp);
+}
+
+/* TPFunc for tp_fit() */
+static void pathHADec(double m, double v[TP_NV], void *arg)
+{
+    PathArg *pap = (PathArg *)arg;
+
+    pap->np->n_mjd = m;
+    findHADec(pap->np, pap->op, &v[0], &v[1]);
+}
+
+/* place knots along the profile of op from mjd0 at np each way for each
+ * mount, then check them against the path every CHKMS. checks where the
+ * path itself jumps, as when aa_hadec() snaps the hour angle to 6h, are
+ * skipped since no knots can follow that.
+ */
+static void knotTests(Now *np, Obj *op, TrackPath *tp, double mjd0, int trackint, double tolmas, int maxn)
+{
+    int span = 1000 * (PPTRACK - 1) * trackint / PPTRACK;
+    double chk[MAXCHK][TK_NV];
+    int good[MAXCHK];
+    TelAxes tax;
+    XYRArg xa;
+    int m, w, i, j, c, nchk;
+
+    nchk = span / CHKMS + 1;
+    if (nchk > MAXCHK)
+        nchk = MAXCHK;
+
+    for (m = 0; m < NMOUNT; m++)
+    {
+        /* pole of the mount at the celestial pole or the zenith */
+        zero_mem(&tax, sizeof(tax));
+        tax.DT = m == 0 ? PI / 2 : lat;
+        xa.np = np;
+        xa.op = op;
+        xa.tp = tp;
+        xa.tap = &tax;
+        xa.unwrap = 0;
+        np->n_mjd = mjd0;
+        pathXYR(0, xa.v0, &xa);
+        xa.unwrap = 1;
+
+        for (c = 0; c < nchk; c++)
+        {
+            pathXYR(c * CHKMS, chk[c], &xa);
+            good[c] = !xa.snap;
+            nsnap += xa.snap;
+        }
+
+        for (w = 0; w < NWAY; w++)
+        {
+            TrackKnots tk;
+            double worst = 0, t0 = usNow();
+
+            if (w == 0)
+            {
+                tk.n = PPTRACK;
+                for (i = 0; i < PPTRACK; i++)
+                {
+                    tk.ms[i] = 1000 * trackint / PPTRACK * i;
+                    pathXYR(tk.ms[i], tk.v[i], &xa);
+                }
+            }
+            else
+                (void)tp_knots(&tk, span, TRACKSAMP, tolmas * MAS, maxn, w == 1, pathXYR, &xa);
+            kstats[m][w].us += usNow() - t0;
+
+            for (c = 0, j = 0; c < nchk; c++)
+            {
+                int ms = c * CHKMS;
+
+                while (j < tk.n - 2 && tk.ms[j + 1] <= ms)
+                    j++;
+                for (i = 0; good[c] && i < TK_NV; i++)
+                {
+                    double l = tk.v[j][i] + (tk.v[j + 1][i] - tk.v[j][i]) * (ms - tk.ms[j]) / (tk.ms[j + 1] - tk.ms[j]);
+
+                    if (fabs(l - chk[c][i]) / MAS > worst)
+                        worst = fabs(l - chk[c][i]) / MAS;
+                }
+            }
+
+            kstats[m][w].nprof++;
+            kstats[m][w].nknots += tk.n;
+            kstats[m][w].nbytes += uploadBytes(&tk);
+            if (worst > kstats[m][w].worst)
+                kstats[m][w].worst = worst;
+            if (worst > tolmas)
+                kstats[m][w].nover++;
+        }
+    }
+}
+
+/* TKFunc for tp_knots(): x and y of the target ms into the profile */
+static void pathXYR(int ms, double v[TK_NV], void *arg)
+{
+    XYRArg *xap = (XYRArg *)arg;
+    Now now = *xap->np, *np = &now;
+    double ha, dec, alt, az;
+    int i;
+
+    np->n_mjd += ms / (1000 * SPD);
+    if (xap->tp)
+    {
+        double hd[TP_NV];
+
+        tp_eval(xap->tp, mjd, hd);
+        ha = hd[0];
+        dec = hd[1];
+        refractHADec(np, &ha, &dec);
+    }
+    else
+        findHADec(np, xap->op, &ha, &dec);
+    tel_hadec2xy(ha, dec, xap->tap, &v[0], &v[1]);
+    v[2] = 0; /* no rotator, as telescoped.cfg */
+
+    if (xap->unwrap)
+        for (i = 0; i < TK_NV; i++)
+            v[i] -= 2 * PI * floor((v[i] - xap->v0[i]) / (2 * PI) + 0.5);
+
+    /* near where aa_hadec() or an alt-az tel_hadec2xy() snap? */
+    hadec_aa(lat, ha, dec, &alt, &az);
+    xap->snap = fabs(sin(alt) - sin(dec) * sin(lat)) < SNAP;
+    if (xap->tap->DT != PI / 2)
+        xap->snap |= fabs(sin(dec) - sin(alt) * sin(lat)) < SNAP;
+}
+
+/* bytes of the e/mtrack command for tk, as tel.c loadTrack(), or with the
+ * time of each knot too if they are not evenly spaced.
+ */
+static int uploadBytes(TrackKnots *tk)
+{
+    char buf[TK_MAXN * 32 + 64];
+    int i, l, even;
+
+    for (even = 1, i = 2; i < tk->n; i++)
+        if (tk->ms[i] != i * tk->ms[1])
+            even = 0;
+
+    l = sprintf(buf, "etrack(%d", 0);
+    if (even)
+        l += sprintf(buf + l, ",%d", tk->ms[1]);
+    for (i = 0; i < tk->n; i++)
+    {
+        if (!even)
+            l += sprintf(buf + l, ",%d", tk->ms[i]);
+        l += sprintf(buf + l, ",%.0f", ESTEP * tk->v[i][0] / (2 * PI) + .5);
+    }
+    l += sprintf(buf + l, ");");
+
+    return (l);
+}
+
+/* refract the apparent ha and dec at np, as obj_cir() does */
+static void refractHADec(Now *np, double *hap, double *decp)
+{
+    double alt, az;
+
+    hadec_aa(lat, *hap, *decp, &alt, &az);
+    refract(pressure, temp, alt, &alt);
+    aa_hadec(lat, alt, az, hap, decp);
+}
+
+/* a - b, in -PI .. PI */
+static double diffAngle(double a, double b)
+{
+    double d = fmod(a - b, 2 * PI);
+
+    if (d > PI)
+        d -= 2 * PI;
+    if (d < -PI)
+        d += 2 * PI;
+    return (d);
+}
+
+/* return a monotonic clock in microseconds */
+static double usNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e6 + ts.tv_nsec / 1e3);
+}
@@ -0,0 +1,311 @@
+/* find the path of a target across a track interval from a few full
+ * reductions instead of one per track point.
+ *
+ * the apparent ha and dec of anything we can track are smooth across a
+ * TRACKINT so we reduce at Chebyshev-Lobatto epochs spanning it and
+ * interpolate between them with the barycentric form of Lagrange's formula.
+ * the interpolation is checked against more full reductions halfway between
+ * epochs. if it is off by more than allowed we double the epochs, which
+ * reuses every reduction so far including the checks, up to TP_MAXN.
+ *
+ * the controllers move in straight lines between the points they are given
+ * so tp_knots() then puts those only as close together as the path bends.
+ */
+
+#include <math.h>
+
+#include "P_.h"
+#include "astro.h"
+
+#include "trackpath.h"
+
+static void full(TrackPath *tp, int n, int j, TPFunc fn, void *arg, double v[TP_NV]);
+static double epochX(int n, int j);
+static int isCheck(int n, int j);
+static double lineErr(double s[][TK_NV], double bend[], int sms[], int a, int b);
+
+/* fit tp to fn across mjd0 .. mjd0+span, days, such that the interpolated
+ * angles are within maxerr rads of fn at each check.
+ * return 0 if ok, else -1 if even TP_MAXN epochs are not enough, in which
+ *   case the caller should reduce every point itself.
+ */
+int tp_fit(TrackPath *tp, double mjd0, double span, double maxerr, TPFunc fn, void *arg)
+{
+    double chk[2 * TP_MAXN][TP_NV]; /* reductions at the checks */
+    int n, m, i, j, ok;
+
+    tp->mjd0 = mjd0;
+    tp->span = span;
+    tp->nfull = 0;
+    tp->n = TP_MINN;
+    for (j = 0; j < tp->n; j++)
+        full(tp, tp->n, j, fn, arg, tp->v[j]);
+
+    while (1)
+    {
+        n = tp->n;
+        m = 2 * (n - 1) + 1;
+
+        /* check halfway between epochs, in angle, where m would add its
+         * own: by the ends where the error is largest and by the middle.
+         */
+        tp->err = 0;
+        for (j = 1; j < m; j += 2)
+        {
+            double v[TP_NV];
+
+            if (!isCheck(n, j))
+                continue;
+            full(tp, m, j, fn, arg, chk[j]);
+            tp_eval(tp, tp->mjd0 + span * (1 - epochX(m, j)) / 2, v);
+            for (i = 0; i < TP_NV; i++)
+                if (fabs(v[i] - chk[j][i]) > tp->err)
+                    tp->err = fabs(v[i] - chk[j][i]);
+        }
+        ok = tp->err <= maxerr;
+        if (ok && n > 3)
+            return (0); /* the checks are not all of m so just drop them */
+        if (!ok && m > TP_MAXN)
+            return (-1);
+
+        /* double up: the old epochs are the even ones, the checks some odd.
+         * when ok the checks were all of them so m is free and only better.
+         */
+        for (j = n - 1; j >= 0; j--)
+            for (i = 0; i < TP_NV; i++)
+                tp->v[2 * j][i] = tp->v[j][i];
+        for (j = 1; j < m; j += 2)
+        {
+            if (isCheck(n, j))
+                for (i = 0; i < TP_NV; i++)
+                    tp->v[j][i] = chk[j][i];
+            else
+                full(tp, m, j, fn, arg, tp->v[j]);
+        }
+        tp->n = m;
+        if (ok)
+            return (0);
+    }
+}
+
+/* set v[] to the angles of tp at MJD t.
+ * N.B. they are continuous with those at tp->mjd0 so may be out of range.
+ */
+void tp_eval(TrackPath *tp, double t, double v[TP_NV])
+{
+    double x = 1 - 2 * (t - tp->mjd0) / tp->span;
+    double num[TP_NV], den = 0;
+    int i, j;
+
+    for (i = 0; i < TP_NV; i++)
+        num[i] = 0;
+
+    for (j = 0; j < tp->n; j++)
+    {
+        double d = x - epochX(tp->n, j);
+        double w;
+
+        if (d == 0)
+        {
+            for (i = 0; i < TP_NV; i++)
+                v[i] = tp->v[j][i];
+            return;
+        }
+
+        w = ((j & 1) ? -1.0 : 1.0) / d;
+        if (j == 0 || j == tp->n - 1)
+            w /= 2;
+        den += w;
+        for (i = 0; i < TP_NV; i++)
+            num[i] += w * tp->v[j][i];
+    }
+
+    for (i = 0; i < TP_NV; i++)
+        v[i] = num[i] / den;
+}
+
+/* place knots along fn across 0 .. span ms, at most maxn, such that straight
+ * lines between them are within maxerr of fn, judged from nsamp samples
+ * spaced evenly across it, ends included.
+ * if even the knots are a whole number of ms apart, as e/mtrack needs, and
+ * the last may be past span; else each is at the sample furthest along that
+ * the line from the one before still fits.
+ * return 0 if ok, else -1 if maxn are not enough, in which case tk is maxn
+ *   evenly spaced, which is as close as we come.
+ */
+int tp_knots(TrackKnots *tk, int span, int nsamp, double maxerr, int maxn, int even, TKFunc fn, void *arg)
+{
+    double s[TK_MAXN][TK_NV];   /* samples */
+    double bend[TK_MAXN] = {0}; /* most fn strays from lines between samples */
+    int sms[TK_MAXN];           /* time of each */
+    double c;
+    int n, a, b, i, j, k;
+
+    if (nsamp > TK_MAXN)
+        nsamp = TK_MAXN;
+    if (nsamp < 3)
+        nsamp = 3; /* fewest with a bend between the ends */
+    if (maxn > TK_MAXN)
+        maxn = TK_MAXN;
+
+    tk->nfn = 0;
+    for (j = 0; j < nsamp; j++)
+    {
+        sms[j] = floor((double)span * j / (nsamp - 1) + .5);
+        (*fn)(sms[j], s[j], arg);
+        tk->nfn++;
+    }
+
+    /* a line across a curve is off by an eighth of its second difference
+     * in the middle, so that much more may be hidden between samples.
+     */
+    c = 0;
+    for (j = 1; j < nsamp - 1; j++)
+    {
+        bend[j] = 0;
+        for (i = 0; i < TK_NV; i++)
+            if (fabs(s[j - 1][i] - 2 * s[j][i] + s[j + 1][i]) / 8 > bend[j])
+                bend[j] = fabs(s[j - 1][i] - 2 * s[j][i] + s[j + 1][i]) / 8;
+        if (bend[j] > c)
+            c = bend[j];
+    }
+    bend[0] = bend[1];
+    bend[nsamp - 1] = bend[nsamp - 2];
+
+    if (!even)
+    {
+        tk->n = 0;
+        tk->err = 0;
+        for (a = 0; tk->n < maxn; a = b)
+        {
+            tk->ms[tk->n] = sms[a];
+            for (i = 0; i < TK_NV; i++)
+                tk->v[tk->n][i] = s[a][i];
+            tk->n++;
+            if (a == nsamp - 1)
+                return (0);
+
+            for (b = a + 1; b < nsamp - 1 && lineErr(s, bend, sms, a, b + 1) <= maxerr; b++)
+                continue;
+            if (lineErr(s, bend, sms, a, b) > tk->err)
+                tk->err = lineErr(s, bend, sms, a, b);
+        }
+        n = maxn;
+    }
+    else
+    {
+        /* that goes as the square of the spacing, so start from where the
+         * sharpest bend just fits.
+         */
+        double d = c > 0 ? (double)span / (nsamp - 1) * sqrt(maxerr / c) : span;
+
+        d = ceil(span / d) + 1;
+        n = d > maxn ? maxn : d;
+    }
+
+    /* even spacing, checked at the samples and halfway between knots */
+    while (1)
+    {
+        int dt = (span + n - 2) / (n - 1);
+
+        tk->n = n;
+        for (k = 0; k < n; k++)
+        {
+            tk->ms[k] = k * dt;
+            (*fn)(tk->ms[k], tk->v[k], arg);
+            tk->nfn++;
+        }
+
+        tk->err = 0;
+        for (j = 0; j < nsamp; j++)
+        {
+            k = sms[j] / dt;
+            if (k > n - 2)
+                k = n - 2;
+            for (i = 0; i < TK_NV; i++)
+            {
+                double v = tk->v[k][i] + (tk->v[k + 1][i] - tk->v[k][i]) * (sms[j] - tk->ms[k]) / dt;
+
+                if (fabs(v - s[j][i]) > tk->err)
+                    tk->err = fabs(v - s[j][i]);
+            }
+        }
+        for (k = 0; k < n - 1; k++)
+        {
+            double v[TK_NV];
+
+            (*fn)(tk->ms[k] + dt / 2, v, arg);
+            tk->nfn++;
+            for (i = 0; i < TK_NV; i++)
+            {
+                double l = tk->v[k][i] + (tk->v[k + 1][i] - tk->v[k][i]) * (dt / 2) / dt;
+
+                if (fabs(l - v[i]) > tk->err)
+                    tk->err = fabs(l - v[i]);
+            }
+        }
+
+        if (tk->err <= maxerr)
+            return (0);
+        if (n == maxn)
+            return (-1);
+        k = ceil((n - 1) * sqrt(tk->err / maxerr)) + 1;
+        n = k > n ? k : n + 1;
+        if (n > maxn)
+            n = maxn;
+    }
+}
+
+/* call fn at epoch j of n across tp, unwrapping each angle to be within PI
+ * of the first epoch.
+ */
+static void full(TrackPath *tp, int n, int j, TPFunc fn, void *arg, double v[TP_NV])
+{
+    int i;
+
+    (*fn)(tp->mjd0 + tp->span * (1 - epochX(n, j)) / 2, v, arg);
+    tp->nfull++;
+
+    if (n == TP_MINN && j == 0)
+        return; /* this is the first */
+    for (i = 0; i < TP_NV; i++)
+        v[i] -= 2 * PI * floor((v[i] - tp->v[0][i]) / (2 * PI) + 0.5);
+}
+
+/* return the worst error of the line from sample a to b at those between,
+ * and what bend[] says may be hidden between them.
+ */
+static double lineErr(double s[][TK_NV], double bend[], int sms[], int a, int b)
+{
+    double err = 0, hid = 0;
+    int i, j;
+
+    for (j = a; j <= b; j++)
+    {
+        if (bend[j] > hid)
+            hid = bend[j];
+        if (j == a || j == b)
+            continue;
+        for (i = 0; i < TK_NV; i++)
+        {
+            double v = s[a][i] + (s[b][i] - s[a][i]) * (sms[j] - sms[a]) / (sms[b] - sms[a]);
+
+            if (fabs(v - s[j][i]) > err)
+                err = fabs(v - s[j][i]);
+        }
+    }
+
+    return (err + hid);
+}
+
+/* return whether odd epoch j of 2(n-1)+1 is one tp_fit() checks n with */
+static int isCheck(int n, int j)
+{
+    return (j == 1 || j == ((n - 1) | 1) || j == 2 * (n - 1) - 1);
+}
+
+/* return epoch j of n in -1 .. 1, from 1 at j 0 */
+static double epochX(int n, int j)
+{
+    return (cos(j * PI / (n - 1)));
+}
@@ -0,0 +1,47 @@
+/* include file for trackpath.c, which finds the path of a target across a
+ * track interval from full reductions at only a few epochs, and where to
+ * put the points sent to the controllers along it.
+ */
+
+#ifndef TRACKPATH_H
+#define TRACKPATH_H
+
+#define TP_MINN 3  /* fewest epochs fitted, 2^k + 1 */
+#define TP_MAXN 17 /* most epochs fitted, 2^k + 1 */
+#define TP_NV 2    /* angles per epoch */
+
+/* set v[] to the TP_NV angles of the path at MJD t, rads */
+typedef void (*TPFunc)(double t, double v[TP_NV], void *arg);
+
+/* a path fitted across mjd0 .. mjd0+span */
+typedef struct
+{
+    double mjd0, span;        /* interval, days */
+    int n;                    /* epochs fitted */
+    double v[TP_MAXN][TP_NV]; /* angles at each, unwrapped to be continuous */
+    double err;               /* worst error seen at the check epochs, rads */
+    int nfull;                /* calls made to the TPFunc */
+} TrackPath;
+
+#define TK_NV 3    /* values per knot, one per axis */
+#define TK_MAXN 240 /* most knots, and most samples tp_knots() takes */
+
+/* set v[] to the TK_NV values of the path ms after it starts */
+typedef void (*TKFunc)(int ms, double v[TK_NV], void *arg);
+
+/* points along a path, between which it is taken to be straight */
+typedef struct
+{
+    int n;                    /* knots */
+    int ms[TK_MAXN];          /* time of each after the start, ms */
+    double v[TK_MAXN][TK_NV]; /* values at each */
+    double err;               /* worst error of the straight lines at the samples */
+    int nfn;                  /* calls made to the TKFunc */
+} TrackKnots;
+
+/* trackpath.c */
+extern int tp_fit(TrackPath *tp, double mjd0, double span, double maxerr, TPFunc fn, void *arg);
+extern void tp_eval(TrackPath *tp, double t, double v[TP_NV]);
+extern int tp_knots(TrackKnots *tk, int span, int nsamp, double maxerr, int maxn, int even, TKFunc fn, void *arg);
+
+#endif // TRACKPATH_H
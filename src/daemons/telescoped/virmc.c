@@ -15,6 +15,7 @@
 
 #include "virmc.h"
 #include <ctype.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,9 +51,9 @@ typedef void (*ActFunc)(int);
 static ActFunc active_func[NVNODES];
 
 // Main service loop.  This is called at each iteration of tel_poll
+// vmcGo moves us on at the speed set last time, to now
 // If we are tracking, vmcTrackProgram is executed to keep target current
-// vmcMoveToTarget handles acceleration
-// vmcGo moves us there
+// vmcMoveToTarget then sets the speed until next time
 void vmcService(int node)
 {
     VCNodePtr pvc;
@@ -66,6 +67,8 @@ void vmcService(int node)
 
     //		TRACE "vmcService %d. Tracking = %d\n",node,pvc->tracking);
 
+    oMotorGo(pvc);
+
     if (pvc->tracking)
     {
         oTrackProgram(pvc);
@@ -75,8 +78,6 @@ void vmcService(int node)
         oMoveToTarget(pvc);
     }
 
-    oMotorGo(pvc);
-
     // run our background (script) process if we've set one up.
     if (active_func[node])
         (*active_func[node])(node);
@@ -116,6 +117,9 @@ int vmcSetup(int node, double maxvelr, double maxaccr, long steps, int sign)
         if (pvc->trackPath)
             free(pvc->trackPath);
         pvc->trackPath = NULL;
+        if (pvc->trackTimes)
+            free(pvc->trackTimes);
+        pvc->trackTimes = NULL;
         pvc->numTrackPts = 0;
 
         if (steps != pvc->countsPerRev || sign != pvc->sign)
@@ -274,42 +278,55 @@ void vmcStop(int node)
 
 // Accept a list of idealized encoder positions for tracking
 // path is represented in encoder radians -- must convert to encoder positions
+// timesMs is when each is due, ms after startMs, ascending but not necessarily evenly
+// if already tracking the new path just takes over from the old one where they
+// overlap, without stopping, so paths may be streamed one after another
 // return 0 for success
-int vmcSetTrackPath(int node, int num, int startMs, int ivalMs, double *path)
+int vmcSetTrackPath(int node, int num, int startMs, int *timesMs, double *path)
 {
     int i;
     double scale;
 
     VCNodePtr pvc = &vmcNode[node];
 
-    TRACE "vmcSetTrackPath %d, %d items at %d, %d apart\n",node,num,startMs,ivalMs);
+    TRACE "vmcSetTrackPath %d, %d items at %d over %d\n",node,num,startMs,timesMs[num-1]);
 
-    pvc->lastPos = pvc->targetPos = pvc->currentPos;
-    pvc->velocity = 0;
-    pvc->lastTime = oGetTime(pvc);
+    if (!pvc->tracking)
+    {
+        pvc->lastPos = pvc->targetPos = pvc->currentPos;
+        pvc->velocity = 0;
+        pvc->trackVel = 0;
+        pvc->lastTime = oGetTime(pvc);
+    }
 
     if (pvc->trackPath)
         free(pvc->trackPath); // free previous
     pvc->trackPath = malloc(num * sizeof(double));
     if (!pvc->trackPath)
         return -1;
+    if (pvc->trackTimes)
+        free(pvc->trackTimes);
+    pvc->trackTimes = malloc(num * sizeof(int));
+    if (!pvc->trackTimes)
+        return -1;
 
-    scale = 0.5 + pvc->countsPerRev / (2 * PI);
+    scale = pvc->sign * (0.5 + pvc->countsPerRev / (2 * PI));
     //	TRACE "positions (scale = %g):\n",scale);
     for (i = 0; i < num; i++)
     {
         pvc->trackPath[i] = path[i] * scale + 0.5;
+        pvc->trackTimes[i] = timesMs[i];
         //		TRACE "%d = %g => %g\n",i,path[i],pvc->trackPath[i]);
     }
-    pvc->trackIval = ivalMs;
     pvc->trackStart = startMs;
     pvc->numTrackPts = num;
 
+    if (!pvc->tracking)
+        pvc->targetPos = pvc->trackPath[0];
+
     pvc->tracking = 1;
     pvc->targetSet = 1;
 
-    pvc->targetPos = pvc->trackPath[0];
-
     return 0;
 }
 
@@ -335,17 +352,17 @@ static int oTrackProgram(VCNodePtr pvc)
 {
     long now, span;
     double p1, p2, rat;
-    int i;
+    int i, j, k;
 
     //	TRACE "oTrackProgram\n");
 
     // Find where we're at in the list
     now = oGetTime(pvc);
-    now += 100; // add some time for interpolation
 
     span = now - pvc->trackStart;
-    i = span / pvc->trackIval;
-    if (i >= pvc->numTrackPts - 1)
+    if (span < 0)
+        span = 0; // hold at the first point until it starts
+    if (span >= pvc->trackTimes[pvc->numTrackPts - 1])
     {
         // we should have been refreshed by now...
         // we're pretty much screwed.  Drop out of tracking.
@@ -353,26 +370,38 @@ static int oTrackProgram(VCNodePtr pvc)
         pvc->tracking = 0;
         pvc->targetSet = 0;
         pvc->velocity = 0;
+        pvc->trackVel = 0;
         return -1;
     }
 
-    // we need two points to interpolate from
+    // we need two points to interpolate from, either side of span
+    for (i = 0, j = pvc->numTrackPts - 1; j - i > 1;)
+    {
+        k = (i + j) / 2;
+        if (pvc->trackTimes[k] <= span)
+            i = k;
+        else
+            j = k;
+    }
     p1 = pvc->trackPath[i];
     p2 = pvc->trackPath[i + 1];
 
     // how far past the ideal time for p1 are we?
 
-    span = now - pvc->trackIval * i;
+    span -= pvc->trackTimes[i];
 
     // and what ratio is that of our interval?
-    rat = (double)span / (double)pvc->trackIval;
+    rat = (double)span / (double)(pvc->trackTimes[i + 1] - pvc->trackTimes[i]);
+
+    // the path moves this fast here, steps per second
+    pvc->trackVel = (p2 - p1) * 1000 / (pvc->trackTimes[i + 1] - pvc->trackTimes[i]);
 
     // so what is the relative ratio of the difference in position?
     // add this to p1 to get where we should be now
     p1 += (p2 - p1) * rat;
 
     // okay -- let's move there.
-    pvc->targetPos = (long)(p1 + 0.5);
+    pvc->targetPos = (long)floor(p1 + 0.5);
     pvc->targetPos += pvc->toffset; // apply a jog offset if one in effect
     pvc->targetSet = 1;
 
@@ -398,7 +427,7 @@ static void oMotorGo(VCNodePtr pvc)
     else
         pvc->clamped = 0;
 
-    amt = (ival * pvc->velocity) / 1000;
+    amt = floor(ival * pvc->velocity / 1000 + 0.5);
 
     if (!amt && wantVel)
         return; // not enough time has elapsed to do anything
@@ -406,7 +435,7 @@ static void oMotorGo(VCNodePtr pvc)
     pvc->currentPos += amt * pvc->sign;
 
     // check the motion past switches and latch the bits
-    if (pvc->targetSet)
+    if (pvc->targetSet && !pvc->tracking)
     {
         // if we've gone past target, latch to target and stop
         if ((pvc->lastPos <= pvc->targetPos && pvc->currentPos >= pvc->targetPos) ||
@@ -444,6 +473,7 @@ static void oResetEdgeLatch(VCNodePtr pvc, char edgeBits)
 }
 
 // Move toward current target
+// when tracking, also move as fast as the path so we do not lag behind it
 static void oMoveToTarget(VCNodePtr pvc)
 {
     double amt = pvc->sign * (pvc->targetPos - pvc->currentPos);
@@ -455,6 +485,8 @@ static void oMoveToTarget(VCNodePtr pvc)
         else
             amt = pvc->countsPerRev + amt;
     }
+    if (pvc->tracking)
+        amt += pvc->sign * pvc->trackVel;
 
     absclamp(amt, pvc->maxVel);
     pvc->velocity = amt;
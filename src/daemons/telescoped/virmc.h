@@ -44,7 +44,8 @@ typedef struct
     double *trackPath;    // allocation for path points if tracking
     int numTrackPts;      // number of tracking points in path
     int trackStart;       // ms time this path starts at
-    int trackIval;        // ms interval between each track point
+    int *trackTimes;      // ms after trackStart of each track point
+    double trackVel;      // speed of the path where we are, steps per second
     int toffset;          // jogged offset from track path
 
     int targetSet; // 1 if we are actively pursuing a target
@@ -67,7 +68,7 @@ extern void vmcSetTimeout(int node, int timeout);
 extern void vmcSetTrackingOffset(int node, int offset);
 extern void vmcJog(int node, int amt);
 extern void vmcStop(int node);
-extern int vmcSetTrackPath(int node, int num, int startMs, int ivalMs, double *path);
+extern int vmcSetTrackPath(int node, int num, int startMs, int *timesMs, double *path);
 extern void vmcSetHome(int node);
 
 extern int vmc_r(int node, char *buf, int length);
@@ -0,0 +1,167 @@
+/* record telstatshm in the telemetry archive, see telrec.h.
+ * run on the master machine: rund telrecd
+ *
+ * we add a record each time telescoped announces a change, but no more
+ * often than minms, and every maxms regardless so idle times are covered.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "misc.h"
+#include "running.h"
+#include "strops.h"
+#include "telenv.h"
+#include "telstatshm.h"
+#include "telrec.h"
+
+#define DEFMINMS 100    /* default least ms between records */
+#define DEFMAXMS 10000  /* default most ms between records */
+#define REPSECS 3600    /* seconds between reports when verbose */
+
+static void usage(void);
+static void shmConnect(void);
+static void record(void);
+
+static TelStatShm *telstatshmp; /* shared mem status segment */
+static TelRec *trp;             /* the archive */
+static char *dir;               /* archive dir, if not default */
+static int minms = DEFMINMS;    /* least ms between records */
+static int maxms = DEFMAXMS;    /* most ms between records */
+static int vflag;               /* set if want verbose */
+static char *me;                /* our program name */
+
+int main(int ac, char *av[])
+{
+    me = basenm(av[0]);
+
+    while ((--ac > 0) && ((*++av)[0] == '-'))
+    {
+        char *s;
+        for (s = av[0] + 1; *s != '\0'; s++)
+            switch (*s)
+            {
+            case 'd':
+                if (ac < 2)
+                    usage();
+                dir = *++av;
+                ac--;
+                break;
+            case 'i':
+                if (ac < 2)
+                    usage();
+                minms = atoi(*++av);
+                ac--;
+                break;
+            case 'k':
+                if (ac < 2)
+                    usage();
+                maxms = atoi(*++av);
+                ac--;
+                break;
+            case 'v':
+                vflag++;
+                break;
+            default:
+                usage();
+            }
+    }
+
+    /* ac remaining args starting at av[0] */
+    if (ac || minms < 0 || maxms <= 0)
+        usage();
+
+    /* only ever one writer */
+    if (lock_running(me) < 0)
+    {
+        daemonLog("%s: Already running\n", me);
+        exit(0);
+    }
+
+    shmConnect();
+    if (!(trp = telrec_open(dir, 1)))
+    {
+        daemonLog("%s: %s\n", dir ? dir : TELREC_DIR, strerror(errno));
+        exit(1);
+    }
+    if (vflag)
+        daemonLog("Archive has %d segments\n", telrec_nsegs(trp));
+
+    record();
+
+    return (0);
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [options]\n", me);
+    fprintf(stderr, "Purpose: record Talon shared memory status in the telemetry archive\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, " -d dir:    archive directory; default is $TELHOME/%s\n", TELREC_DIR);
+    fprintf(stderr, " -i ms:     record changes no more often than <ms>; default is %d\n", DEFMINMS);
+    fprintf(stderr, " -k ms:     record at least every <ms>; default is %d\n", DEFMAXMS);
+    fprintf(stderr, " -v:        verbose\n");
+
+    exit(1);
+}
+
+/* connect to telstatshm, creating if necessary.
+ * exit if trouble.
+ */
+static void shmConnect()
+{
+    int old;
+
+    /* open/create, replacing one left by an older version */
+    telstatshmp = telshm_attach(1, &old);
+    if (!telstatshmp)
+    {
+        daemonLog("shm: %s\n", telshm_error());
+        exit(1);
+    }
+    if (old)
+        daemonLog("Replaced old shm of different size\n");
+}
+
+/* add a record whenever shm changes, forever */
+static void record()
+{
+    unsigned int gen = telstatshmp->gen;
+    time_t lastrep = time(NULL);
+    long nrec = 0;
+    TelStatShm t;
+
+    while (1)
+    {
+        (void)telshm_snapshot(telstatshmp, &t);
+        switch (telrec_append(trp, &t))
+        {
+        case -1:
+            daemonLog("append: %s\n", strerror(errno));
+            exit(1);
+        case 1:
+            nrec++;
+            break;
+        default:
+            break; /* time has not moved on, telescoped is not running */
+        }
+
+        if (vflag && time(NULL) - lastrep >= REPSECS)
+        {
+            daemonLog("%ld records, %d segments\n", nrec, telrec_nsegs(trp));
+            lastrep = time(NULL);
+        }
+
+        (void)telshm_wait(telstatshmp, &gen, minms, maxms);
+    }
+}
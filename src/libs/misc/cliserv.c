@@ -21,6 +21,7 @@
 #include "astro.h"
 #include "circum.h"
 #include "cliserv.h"
+#include "linebuf.h"
 #include "telenv.h"
 #include "telstatshm.h"
 
@@ -56,9 +57,6 @@ int serv_conn(char *name, int fd[2], char msg[])
     /* cooperate with teloper group */
     fchmod(fd[0], S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
 
-    /* used so serv_read() won't block forever */
-    catch_alarm();
-
     (void)sprintf(ws, "comm/%s.out", name);
     telfixpath(ws, ws);
     (void)unlink(ws);
@@ -144,6 +142,7 @@ void dis_conn(char *name, int fd[2])
 {
     char ws[1024];
 
+    lb_flush(fd[0]);
     (void)close(fd[0]);
     (void)close(fd[1]);
     (void)sprintf(ws, "comm/%s.in", name);
@@ -195,52 +194,40 @@ int cli_write(int fd[2], char *msg, char *err)
 /* used by a server to read from a client into buf[bufl].
  * all such received messages are assumed to end with \0 or \n.
  * (we pick the correct fd to use for you :-)
+ * input is buffered so several messages may arrive in one read; anyone who
+ * select()s fd[0] should also check lb_pending(fd[0]).
  * if ok, return 0 with message in buf.
  * else fill buf[] with excuse and return -1.
  */
 int serv_read(int fd[2], char *buf, int bufl)
 {
-    int found;
     int n;
-    int s;
 
-    /* max time to wait for rest of message */
-    alarm_wentoff = 0;
-    alarm(5);
-
-    /* read until get EOS, get bufl chars or alarm goes off */
-    for (found = n = 0; 1; n++)
+    /* wait at most 5 seconds for the rest of the message */
+    n = lb_gets(fd[0], buf, bufl, LB_NUL, 5000);
+    if (n == -2)
     {
-        if (n >= bufl)
-        {
-            sprintf(buf, "Buffer overflow");
-            break;
-        }
-        s = read(fd[0], &buf[n], 1);
-        if (s < 0)
-        {
-            if (alarm_wentoff)
-                sprintf(buf, "Message timeout");
-            else
-                sprintf(buf, "%s", strerror(errno));
-            break;
-        }
-        if (s == 0)
-        {
-            sprintf(buf, "Fifo disappeared");
-            break;
-        }
-        if (buf[n] == '\0' || buf[n] == '\n')
-        {
-            buf[n++] = '\0';
-            found = 1;
-            break;
-        }
+        sprintf(buf, "Message timeout");
+        return (-1);
+    }
+    if (n < 0)
+    {
+        sprintf(buf, "%s", strerror(errno));
+        return (-1);
+    }
+    if (n == 0)
+    {
+        sprintf(buf, "Fifo disappeared");
+        return (-1);
+    }
+    if (buf[n - 1] != '\0' && buf[n - 1] != '\n')
+    {
+        sprintf(buf, "Buffer overflow");
+        return (-1);
     }
 
-    alarm(0); /* done with alarm */
-
-    return (found ? 0 : -1);
+    buf[n - 1] = '\0';
+    return (0);
 }
 
 /* used by a client to read from a server into buf[bufl].
@@ -331,21 +318,15 @@ static void catch_alarm()
 
 /* connect to the telstatshm shared memory segment.
  * same function for cli and serv.
- * return 0 and set *tpp if ok, else -1.
+ * return 0 and set *tpp if ok, else -1, see telshm_error().
  */
 int open_telshm(TelStatShm **tpp)
 {
-    int shmid;
-    long addr;
-
-    shmid = shmget(TELSTATSHMKEY, sizeof(TelStatShm), 0);
-    if (shmid < 0)
-        return (-1);
+    TelStatShm *tp = telshm_attach(0, NULL);
 
-    addr = (long)shmat(shmid, (void *)0, 0);
-    if (addr == -1)
+    if (!tp)
         return (-1);
 
-    *tpp = (TelStatShm *)addr;
+    *tpp = tp;
     return (0);
 }
@@ -10,13 +10,16 @@
 
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "csimc.h"
+#include "linebuf.h"
 
 /*** low-level server connections, not for applications ***********************/
 
@@ -121,11 +124,17 @@ typedef struct
     int haddr;
     int naddr;
     OpenWhy why;
+    char *host;  /* host given to open, or NULL */
+    int port;    /* port given to open, or 0 */
+    int novar;   /* set once node is known to lack GETVAR/SETVAR */
+    int hasvar;  /* set once node has answered GETVAR/SETVAR */
+    int nosnap;  /* set once node is known to lack snap() */
+    int pri;     /* CSIPri asked for at open */
 } FDInfo;
 static FDInfo *fdinfo;
 static int nfdinfo;
 
-static void fdiAdd(int fd, int haddr, int naddr, int why)
+static void fdiAdd(int fd, int haddr, int naddr, int why, char *host, int port, int pri)
 {
     FDInfo *fp, *lfp;
 
@@ -152,6 +161,12 @@ static void fdiAdd(int fd, int haddr, int naddr, int why)
     fp->haddr = haddr;
     fp->naddr = naddr;
     fp->why = why;
+    fp->host = host ? strdup(host) : NULL;
+    fp->port = port;
+    fp->novar = 0;
+    fp->hasvar = 0;
+    fp->nosnap = 0;
+    fp->pri = pri;
 }
 
 static FDInfo *fdiFind(int fd)
@@ -176,7 +191,11 @@ static int common_close(int fd)
 
     if (fp)
     {
+        lb_flush(fp->fd);
         (void)close(fp->fd);
+        if (fp->host)
+            free(fp->host);
+        fp->host = NULL;
         fp->inuse = 0;
         return (0);
     }
@@ -211,7 +230,7 @@ static int common_open(char *host, int port, int addr, OpenWhy why, int client)
     }
 
     /* new */
-    fdiAdd(fd, preamble[0], addr, why);
+    fdiAdd(fd, preamble[0], addr, why, host, port, why == FOR_SHELL || why == FOR_VAR ? client : 0);
     return (fd);
 }
 
@@ -220,7 +239,15 @@ static int common_open(char *host, int port, int addr, OpenWhy why, int client)
  */
 int csi_open(char *host, int port, int addr)
 {
-    return (common_open(host, port, addr, FOR_SHELL, 0));
+    return (common_open(host, port, addr, FOR_SHELL, CSI_PRI_DEFAULT));
+}
+
+/* like csi_open() but ask csimcd to serve the connection with priority pri.
+ * return fd or -1.
+ */
+int csi_popen(char *host, int port, int addr, CSIPri pri)
+{
+    return (common_open(host, port, addr, FOR_SHELL, pri));
 }
 
 /* build a serial connection to csimcd for the given TCP/IP host and port.
@@ -268,6 +295,7 @@ int csi_intr(int fd)
         return (-1);
     if (write(fd, &a, 1) < 0)
         return (-1);
+    lb_flush(fd); /* whatever was pending is from before the interrupt */
     if (read(fd, &a, 1) < 0)
         return (-1);
     return (0);
@@ -310,24 +338,55 @@ int csi_w(int fd, char *fmt, ...)
     return (l);
 }
 
-/* wait for and read up through the next newline or buflen-1 chars, whichever
- * comes first, into buf[]. '\0' is added to the end. Returns count, 0 if EOF,
- * or -1 if error.
+/* send len bytes of buf[] to fd with as few writes as possible so csimcd finds
+ * them all queued at once and can pack them into full PMXDAT-sized packets.
+ * if sp, fill it with counters describing the transfer.
+ * return len if ok, else -1.
  */
-int csi_r(int fd, char buf[], int buflen)
+int csi_wblk(int fd, char buf[], int len, CSIBlkStats *sp)
 {
-    int s, n;
+    struct timespec t0, t1;
+    int nw, s, n;
 
-    for (n = 0; n < buflen - 1;)
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (nw = n = 0; n < len; n += s)
     {
-        if ((s = read(fd, &buf[n], 1)) <= 0)
-            return (s);
-        if (buf[n++] == '\n')
-            break;
+        s = write(fd, buf + n, len - n);
+        nw++;
+        if (s < 0)
+        {
+            if (errno == EINTR)
+            {
+                s = 0;
+                continue;
+            }
+            return (-1);
+        }
     }
 
-    buf[n] = '\0';
-    return (n);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (sp)
+    {
+        sp->nbytes = len;
+        sp->npkts = (len + PMXDAT - 1) / PMXDAT;
+        sp->nwrites = nw;
+        sp->ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    }
+
+    return (len);
+}
+
+/* wait for and read up through the next newline or buflen-1 chars, whichever
+ * comes first, into buf[]. '\0' is added to the end. Returns count, 0 if EOF,
+ * or -1 if error.
+ * N.B. input is buffered, so anyone who select()s fd should also check
+ *   lb_pending(fd).
+ */
+int csi_r(int fd, char buf[], int buflen)
+{
+    return (lb_gets(fd, buf, buflen, 0, -1));
 }
 
 /* like csi_w() followed by csi_r() all in one.
@@ -375,3 +434,406 @@ int csi_rix(int fd, char *fmt, ...)
 
     return (strtol(buf, NULL, 0));
 }
+
+/* read exactly n bytes from fd into buf.
+ * return n if ok, 0 if EOF, else -1.
+ */
+static int readn(int fd, Byte *buf, int n)
+{
+    int s, got;
+
+    for (got = 0; got < n; got += s)
+    {
+        s = read(fd, buf + got, n - got);
+        if (s <= 0)
+        {
+            if (s < 0 && errno == EINTR)
+            {
+                s = 0;
+                continue;
+            }
+            return (s);
+        }
+    }
+
+    return (n);
+}
+
+/* return the FOR_VAR connection to the same node as shell fd, opening it the
+ * first time. all shell connections to one node share the same one.
+ * return fd, else -1.
+ */
+static int varFD(int fd)
+{
+    FDInfo *fp = fdiFind(fd);
+    FDInfo *vp, *lvp;
+    char *host;
+    int naddr, port;
+
+    for (vp = fdinfo, lvp = vp + nfdinfo; vp < lvp; vp++)
+    {
+        if (vp->inuse && vp->why == FOR_VAR && vp->naddr == fp->naddr && vp->port == fp->port &&
+            (vp->host == fp->host || (vp->host && fp->host && !strcmp(vp->host, fp->host))))
+            return (vp->fd);
+    }
+
+    /* N.B. common_open() may move fdinfo[] */
+    host = fp->host ? strdup(fp->host) : NULL;
+    naddr = fp->naddr;
+    port = fp->port;
+    fd = common_open(host, port, naddr, FOR_VAR, fp->pri);
+    if (host)
+        free(host);
+    return (fd);
+}
+
+/* send one GETVAR or SETVAR request for the node on shell fd.
+ * return VAR_OK and value in *vp if GETVAR, VAR_NOSUP if the node or csimcd
+ * can not do it, else -1 if trouble.
+ */
+static int varXchg(int fd, PktType t, char *name, int v, int *vp)
+{
+    Byte buf[VARHDR + PMXDAT];
+    int vfd, l;
+
+    /* leave room for csimcd to escape the value */
+    l = strlen(name) + 1;
+    if (l + 2 * VARVSZ > PMXDAT)
+        return (-1);
+
+    /* an old csimcd closes connections it does not understand */
+    vfd = varFD(fd);
+    if (vfd < 0)
+        return (VAR_NOSUP);
+
+    buf[0] = t;
+    memcpy(buf + VARHDR, name, l);
+    if (t == PT_SETVAR)
+    {
+        buf[VARHDR + l++] = v >> 24;
+        buf[VARHDR + l++] = v >> 16;
+        buf[VARHDR + l++] = v >> 8;
+        buf[VARHDR + l++] = v;
+    }
+    buf[1] = l;
+
+    if (write(vfd, buf, VARHDR + l) < 0 || readn(vfd, buf, VARHDR) <= 0 ||
+        (buf[1] > 0 && (buf[1] > PMXDAT || readn(vfd, buf + VARHDR, buf[1]) <= 0)))
+    {
+        common_close(vfd);
+        return (-1);
+    }
+
+    if (buf[0] != VAR_OK)
+        return (buf[0] == VAR_NOSUP ? VAR_NOSUP : -1);
+
+    if (t == PT_GETVAR)
+    {
+        if (buf[1] != VARVSZ)
+            return (-1);
+        *vp = (int)((unsigned)buf[2] << 24 | buf[3] << 16 | buf[4] << 8 | buf[5]);
+    }
+
+    return (VAR_OK);
+}
+
+/* return 1 if the node on shell fd is known to answer GETVAR/SETVAR, -1 if
+ * it is known not to, else 0 until csi_getvar() or csi_setvar() has found out.
+ */
+int csi_hasvar(int fd)
+{
+    FDInfo *fp = fdiFind(fd);
+
+    if (!fp || fp->why != FOR_SHELL || fp->novar)
+        return (-1);
+    return (fp->hasvar ? 1 : 0);
+}
+
+/* read the value of the integer variable name from the node on shell fd.
+ * uses binary PT_GETVAR packets when the node supports them, else falls
+ * back to asking the shell to evaluate "=name;".
+ * return 0 if ok, else -1.
+ */
+int csi_getvar(int fd, char *name, int *vp)
+{
+    FDInfo *fp = fdiFind(fd);
+    char buf[64];
+
+    if (!fp || fp->why != FOR_SHELL)
+        return (-1);
+
+    if (!fp->novar)
+    {
+        switch (varXchg(fd, PT_GETVAR, name, 0, vp))
+        {
+        case VAR_OK:
+            fdiFind(fd)->hasvar = 1;
+            return (0);
+        case VAR_NOSUP:
+            fdiFind(fd)->novar = 1;
+            break;
+        default:
+            return (-1);
+        }
+    }
+
+    if (csi_wr(fd, buf, sizeof(buf), "=%s;", name) <= 0)
+        return (-1);
+    *vp = strtol(buf, NULL, 0);
+    return (0);
+}
+
+/* set the integer variable name to v on the node on shell fd.
+ * uses binary PT_SETVAR packets when the node supports them, in which case
+ * the node has acked by the time we return, else falls back to sending the
+ * shell "name=v;".
+ * return 0 if ok, else -1.
+ */
+int csi_setvar(int fd, char *name, int v)
+{
+    FDInfo *fp = fdiFind(fd);
+
+    if (!fp || fp->why != FOR_SHELL)
+        return (-1);
+
+    if (!fp->novar)
+    {
+        switch (varXchg(fd, PT_SETVAR, name, v, NULL))
+        {
+        case VAR_OK:
+            fdiFind(fd)->hasvar = 1;
+            return (0);
+        case VAR_NOSUP:
+            fdiFind(fd)->novar = 1;
+            break;
+        default:
+            return (-1);
+        }
+    }
+
+    return (csi_w(fd, "%s=%d;", name, v) < 0 ? -1 : 0);
+}
+
+/* fill *sp by reading each snap() value with csi_getvar().
+ * return 0 if ok, else -1.
+ */
+static int snapVars(int fd, CSISnap *sp)
+{
+    CSISnap s;
+
+    if (csi_getvar(fd, "clock", &s.clock) < 0 || csi_getvar(fd, "mpos", &s.mpos) < 0 ||
+        csi_getvar(fd, "epos", &s.epos) < 0 || csi_getvar(fd, "mvel", &s.mvel) < 0 ||
+        csi_getvar(fd, "iedge", &s.iedge) < 0 || csi_getvar(fd, "ilevel", &s.ilevel) < 0)
+        return (-1);
+
+    *sp = s;
+    return (0);
+}
+
+/* fill *sp with the motion values of the node on shell fd in one round trip
+ * using the snap() script function from basic.cmc. if the node has not
+ * loaded snap() fall back to reading each variable with csi_getvar().
+ * return 0 if ok, else -1.
+ */
+int csi_snap(int fd, CSISnap *sp)
+{
+    return (csi_snapv(&fd, sp, NULL, 1));
+}
+
+/* like csi_snap() for each of n shell fds but with all snap() queries in
+ * flight at once, so the time taken is that of the slowest node.
+ * sp[i] is only changed if its snapshot succeeds; if ok, ok[i] says which.
+ * return 0 if all ok, else -1.
+ */
+int csi_snapv(int fd[], CSISnap sp[], int ok[], int n)
+{
+    CSIReq rq[NNODES];
+    int rqi[NNODES];
+    int got[NNODES];
+    int i, nrq, nbad;
+
+    if (n > NNODES)
+        return (-1);
+
+    /* start a snap() on each node known to have it */
+    for (nrq = i = 0; i < n; i++)
+    {
+        FDInfo *fp = fdiFind(fd[i]);
+
+        got[i] = 0;
+        if (!fp || fp->why != FOR_SHELL || fp->nosnap)
+            continue;
+        if (csi_req(&rq[nrq], fd[i], "snap();") == 0)
+            rqi[nrq++] = i;
+    }
+
+    /* gather the replies */
+    (void)csi_collect(rq, nrq, -1);
+    for (i = 0; i < nrq; i++)
+    {
+        CSIReq *rp = &rq[i];
+        CSISnap s;
+
+        if (rp->done < 0)
+            continue;
+        if (sscanf(rp->buf, "%d %d %d %d %d %d", &s.clock, &s.mpos, &s.epos, &s.mvel, &s.iedge, &s.ilevel) == 6)
+        {
+            sp[rqi[i]] = s;
+            got[rqi[i]] = 1;
+            continue;
+        }
+        fprintf(stderr, "csi_snap(%d): unexpected '%.*s'.. reading each variable\n", rp->fd,
+                (int)strcspn(rp->buf, "\n"), rp->buf);
+        fdiFind(rp->fd)->nosnap = 1;
+    }
+
+    /* read the rest the slow way */
+    for (nbad = i = 0; i < n; i++)
+    {
+        FDInfo *fp;
+
+        if (!got[i])
+        {
+            fp = fdiFind(fd[i]);
+            if (fp && fp->nosnap && snapVars(fd[i], &sp[i]) == 0)
+                got[i] = 1;
+            else
+                nbad++;
+        }
+        if (ok)
+            ok[i] = got[i];
+    }
+
+    return (nbad ? -1 : 0);
+}
+
+/* send a query on shell fd whose one-line reply is to be gathered later by
+ * csi_collect(), so queries to several nodes may be in flight at once.
+ * return 0 if ok, else -1.
+ */
+int csi_req(CSIReq *rp, int fd, char *fmt, ...)
+{
+    va_list ap;
+    char buf[1024];
+    int l;
+
+    va_start(ap, fmt);
+    l = vsprintf(buf, fmt, ap);
+    va_end(ap);
+
+    rp->fd = fd;
+    rp->len = 0;
+    rp->buf[0] = '\0';
+    if (write(fd, buf, l) < 0)
+    {
+        rp->done = -1;
+        return (-1);
+    }
+
+    rp->done = 0;
+    return (0);
+}
+
+/* gather the reply line to each of nrq queries from csi_req() using one poll
+ * for all, waiting up to ms for the slowest, or forever if ms < 0.
+ * bytes beyond each reply line are left buffered for later csi_r() calls.
+ * return 0 if all replies are complete, else -1.
+ */
+int csi_collect(CSIReq rq[], int nrq, int ms)
+{
+    struct pollfd pfd[NNODES];
+    int pix[NNODES];
+    struct timespec t0, t1;
+    int i, n, np, wait;
+
+    if (nrq > NNODES)
+        return (-1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (1)
+    {
+        /* take any replies already complete, poll each still waiting */
+        for (np = i = 0; i < nrq; i++)
+        {
+            CSIReq *rp = &rq[i];
+
+            if (rp->done)
+                continue;
+            rp->len = lb_take(rp->fd, rp->buf, sizeof(rp->buf), 0);
+            if (rp->len > 0)
+            {
+                rp->done = 1;
+                continue;
+            }
+            pfd[np].fd = rp->fd;
+            pfd[np].events = POLLIN;
+            pix[np++] = i;
+        }
+        if (np == 0)
+            break;
+
+        wait = ms;
+        if (ms >= 0)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            wait = ms - ((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000);
+            if (wait < 0)
+                wait = 0;
+        }
+
+        n = poll(pfd, np, wait);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; /* error or out of time */
+
+        /* buffer what has arrived, lines are taken next time around */
+        for (i = 0; i < np; i++)
+            if (pfd[i].revents && lb_fill(pfd[i].fd) <= 0)
+                rq[pix[i]].done = -1;
+    }
+
+    /* any left are failures */
+    for (n = i = 0; i < nrq; i++)
+    {
+        if (!rq[i].done)
+            rq[i].done = -1;
+        if (rq[i].done < 0)
+            n++;
+    }
+
+    return (n ? -1 : 0);
+}
+
+/* poll all nfd fds at once, waiting up to ms for any to become readable, or
+ * forever if ms < 0. set ready[i] to 1 if fd[i] can be read, else 0.
+ * return number ready, else -1.
+ */
+int csi_ready(int fd[], int ready[], int nfd, int ms)
+{
+    struct pollfd pfd[NNODES];
+    int i, n;
+
+    if (nfd > NNODES)
+        return (-1);
+
+    for (i = 0; i < nfd; i++)
+    {
+        pfd[i].fd = fd[i];
+        pfd[i].events = POLLIN;
+        if (lb_pending(fd[i]))
+            ms = 0; /* already have something to read */
+    }
+
+    while ((n = poll(pfd, nfd, ms)) < 0 && errno == EINTR)
+        continue;
+    if (n < 0)
+        return (-1);
+
+    for (n = i = 0; i < nfd; i++)
+        if ((ready[i] = pfd[i].revents != 0 || lb_pending(fd[i]) > 0))
+            n++;
+
+    return (n);
+}
@@ -90,9 +90,40 @@ typedef enum
     FOR_SHELL,
     FOR_BOOT,
     FOR_REBOOT,
-    FOR_SERIAL
+    FOR_SERIAL,
+    FOR_VAR
 } OpenWhy;
 
+/* the order in which csimcd serves its clients when it has the token.
+ * FOR_SHELL and FOR_VAR connections may ask for one in the 3rd preamble
+ * byte, else they get CSI_PRI_SHELL. all others get CSI_PRI_BULK.
+ */
+typedef enum
+{
+    CSI_PRI_DEFAULT,
+    CSI_PRI_CTRL,  /* control loop queries, always served first */
+    CSI_PRI_SHELL, /* interactive sessions */
+    CSI_PRI_BULK,  /* boot images, serial passthrough */
+    CSI_NPRI
+} CSIPri;
+
+/* a FOR_VAR connection exchanges binary frames instead of shell text.
+ * request: PT_GETVAR or PT_SETVAR, count, then count bytes of variable name
+ *   including its '\0', followed by a 4-byte big-endian value for PT_SETVAR.
+ * reply: one of VarStatus, count, then count bytes, which for PT_GETVAR is
+ *   the value as a 4-byte big-endian int.
+ * on the network csimcd escapes values with PESC; names are plain text.
+ */
+#define VARHDR 2 /* bytes in request and reply header */
+#define VARVSZ 4 /* bytes in an encoded value */
+
+typedef enum
+{
+    VAR_OK,    /* request was acked by the node */
+    VAR_NOSUP, /* node firmware does not support GETVAR/SETVAR */
+    VAR_ERR    /* malformed request */
+} VarStatus;
+
 /* header for a boot image record */
 typedef struct
 {
@@ -113,17 +144,58 @@ extern int csimcd_slisten(int port);
 extern int csimcd_saccept(int fd);
 extern int csimcd_clconn(char *host, int port);
 
+/* counters describing one csi_wblk() upload */
+typedef struct
+{
+    int nbytes;  /* bytes handed to csimcd */
+    int npkts;   /* PMXDAT-sized packets they occupy on the network */
+    int nwrites; /* write(2) calls it took */
+    double ms;   /* wall time spent writing, ms */
+} CSIBlkStats;
+
+/* one consistent set of motion values from a node, as reported by snap() */
+typedef struct
+{
+    int clock;  /* node clock, ms */
+    int mpos;   /* motor position, steps */
+    int epos;   /* encoder position, steps */
+    int mvel;   /* motor velocity, steps/sec */
+    int iedge;  /* latched input edges */
+    int ilevel; /* input levels */
+} CSISnap;
+
+/* one query issued with csi_req() whose reply line is gathered by
+ * csi_collect(). a connection may have only one in flight at a time.
+ */
+typedef struct
+{
+    int fd;        /* shell fd the query was sent on */
+    int done;      /* 0 while waiting, 1 when buf holds reply, -1 if failed */
+    int len;       /* bytes in buf so far */
+    char buf[128]; /* reply through its '\n', then '\0' */
+} CSIReq;
+
 /* host client API */
 extern int csi_open(char *host, int port, int addr);
+extern int csi_popen(char *host, int port, int addr, CSIPri pri);
 extern int csi_bopen(char *host, int port, int addr);
 extern int csi_sopen(char *host, int port, int addr, int baud);
 extern int csi_close(int fd);
 extern int csi_intr(int fd);
 extern int csi_rebootAll(char *host, int port);
 extern int csi_w(int fd, char *fmt, ...);
+extern int csi_wblk(int fd, char buf[], int len, CSIBlkStats *sp);
 extern int csi_r(int fd, char buf[], int buflen);
 extern int csi_rix(int fd, char *fmt, ...);
 extern int csi_wr(int fd, char buf[], int buflen, char *fmt, ...);
+extern int csi_hasvar(int fd);
+extern int csi_getvar(int fd, char *name, int *vp);
+extern int csi_setvar(int fd, char *name, int v);
+extern int csi_snap(int fd, CSISnap *sp);
+extern int csi_snapv(int fd[], CSISnap sp[], int ok[], int n);
+extern int csi_req(CSIReq *rp, int fd, char *fmt, ...);
+extern int csi_collect(CSIReq rq[], int nrq, int ms);
+extern int csi_ready(int fd[], int ready[], int nfd, int ms);
 extern int csi_f2h(int fd);
 extern int csi_f2n(int fd);
 
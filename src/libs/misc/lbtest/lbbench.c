@@ -0,0 +1,128 @@
+/* compare reading lines a byte at a time with the buffered line reader */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "linebuf.h"
+
+/* linebuf.o is compiled with read() renamed to this */
+ssize_t counted_read(int fd, void *buf, size_t n);
+
+static long nreads;
+
+static void writer(int fd, int nlines, int perwrite);
+static double now(void);
+
+int main(int ac, char *av[])
+{
+    int nlines = ac > 1 ? atoi(av[1]) : 100000;
+    int perwrite = ac > 2 ? atoi(av[2]) : 4;
+    int method;
+
+    if (nlines <= 0 || perwrite <= 0)
+    {
+        fprintf(stderr, "Usage: %s [nlines [lines_per_write]]\n", av[0]);
+        exit(1);
+    }
+
+    printf("%d lines, %d per write\n", nlines, perwrite);
+    printf("%-10s %10s %10s %12s\n", "method", "lines", "reads", "us/line");
+
+    for (method = 0; method < 2; method++)
+    {
+        char buf[128];
+        int sv[2];
+        double t0, t1;
+        int pid, n, got;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        {
+            perror("socketpair");
+            exit(1);
+        }
+
+        pid = fork();
+        if (pid < 0)
+        {
+            perror("fork");
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            close(sv[0]);
+            writer(sv[1], nlines, perwrite);
+            _exit(0);
+        }
+        close(sv[1]);
+
+        nreads = 0;
+        t0 = now();
+        for (got = 0; got < nlines; got++)
+        {
+            if (method == 0)
+            {
+                /* the old csi_r() */
+                for (n = 0; n < sizeof(buf) - 1;)
+                {
+                    if (counted_read(sv[0], &buf[n], 1) <= 0)
+                        break;
+                    if (buf[n++] == '\n')
+                        break;
+                }
+                buf[n] = '\0';
+            }
+            else
+                n = lb_gets(sv[0], buf, sizeof(buf), 0, -1);
+            if (n <= 0)
+                break;
+        }
+        t1 = now();
+
+        printf("%-10s %10d %10ld %12.3f\n", method == 0 ? "bytewise" : "lb_gets", got, nreads,
+               got ? (t1 - t0) * 1e6 / got : 0.0);
+
+        lb_flush(sv[0]);
+        close(sv[0]);
+        waitpid(pid, NULL, 0);
+    }
+
+    return (0);
+}
+
+ssize_t counted_read(int fd, void *buf, size_t n)
+{
+    nreads++;
+    return (read(fd, buf, n));
+}
+
+/* write nlines of typical snap() replies to fd, perwrite lines per write() */
+static void writer(int fd, int nlines, int perwrite)
+{
+    char buf[4096];
+    int i, l;
+
+    for (l = i = 0; i < nlines; i++)
+    {
+        l += sprintf(buf + l, "%d %d %d %d %d %d\n", 123456 + i, -4567890 + i, 2345678 - i, 1500, 0, 3);
+        if ((i + 1) % perwrite == 0 || i == nlines - 1 || l > sizeof(buf) - 100)
+        {
+            if (write(fd, buf, l) != l)
+                break;
+            l = 0;
+        }
+    }
+}
+
+/* return monotonic time in seconds */
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
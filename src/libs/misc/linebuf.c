@@ -0,0 +1,199 @@
+/* buffered reading of newline-framed messages.
+ *
+ * each fd gets its own buffer which is filled with as much as one read()
+ * returns, then messages are handed out of it one at a time. this replaces
+ * reading one byte per syscall. since bytes may now wait here after the
+ * kernel says the fd is empty, anyone who select()s or poll()s such an fd
+ * must also check lb_pending(), and anyone who discards input must also call
+ * lb_flush().
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "linebuf.h"
+
+#define LBSIZE 4096 /* bytes buffered per fd */
+
+typedef struct
+{
+    int off;            /* index of first unused byte in data[] */
+    int len;            /* index after last unused byte in data[] */
+    char data[LBSIZE];  /* bytes read but not yet handed out */
+} LineBuf;
+
+static LineBuf **lbs; /* malloced per fd, grown as needed */
+static int nlbs;
+
+static LineBuf *lbFind(int fd, int create);
+static int msLeft(struct timespec *t0, int ms);
+
+/* copy the next message for fd into buf, reading as needed and waiting up to
+ * a total of ms, or forever if ms < 0. a message ends with '\n', or '\0' too
+ * if flags includes LB_NUL, and is copied including its terminator. at most
+ * buflen-1 chars are copied and a '\0' is always added.
+ * return count, 0 if EOF, -2 if time ran out, else -1 with errno set.
+ */
+int lb_gets(int fd, char buf[], int buflen, int flags, int ms)
+{
+    struct timespec t0;
+    struct pollfd pfd;
+    int n;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while ((n = lb_take(fd, buf, buflen, flags)) == 0)
+    {
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        n = poll(&pfd, 1, msLeft(&t0, ms));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (-1);
+        }
+        if (n == 0)
+            return (-2);
+
+        n = lb_fill(fd);
+        if (n <= 0)
+            return (n);
+    }
+
+    return (n);
+}
+
+/* copy the next message for fd into buf as in lb_gets() but only if it is
+ * already complete in the buffer; never does any I/O.
+ * return count, else 0 if no complete message is buffered.
+ */
+int lb_take(int fd, char buf[], int buflen, int flags)
+{
+    LineBuf *lbp = lbFind(fd, 0);
+    char *bp, *ep, *end;
+    int n;
+
+    if (!lbp || lbp->off == lbp->len || buflen < 2)
+        return (0);
+
+    bp = &lbp->data[lbp->off];
+    n = lbp->len - lbp->off;
+    if (n > buflen - 1)
+        n = buflen - 1;
+
+    end = memchr(bp, '\n', n);
+    if (flags & LB_NUL)
+    {
+        ep = memchr(bp, '\0', end ? end - bp : n);
+        if (ep)
+            end = ep;
+    }
+
+    if (end)
+        n = end - bp + 1;
+    else if (n < buflen - 1)
+        return (0); /* incomplete and still fits */
+
+    memcpy(buf, bp, n);
+    buf[n] = '\0';
+    lbp->off += n;
+    if (lbp->off == lbp->len)
+        lbp->off = lbp->len = 0;
+
+    return (n);
+}
+
+/* read whatever is available from fd, which is assumed to be readable now,
+ * into its buffer with one read().
+ * return count added, 0 if EOF, else -1 with errno set.
+ */
+int lb_fill(int fd)
+{
+    LineBuf *lbp = lbFind(fd, 1);
+    int n;
+
+    if (!lbp)
+    {
+        errno = ENOMEM;
+        return (-1);
+    }
+
+    /* make room at the end */
+    if (lbp->off > 0)
+    {
+        memmove(lbp->data, &lbp->data[lbp->off], lbp->len - lbp->off);
+        lbp->len -= lbp->off;
+        lbp->off = 0;
+    }
+    if (lbp->len == LBSIZE)
+        return (LBSIZE); /* full of partial message, let lb_take() have it */
+
+    while ((n = read(fd, &lbp->data[lbp->len], LBSIZE - lbp->len)) < 0 && errno == EINTR)
+        continue;
+    if (n > 0)
+        lbp->len += n;
+
+    return (n);
+}
+
+/* return count of bytes buffered for fd but not yet handed out */
+int lb_pending(int fd)
+{
+    LineBuf *lbp = lbFind(fd, 0);
+
+    return (lbp ? lbp->len - lbp->off : 0);
+}
+
+/* discard anything buffered for fd */
+void lb_flush(int fd)
+{
+    LineBuf *lbp = lbFind(fd, 0);
+
+    if (lbp)
+        lbp->off = lbp->len = 0;
+}
+
+/* return the buffer for fd, optionally creating it, else NULL */
+static LineBuf *lbFind(int fd, int create)
+{
+    if (fd < 0)
+        return (NULL);
+
+    if (fd >= nlbs)
+    {
+        LineBuf **newlbs;
+
+        if (!create)
+            return (NULL);
+        newlbs = (LineBuf **)realloc(lbs, (fd + 1) * sizeof(LineBuf *));
+        if (!newlbs)
+            return (NULL);
+        lbs = newlbs;
+        memset(&lbs[nlbs], 0, (fd + 1 - nlbs) * sizeof(LineBuf *));
+        nlbs = fd + 1;
+    }
+
+    if (!lbs[fd] && create)
+        lbs[fd] = (LineBuf *)calloc(1, sizeof(LineBuf));
+
+    return (lbs[fd]);
+}
+
+/* return ms remaining of ms since t0, or -1 if ms < 0 to mean forever */
+static int msLeft(struct timespec *t0, int ms)
+{
+    struct timespec t1;
+    int used;
+
+    if (ms < 0)
+        return (-1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    used = (t1.tv_sec - t0->tv_sec) * 1000 + (t1.tv_nsec - t0->tv_nsec) / 1000000;
+    return (used < ms ? ms - used : 0);
+}
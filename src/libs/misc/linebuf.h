@@ -0,0 +1,14 @@
+/* buffered reading of newline-framed messages, one buffer per fd */
+
+#ifndef LINEBUF_H
+#define LINEBUF_H
+
+#define LB_NUL 0x1 /* '\0' also ends a message */
+
+extern int lb_gets(int fd, char buf[], int buflen, int flags, int ms);
+extern int lb_take(int fd, char buf[], int buflen, int flags);
+extern int lb_fill(int fd);
+extern int lb_pending(int fd);
+extern void lb_flush(int fd);
+
+#endif // LINEBUF_H
@@ -0,0 +1,439 @@
+/* the telemetry archive, see telrec.h.
+ *
+ * one process appends with telrec_append() while any number of others read
+ * the same files. the writer fills in each record and any index entry
+ * before publishing it by advancing nrecs, so readers which load nrecs
+ * first never see a record being written.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "telenv.h"
+#include "telstatshm.h"
+#include "telrec.h"
+
+#define SEGSIZE (TR_HDRSIZE + (size_t)TR_NRECS * sizeof(TelRecRec))
+#define RECP(hp, i) ((TelRecRec *)((char *)(hp) + TR_HDRSIZE) + (i))
+
+/* one segment file */
+typedef struct
+{
+    char *name;    /* file name within dir */
+    TelRecHdr *hp; /* mapped file */
+    size_t len;    /* bytes mapped */
+} Seg;
+
+struct _TelRec
+{
+    char dir[1024]; /* archive directory */
+    int writing;    /* set if we append */
+    Seg *segs;      /* segments in time order */
+    int nsegs;      /* number of segs[] */
+};
+
+static int loadSegs(TelRec *trp);
+static int mapSeg(TelRec *trp, Seg *sp, int rw);
+static int newSeg(TelRec *trp, double n_mjd);
+static int cmpNames(const void *p1, const void *p2);
+static unsigned int nrecs(Seg *sp);
+static int locate(TelRec *trp, double n_mjd, int *segp, long *recp);
+
+/* open the archive in dir, or TELREC_DIR if NULL, for reading or, if
+ * writing, for appending too. a writer creates dir if need be.
+ * return handle, else NULL with errno set.
+ */
+TelRec *telrec_open(char *dir, int writing)
+{
+    TelRec *trp = (TelRec *)calloc(1, sizeof(TelRec));
+
+    if (!trp)
+        return (NULL);
+    if (!dir)
+        telfixpath(trp->dir, TELREC_DIR);
+    else
+        strncpy(trp->dir, dir, sizeof(trp->dir) - 1);
+    trp->writing = writing;
+
+    if (writing && mkdir(trp->dir, 0775) < 0 && errno != EEXIST)
+    {
+        free(trp);
+        return (NULL);
+    }
+    if (loadSegs(trp) < 0)
+    {
+        int e = errno;
+        telrec_close(trp);
+        errno = e;
+        return (NULL);
+    }
+
+    return (trp);
+}
+
+/* finished with trp */
+void telrec_close(TelRec *trp)
+{
+    int i;
+
+    for (i = 0; i < trp->nsegs; i++)
+    {
+        if (trp->segs[i].hp)
+            munmap(trp->segs[i].hp, trp->segs[i].len);
+        free(trp->segs[i].name);
+    }
+    free(trp->segs);
+    free(trp);
+}
+
+/* return number of segments in the archive */
+int telrec_nsegs(TelRec *trp)
+{
+    return (trp->nsegs);
+}
+
+/* append *tp to the archive, unless it is no later than the last record.
+ * start a new segment when the current one is full.
+ * return 1 if added, 0 if not later, -1 if trouble with errno set.
+ */
+int telrec_append(TelRec *trp, TelStatShm *tp)
+{
+    double n_mjd = tp->now.n_mjd;
+    TelRecHdr *hp;
+    TelRecRec *rp;
+    unsigned int n;
+
+    if (!trp->writing)
+    {
+        errno = EPERM;
+        return (-1);
+    }
+
+    /* last record */
+    if (trp->nsegs > 0)
+    {
+        Seg *sp = &trp->segs[trp->nsegs - 1];
+        n = nrecs(sp);
+        if (n > 0 && n_mjd <= RECP(sp->hp, n - 1)->n_mjd)
+            return (0);
+        if (n >= TR_NRECS && newSeg(trp, n_mjd) < 0)
+            return (-1);
+    }
+    else if (newSeg(trp, n_mjd) < 0)
+        return (-1);
+
+    hp = trp->segs[trp->nsegs - 1].hp;
+    n = hp->nrecs;
+    rp = RECP(hp, n);
+    rp->n_mjd = n_mjd;
+    telwire_encode(tp, rp->wire);
+    if (n % TR_IDXSTEP == 0)
+        hp->idx[n / TR_IDXSTEP] = n_mjd;
+    __atomic_store_n(&hp->nrecs, n + 1, __ATOMIC_RELEASE);
+
+    return (1);
+}
+
+/* find the latest record at or before n_mjd and decode it into *tp.
+ * if mjdp, also return its time there.
+ * return 0 if found, -1 if n_mjd is before the first record.
+ */
+int telrec_find(TelRec *trp, double n_mjd, TelStatShm *tp, double *mjdp)
+{
+    TelRecRec *rp;
+    long r;
+    int s;
+
+    if (locate(trp, n_mjd, &s, &r) < 0)
+        return (-1);
+
+    rp = RECP(trp->segs[s].hp, r);
+    memset(tp, 0, sizeof(*tp));
+    telwire_decode(rp->wire, tp);
+    if (mjdp)
+        *mjdp = rp->n_mjd;
+    return (0);
+}
+
+/* call fn with each record from t0 through t1, in order, until it returns
+ * non-0.
+ * return number of records passed to fn.
+ */
+long telrec_range(TelRec *trp, double t0, double t1, TelRecFunc fn, void *arg)
+{
+    TelStatShm t;
+    long count = 0;
+    long r;
+    int s;
+
+    /* start at the first record at or after t0 */
+    if (locate(trp, t0, &s, &r) < 0)
+    {
+        s = 0;
+        r = 0;
+    }
+    else if (RECP(trp->segs[s].hp, r)->n_mjd < t0)
+        r++;
+
+    for (; s < trp->nsegs; s++, r = 0)
+    {
+        Seg *sp = &trp->segs[s];
+        long n = nrecs(sp);
+
+        for (; r < n; r++)
+        {
+            TelRecRec *rp = RECP(sp->hp, r);
+
+            if (rp->n_mjd > t1)
+                return (count);
+            memset(&t, 0, sizeof(t));
+            telwire_decode(rp->wire, &t);
+            count++;
+            if ((*fn)(rp->n_mjd, &t, arg))
+                return (count);
+        }
+    }
+
+    return (count);
+}
+
+/* find the latest record at or before n_mjd.
+ * return 0 with its segment and record index, or -1 if none.
+ */
+static int locate(TelRec *trp, double n_mjd, int *segp, long *recp)
+{
+    TelRecHdr *hp;
+    long lo, hi, mid, n, nidx;
+    int s;
+
+    /* last segment starting at or before n_mjd */
+    lo = 0;
+    hi = trp->nsegs - 1;
+    s = -1;
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        if (nrecs(&trp->segs[mid]) > 0 && trp->segs[mid].hp->idx[0] <= n_mjd)
+        {
+            s = mid;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+    if (s < 0)
+        return (-1);
+    hp = trp->segs[s].hp;
+    n = nrecs(&trp->segs[s]);
+
+    /* last index entry at or before n_mjd */
+    nidx = (n - 1) / TR_IDXSTEP + 1;
+    lo = 0;
+    hi = nidx - 1;
+    while (lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        if (hp->idx[mid] <= n_mjd)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    /* last record at or before n_mjd within that step */
+    hi = (lo + 1) * TR_IDXSTEP - 1;
+    if (hi > n - 1)
+        hi = n - 1;
+    lo = lo * TR_IDXSTEP;
+    while (lo < hi)
+    {
+        mid = (lo + hi + 1) / 2;
+        if (RECP(hp, mid)->n_mjd <= n_mjd)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    *segp = s;
+    *recp = lo;
+    return (0);
+}
+
+/* records published in sp */
+static unsigned int nrecs(Seg *sp)
+{
+    unsigned int n = __atomic_load_n(&sp->hp->nrecs, __ATOMIC_ACQUIRE);
+    return (n > TR_NRECS ? TR_NRECS : n);
+}
+
+/* find and map each segment in trp->dir.
+ * return 0 if ok, else -1.
+ */
+static int loadSegs(TelRec *trp)
+{
+    DIR *dp = opendir(trp->dir);
+    struct dirent *dep;
+    int i;
+
+    if (!dp)
+        return (-1);
+    while ((dep = readdir(dp)) != NULL)
+    {
+        int l = strlen(dep->d_name);
+        int sl = strlen(TELREC_SUFFIX);
+        Seg *newsegs;
+
+        if (l <= sl || strcmp(dep->d_name + l - sl, TELREC_SUFFIX))
+            continue;
+        newsegs = (Seg *)realloc(trp->segs, (trp->nsegs + 1) * sizeof(Seg));
+        if (!newsegs)
+        {
+            closedir(dp);
+            return (-1);
+        }
+        trp->segs = newsegs;
+        memset(&trp->segs[trp->nsegs], 0, sizeof(Seg));
+        if (!(trp->segs[trp->nsegs].name = strdup(dep->d_name)))
+        {
+            closedir(dp);
+            return (-1);
+        }
+        trp->nsegs++;
+    }
+    closedir(dp);
+
+    /* names are the MJD of the first record, all the same width */
+    qsort(trp->segs, trp->nsegs, sizeof(Seg), cmpNames);
+
+    /* a writer only changes the last */
+    for (i = 0; i < trp->nsegs; i++)
+    {
+        int s = mapSeg(trp, &trp->segs[i], trp->writing && i == trp->nsegs - 1);
+        if (s < 0)
+            return (-1);
+        if (s > 0)
+        {
+            /* still being made, as good as not there yet */
+            free(trp->segs[i].name);
+            memmove(&trp->segs[i], &trp->segs[i + 1], (trp->nsegs - i - 1) * sizeof(Seg));
+            trp->nsegs--;
+            i--;
+        }
+    }
+
+    return (0);
+}
+
+/* map segment sp, read/write if rw.
+ * return 0 if ok, 1 if it is still being created, else -1.
+ */
+static int mapSeg(TelRec *trp, Seg *sp, int rw)
+{
+    int prot = rw ? PROT_READ | PROT_WRITE : PROT_READ;
+    char path[2048];
+    struct stat st;
+    void *addr;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", trp->dir, sp->name);
+    if ((fd = open(path, rw ? O_RDWR : O_RDONLY)) < 0)
+        return (-1);
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return (-1);
+    }
+    if (st.st_size != SEGSIZE)
+    {
+        close(fd);
+        errno = EPROTO;
+        return (-1);
+    }
+    addr = mmap(NULL, SEGSIZE, prot, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return (-1);
+
+    sp->hp = (TelRecHdr *)addr;
+    sp->len = SEGSIZE;
+    if (__atomic_load_n(&sp->hp->magic, __ATOMIC_ACQUIRE) == 0)
+    {
+        munmap(addr, SEGSIZE);
+        sp->hp = NULL;
+        return (1);
+    }
+    if (sp->hp->magic != TELREC_MAGIC || sp->hp->version != TELREC_VERSION ||
+        sp->hp->wireversion != TELWIRE_VERSION || sp->hp->recsize != sizeof(TelRecRec))
+    {
+        errno = EPROTO;
+        return (-1);
+    }
+
+    return (0);
+}
+
+/* add a new empty segment for records starting at n_mjd.
+ * return 0 if ok, else -1.
+ */
+static int newSeg(TelRec *trp, double n_mjd)
+{
+    char name[64], path[2048];
+    TelRecHdr *hp;
+    Seg *newsegs;
+    Seg *sp;
+    void *addr;
+    int fd;
+
+    snprintf(name, sizeof(name), "%011.5f%s", n_mjd, TELREC_SUFFIX);
+    snprintf(path, sizeof(path), "%s/%s", trp->dir, name);
+    if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0664)) < 0)
+        return (-1);
+    if (ftruncate(fd, SEGSIZE) < 0)
+    {
+        close(fd);
+        unlink(path);
+        return (-1);
+    }
+    addr = mmap(NULL, SEGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        unlink(path);
+        return (-1);
+    }
+
+    /* header, last so readers never find a half-made one */
+    hp = (TelRecHdr *)addr;
+    hp->version = TELREC_VERSION;
+    hp->wireversion = TELWIRE_VERSION;
+    hp->recsize = sizeof(TelRecRec);
+    hp->nrecs = 0;
+    __atomic_store_n(&hp->magic, TELREC_MAGIC, __ATOMIC_RELEASE);
+
+    newsegs = (Seg *)realloc(trp->segs, (trp->nsegs + 1) * sizeof(Seg));
+    if (!newsegs)
+        return (-1);
+    trp->segs = newsegs;
+    sp = &trp->segs[trp->nsegs];
+    sp->name = strdup(name);
+    sp->hp = hp;
+    sp->len = SEGSIZE;
+    trp->nsegs++;
+
+    return (0);
+}
+
+static int cmpNames(const void *p1, const void *p2)
+{
+    return (strcmp(((Seg *)p1)->name, ((Seg *)p2)->name));
+}
@@ -0,0 +1,61 @@
+/* include file for the telemetry archive written by telrecd.
+ *
+ * the archive is a directory of segment files, each a TelRecHdr followed
+ * by up to TR_NRECS fixed-size TelRecRec in increasing MJD order. files are
+ * named for the MJD of their first record so sorting the names sorts the
+ * segments. each header also keeps the MJD of every TR_IDXSTEP'th record,
+ * so finding any time takes one search of the segment names, one of that
+ * sparse index and one within TR_IDXSTEP records, all straight from mmap.
+ *
+ * the state in each record is in the portable telwire.h encoding; the
+ * header and MJDs are in the byte order of the writer.
+ */
+
+#ifndef TELREC_H
+#define TELREC_H
+
+#include "telwire.h"
+
+#define TELREC_MAGIC 0x54524543 /* "TREC" */
+#define TELREC_VERSION 1
+#define TELREC_DIR "archive/telrec" /* default archive, from TELHOME */
+#define TELREC_SUFFIX ".trec"       /* segment file name suffix */
+
+#define TR_IDXSTEP 256                   /* records per sparse index entry */
+#define TR_IDXN 256                      /* sparse index entries per segment */
+#define TR_NRECS (TR_IDXSTEP * TR_IDXN) /* records per segment */
+#define TR_HDRSIZE 4096                  /* bytes reserved for TelRecHdr */
+
+/* start of each segment file */
+typedef struct
+{
+    unsigned int magic;       /* TELREC_MAGIC, also shows byte order */
+    unsigned int version;     /* TELREC_VERSION */
+    unsigned int wireversion; /* TELWIRE_VERSION of the records */
+    unsigned int recsize;     /* sizeof(TelRecRec) */
+    unsigned int nrecs;       /* records written so far */
+    unsigned int pad;         /* unused */
+    double idx[TR_IDXN];      /* MJD of record i*TR_IDXSTEP */
+} TelRecHdr;
+
+/* one archived state */
+typedef struct
+{
+    double n_mjd;                   /* now.n_mjd when recorded */
+    unsigned char wire[TELWIRE_LEN]; /* TelStatShm, see telwire.h */
+} TelRecRec;
+
+typedef struct _TelRec TelRec; /* private handle */
+
+/* called by telrec_range() with each record; return 0 to keep going */
+typedef int (*TelRecFunc)(double n_mjd, TelStatShm *tp, void *arg);
+
+/* telrec.c */
+extern TelRec *telrec_open(char *dir, int writing);
+extern void telrec_close(TelRec *trp);
+extern int telrec_append(TelRec *trp, TelStatShm *tp);
+extern int telrec_find(TelRec *trp, double n_mjd, TelStatShm *tp, double *mjdp);
+extern long telrec_range(TelRec *trp, double t0, double t1, TelRecFunc fn, void *arg);
+extern int telrec_nsegs(TelRec *trp);
+
+#endif // TELREC_H
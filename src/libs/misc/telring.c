@@ -0,0 +1,125 @@
+/* the per-cycle telemetry ring in shared memory.
+ * one writer, which creates the segment, and any number of readers.
+ * each slot carries a sequence number the writer makes odd while changing
+ * the slot, so a reader can tell if what it copied was torn or overwritten.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "telring.h"
+
+/* connect to the ring segment.
+ * if create, make a fresh empty one, replacing any of a different layout,
+ *   else just attach to an existing one of our version.
+ * return pointer if ok, else NULL with errno set.
+ */
+TelRing *telring_open(int create)
+{
+    TelRing *trp;
+    int shmid;
+
+    shmid = shmget(TELRINGKEY, sizeof(TelRing), create ? 0664 | IPC_CREAT : 0);
+    if (shmid < 0 && create && errno == EINVAL)
+    {
+        /* exists but is too small, from an older version */
+        shmid = shmget(TELRINGKEY, 0, 0);
+        if (shmid >= 0)
+            (void)shmctl(shmid, IPC_RMID, NULL);
+        shmid = shmget(TELRINGKEY, sizeof(TelRing), 0664 | IPC_CREAT);
+    }
+    if (shmid < 0)
+        return (NULL);
+
+    trp = (TelRing *)shmat(shmid, NULL, create ? 0 : SHM_RDONLY);
+    if (trp == (TelRing *)-1)
+        return (NULL);
+
+    if (create)
+    {
+        memset(trp, 0, sizeof(TelRing));
+        trp->size = sizeof(TelRing);
+        trp->nslots = TR_NSLOTS;
+        trp->recsize = sizeof(TelRingRec);
+        __atomic_store_n(&trp->version, TELRING_VERSION, __ATOMIC_RELEASE);
+    }
+    else if (__atomic_load_n(&trp->version, __ATOMIC_ACQUIRE) != TELRING_VERSION || trp->size != sizeof(TelRing))
+    {
+        (void)shmdt(trp);
+        errno = EPROTO;
+        return (NULL);
+    }
+
+    return (trp);
+}
+
+/* add a copy of *rp as the next record.
+ * N.B. only the creator may call this.
+ */
+void telring_push(TelRing *trp, TelRingRec *rp)
+{
+    uint64_t n;
+    TelRingSlot *sp;
+
+    if (!trp)
+        return;
+
+    n = trp->head;
+    sp = &trp->slot[n & (TR_NSLOTS - 1)];
+
+    /* mark busy, fill, mark done as record n, then publish */
+    __atomic_store_n(&sp->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    sp->rec = *rp;
+    __atomic_store_n(&sp->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&trp->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/* copy record number *cursor into *rp and advance *cursor.
+ * return 1 if did, 0 if it is not written yet, or -1 if it has already
+ *   been overwritten, in which case *cursor is moved to the oldest record
+ *   still available and nothing is copied.
+ */
+int telring_read(TelRing *trp, uint64_t *cursor, TelRingRec *rp)
+{
+    uint64_t n = *cursor;
+    uint64_t head, s1, s2;
+    TelRingSlot *sp;
+
+    while (1)
+    {
+        head = __atomic_load_n(&trp->head, __ATOMIC_ACQUIRE);
+        if (n >= head)
+            return (0);
+        if (head - n > TR_NSLOTS - 1)
+            break; /* lapped, or about to be */
+
+        sp = &trp->slot[n & (TR_NSLOTS - 1)];
+        s1 = __atomic_load_n(&sp->seq, __ATOMIC_ACQUIRE);
+        if (s1 != 2 * n + 2)
+            break; /* already being reused */
+        *rp = sp->rec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&sp->seq, __ATOMIC_RELAXED);
+        if (s2 == s1)
+        {
+            *cursor = n + 1;
+            return (1);
+        }
+    }
+
+    /* skip to the oldest the writer can not be reusing now */
+    head = __atomic_load_n(&trp->head, __ATOMIC_ACQUIRE);
+    *cursor = head > TR_NSLOTS - 1 ? head - (TR_NSLOTS - 1) : 0;
+    return (-1);
+}
+
+/* return the number of the next record to be written, ie, a cursor from
+ * which telring_read() returns only new records.
+ */
+uint64_t telring_head(TelRing *trp)
+{
+    return (__atomic_load_n(&trp->head, __ATOMIC_ACQUIRE));
+}
@@ -0,0 +1,67 @@
+/* include file to access the per-cycle telemetry ring in shared memory.
+ * telescoped adds one record each control cycle; any number of readers may
+ * follow along without locks or syscalls, each with its own cursor.
+ */
+
+#ifndef TELRING_H
+#define TELRING_H
+
+#include <stdint.h>
+
+#include "telstatshm.h"
+
+/* shared memory key, next to TELSTATSKEY */
+#define TELRINGKEY 0x4e56361c
+
+/* bump whenever the layout below changes */
+#define TELRING_VERSION 1
+
+#define TR_NSLOTS 16384 /* records kept, must be a power of 2 */
+
+/* state of one motor in one cycle */
+typedef struct
+{
+    int32_t raw; /* raw count from home (encoder else motor) */
+    int32_t pad;
+    double cpos; /* current position, rads from home */
+    double dpos; /* desired position, rads from home */
+    double cvel; /* commanded velocity, rads/sec */
+} TelRingMot;
+
+/* one control cycle */
+typedef struct
+{
+    double n_mjd;              /* telstatshmp->now.n_mjd */
+    double mdha, mddec;        /* mesh corrections, rads */
+    int32_t telstate;          /* TelState */
+    int32_t telstateidx;       /* changes with each telstate change */
+    TelRingMot mot[TEL_NM];    /* each motor, index with MotorId */
+} TelRingRec;
+
+/* one slot in the ring.
+ * seq is 2*(n+1) once record number n is complete here, odd while the
+ * writer is changing it.
+ */
+typedef struct
+{
+    uint64_t seq;
+    TelRingRec rec;
+} TelRingSlot;
+
+/* the whole segment */
+typedef struct
+{
+    uint32_t version; /* TELRING_VERSION */
+    uint32_t size;    /* sizeof(TelRing) */
+    uint32_t nslots;  /* TR_NSLOTS */
+    uint32_t recsize; /* sizeof(TelRingRec) */
+    uint64_t head;    /* number of records ever added */
+    TelRingSlot slot[TR_NSLOTS];
+} TelRing;
+
+extern TelRing *telring_open(int create);
+extern void telring_push(TelRing *trp, TelRingRec *rp);
+extern int telring_read(TelRing *trp, uint64_t *cursor, TelRingRec *rp);
+extern uint64_t telring_head(TelRing *trp);
+
+#endif // TELRING_H
@@ -0,0 +1,256 @@
+/* consistent access to the TelStatShm segment.
+ * the one writer brackets each group of related changes with
+ * telshm_wbegin() and telshm_wend(), which make tp->seq odd in between.
+ * readers use telshm_snapshot() to get a copy taken while seq stayed the
+ * same even value, so it never mixes fields from two different updates.
+ *
+ * the writer also calls telshm_notify() once each cycle. if anything a
+ * reader would care about has changed it bumps tp->gen and wakes any
+ * readers blocked on it in telshm_wait(). gen is a futex so this works
+ * across processes with no other connection.
+ *
+ * everyone attaches with telshm_attach(). TelStatShm has grown, so a
+ * segment left by an older version is too small: those who may create the
+ * segment replace it, the rest can only say telescoped must be restarted.
+ */
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "telstatshm.h"
+
+#define SNAPSPINS 100 /* tries before yielding the cpu to the writer */
+#define SNAPMS 50     /* give up waiting for the writer after this long */
+
+static int wdepth; /* nesting of wbegin/wend in the writer */
+
+/* the fields whose change telshm_notify() announces.
+ * time, and cooked places which follow from time and these, are not. nor
+ * are desired places, which also move with time when idle; a new target
+ * changes telstateidx.
+ */
+typedef struct
+{
+    MotorInfo minfo[TEL_NM];
+    TelState telstate;
+    int telstateidx;
+    int jogging_ison;
+    double jdha, jddec;
+} Watched;
+
+static double monoms(void);
+static void getWatched(TelStatShm *tp, Watched *wp);
+
+/* attach the TelStatShm segment. if create, make it if there is none and
+ * replace one left by an older version with a different size, setting
+ * *oldp if so when oldp is not NULL.
+ * return it, else NULL with errno set, see telshm_error().
+ */
+TelStatShm *telshm_attach(int create, int *oldp)
+{
+    int len = sizeof(TelStatShm);
+    int shmid;
+    void *addr;
+
+    if (oldp)
+        *oldp = 0;
+
+    shmid = shmget(TELSTATSHMKEY, len, create ? 0664 : 0);
+    if (shmid < 0 && create)
+    {
+        if (errno == EINVAL)
+        {
+            /* left by an older version with a smaller TelStatShm */
+            if (oldp)
+                *oldp = 1;
+            shmid = shmget(TELSTATSHMKEY, 0, 0);
+            if (shmid >= 0)
+                (void)shmctl(shmid, IPC_RMID, NULL);
+            errno = ENOENT;
+        }
+        if (errno == ENOENT)
+            shmid = shmget(TELSTATSHMKEY, len, 0664 | IPC_CREAT);
+    }
+    if (shmid < 0)
+        return (NULL);
+
+    addr = shmat(shmid, NULL, 0);
+    if (addr == (void *)-1)
+        return (NULL);
+    return ((TelStatShm *)addr);
+}
+
+/* return why telshm_attach() just failed */
+char *telshm_error()
+{
+    if (errno == EINVAL)
+        return ("segment is from an older version, restart telescoped");
+    return (strerror(errno));
+}
+
+/* begin changing fields in tp.
+ * pairs may nest, only the outermost pair affects seq.
+ */
+void telshm_wbegin(TelStatShm *tp)
+{
+    if (wdepth++ > 0)
+        return;
+    __atomic_store_n(&tp->seq, tp->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/* done changing fields in tp */
+void telshm_wend(TelStatShm *tp)
+{
+    if (wdepth == 0 || --wdepth > 0)
+        return;
+    __atomic_store_n(&tp->seq, tp->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* copy tp to *copy such that no group of changes is only partly included.
+ * never blocks the writer; we just try again if it changed anything.
+ * return 0 if ok, else -1 if the writer seems stuck in which case *copy
+ *   is still as good as we could get.
+ */
+int telshm_snapshot(TelStatShm *tp, TelStatShm *copy)
+{
+    double t0 = 0;
+    unsigned int s1, s2;
+    int n;
+
+    for (n = 0; 1; n++)
+    {
+        s1 = __atomic_load_n(&tp->seq, __ATOMIC_ACQUIRE);
+        if (!(s1 & 1))
+        {
+            memcpy(copy, tp, sizeof(TelStatShm));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            s2 = __atomic_load_n(&tp->seq, __ATOMIC_RELAXED);
+            if (s1 == s2)
+                return (0);
+        }
+
+        /* writer is busy, let it run but don't wait forever */
+        if (n >= SNAPSPINS)
+        {
+            if (n == SNAPSPINS)
+                t0 = monoms();
+            else if (monoms() - t0 > SNAPMS)
+                break;
+            sched_yield();
+        }
+    }
+
+    memcpy(copy, tp, sizeof(TelStatShm));
+    return (-1);
+}
+
+/* replace all of tp with *from as one change, keeping tp's own seq.
+ * this is for mirroring a whole segment from elsewhere.
+ * N.B. relies on gen, waiters and seq being the last fields.
+ */
+void telshm_publish(TelStatShm *tp, TelStatShm *from)
+{
+    telshm_wbegin(tp);
+    memcpy(tp, from, offsetof(TelStatShm, gen));
+    telshm_wend(tp);
+    telshm_notify(tp);
+}
+
+/* called by the writer after each cycle of changes to tp.
+ * if anything watched has changed since last time, bump gen and wake
+ * everyone waiting in telshm_wait().
+ */
+void telshm_notify(TelStatShm *tp)
+{
+    static Watched last;
+    Watched now;
+
+    getWatched(tp, &now);
+    if (memcmp(&now, &last, sizeof(now)) == 0)
+        return;
+    last = now;
+
+    __atomic_add_fetch(&tp->gen, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tp->waiters, __ATOMIC_SEQ_CST) > 0)
+        (void)syscall(SYS_futex, &tp->gen, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
+}
+
+/* wait until tp->gen differs from *genp, then set *genp to it.
+ * if minms > 0, return no sooner than that after we were called so changes
+ *   in quick succession are reported together.
+ * if maxms >= 0, give up after that long.
+ * typical use is to read gen, take a snapshot, then loop waiting on that
+ *   gen and taking a new snapshot each time it changes.
+ * return 1 if changed, 0 if gave up.
+ */
+int telshm_wait(TelStatShm *tp, unsigned int *genp, int minms, int maxms)
+{
+    double t0 = monoms();
+    struct timespec ts, *tsp;
+    unsigned int g;
+    double left;
+
+    while ((g = __atomic_load_n(&tp->gen, __ATOMIC_SEQ_CST)) == *genp)
+    {
+        tsp = NULL;
+        if (maxms >= 0)
+        {
+            left = maxms - (monoms() - t0);
+            if (left <= 0)
+                return (0);
+            ts.tv_sec = (time_t)(left / 1000);
+            ts.tv_nsec = (long)((left - ts.tv_sec * 1000.) * 1e6);
+            tsp = &ts;
+        }
+
+        /* the kernel checks gen again before sleeping so no wake is lost */
+        __atomic_add_fetch(&tp->waiters, 1, __ATOMIC_SEQ_CST);
+        (void)syscall(SYS_futex, &tp->gen, FUTEX_WAIT, g, tsp, NULL, 0);
+        __atomic_sub_fetch(&tp->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+
+    if (minms > 0 && (left = minms - (monoms() - t0)) > 0)
+    {
+        ts.tv_sec = (time_t)(left / 1000);
+        ts.tv_nsec = (long)((left - ts.tv_sec * 1000.) * 1e6);
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+            continue;
+        g = __atomic_load_n(&tp->gen, __ATOMIC_SEQ_CST);
+    }
+
+    *genp = g;
+    return (1);
+}
+
+/* collect the watched fields of tp into *wp */
+static void getWatched(TelStatShm *tp, Watched *wp)
+{
+    memset(wp, 0, sizeof(*wp));
+    memcpy(wp->minfo, tp->minfo, sizeof(wp->minfo));
+    wp->telstate = tp->telstate;
+    wp->telstateidx = tp->telstateidx;
+    wp->jogging_ison = tp->jogging_ison;
+    wp->jdha = tp->jdha;
+    wp->jddec = tp->jddec;
+}
+
+/* return monotonic time in ms */
+static double monoms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e3 + ts.tv_nsec / 1e6);
+}
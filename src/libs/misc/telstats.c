@@ -0,0 +1,163 @@
+/* control loop timing statistics kept in shared memory.
+ * the daemon being timed creates the segment and adds samples, anyone may
+ * attach to read them.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telstats.h"
+
+/* connect to the stats segment.
+ * if create, make a fresh one initialized for us, replacing any of a
+ *   different layout, else just attach to an existing one of our version.
+ * return pointer if ok, else NULL with errno set.
+ */
+TelStats *telstats_open(int create)
+{
+    TelStats *tsp;
+    int shmid;
+
+    shmid = shmget(TELSTATSKEY, sizeof(TelStats), create ? 0664 | IPC_CREAT : 0);
+    if (shmid < 0 && create && errno == EINVAL)
+    {
+        /* exists but is too small, from an older version */
+        shmid = shmget(TELSTATSKEY, 0, 0);
+        if (shmid >= 0)
+            (void)shmctl(shmid, IPC_RMID, NULL);
+        shmid = shmget(TELSTATSKEY, sizeof(TelStats), 0664 | IPC_CREAT);
+    }
+    if (shmid < 0)
+        return (NULL);
+
+    tsp = (TelStats *)shmat(shmid, NULL, 0);
+    if (tsp == (TelStats *)-1)
+        return (NULL);
+
+    if (create)
+    {
+        memset(tsp, 0, sizeof(TelStats));
+        tsp->size = sizeof(TelStats);
+        tsp->nstages = TS_NSTAGES;
+        tsp->nbins = TS_NBINS;
+        tsp->pid = getpid();
+        tsp->start = time(NULL);
+        tsp->version = TELSTATS_VERSION;
+    }
+    else if (tsp->version != TELSTATS_VERSION || tsp->size != sizeof(TelStats))
+    {
+        (void)shmdt(tsp);
+        errno = EPROTO;
+        return (NULL);
+    }
+
+    return (tsp);
+}
+
+/* name stage id */
+void telstats_name(TelStats *tsp, int id, char *name)
+{
+    if (!tsp || id < 0 || id >= TS_NSTAGES)
+        return;
+    strncpy(tsp->stage[id].name, name, TS_NAMELEN - 1);
+    tsp->stage[id].name[TS_NAMELEN - 1] = '\0';
+}
+
+/* add a sample of ns to stage id.
+ * ok to call with tsp NULL if stats are not available.
+ */
+void telstats_add(TelStats *tsp, int id, uint64_t ns)
+{
+    TelStatsStage *sp;
+
+    if (!tsp || id < 0 || id >= TS_NSTAGES)
+        return;
+    sp = &tsp->stage[id];
+
+    sp->bin[telstats_bin(ns)]++;
+    sp->sum += ns;
+    sp->last = ns;
+    if (sp->n == 0 || ns < sp->min)
+        sp->min = ns;
+    if (ns > sp->max)
+        sp->max = ns;
+    sp->n++;
+}
+
+/* restart all counters, keeping the stage names */
+void telstats_zero(TelStats *tsp)
+{
+    int i;
+
+    for (i = 0; i < TS_NSTAGES; i++)
+    {
+        TelStatsStage *sp = &tsp->stage[i];
+
+        sp->n = sp->sum = sp->min = sp->max = sp->last = 0;
+        memset(sp->bin, 0, sizeof(sp->bin));
+    }
+    tsp->start = time(NULL);
+}
+
+/* return the value below which pct percent of samples in sp fall, ns.
+ * this is the top of the bin containing that sample, but never more than max.
+ */
+uint64_t telstats_pct(TelStatsStage *sp, double pct)
+{
+    uint64_t want, n;
+    int i;
+
+    if (sp->n == 0)
+        return (0);
+
+    want = (uint64_t)(pct / 100.0 * sp->n + 0.5);
+    if (want < 1)
+        want = 1;
+    for (n = i = 0; i < TS_NBINS - 1; i++)
+    {
+        n += sp->bin[i];
+        if (n >= want)
+            break;
+    }
+
+    n = telstats_binlow(i + 1) - 1;
+    return (n < sp->max ? n : sp->max);
+}
+
+/* return the bin for a sample of ns */
+int telstats_bin(uint64_t ns)
+{
+    int e, b;
+
+    if (ns < TS_SUB)
+        return ((int)ns);
+
+    /* e = index of the highest set bit, bins below it refine the power */
+    e = 63 - __builtin_clzll(ns);
+    b = (e - TS_SUBBITS + 1) * TS_SUB + (int)((ns >> (e - TS_SUBBITS)) & (TS_SUB - 1));
+    return (b < TS_NBINS ? b : TS_NBINS - 1);
+}
+
+/* return the smallest sample that goes in bin, ns */
+uint64_t telstats_binlow(int bin)
+{
+    int g = bin / TS_SUB;
+    int m = bin % TS_SUB;
+
+    if (g == 0)
+        return (m);
+    return ((uint64_t)(TS_SUB + m) << (g - 1));
+}
+
+/* return a monotonic time stamp for timing, ns */
+uint64_t telstats_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
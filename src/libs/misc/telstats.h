@@ -0,0 +1,64 @@
+/* include file to access the control loop timing statistics shared memory.
+ * this is a sibling of TelStatShm so its layout may change without
+ * disturbing readers of that; check version before using anything else.
+ */
+
+#ifndef TELSTATS_H
+#define TELSTATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* shared memory key, next to TELSTATSHMKEY */
+#define TELSTATSKEY 0x4e56361b
+
+/* bump whenever the layout below changes */
+#define TELSTATS_VERSION 1
+
+/* samples are ns, binned log-linear: TS_SUB bins per power of 2 so each is
+ * within 1/TS_SUB of its value; values of 2^TS_MAXBITS ns or more all land
+ * in the last bin.
+ */
+#define TS_SUBBITS 4
+#define TS_SUB (1 << TS_SUBBITS)
+#define TS_MAXBITS 40
+#define TS_NBINS ((TS_MAXBITS - TS_SUBBITS + 1) * TS_SUB)
+
+#define TS_NSTAGES 16 /* max stages */
+#define TS_NAMELEN 16 /* max stage name, including EOS */
+
+/* timing of one stage */
+typedef struct
+{
+    char name[TS_NAMELEN];   /* stage name, "" if unused */
+    uint64_t n;              /* number of samples */
+    uint64_t sum;            /* sum of all samples, ns */
+    uint64_t min, max, last; /* smallest, largest and latest sample, ns */
+    uint64_t bin[TS_NBINS];  /* count of samples in each bin */
+} TelStatsStage;
+
+/* the whole segment.
+ * written only by its creator without locks, so readers may see a sample
+ * partly counted. this is harmless for statistics.
+ */
+typedef struct
+{
+    uint32_t version;  /* TELSTATS_VERSION */
+    uint32_t size;     /* sizeof(TelStats) */
+    uint32_t nstages;  /* TS_NSTAGES */
+    uint32_t nbins;    /* TS_NBINS */
+    pid_t pid;         /* process writing the stats */
+    int64_t start;     /* unix time when stats began */
+    TelStatsStage stage[TS_NSTAGES];
+} TelStats;
+
+extern TelStats *telstats_open(int create);
+extern void telstats_name(TelStats *tsp, int id, char *name);
+extern void telstats_add(TelStats *tsp, int id, uint64_t ns);
+extern void telstats_zero(TelStats *tsp);
+extern uint64_t telstats_pct(TelStatsStage *sp, double pct);
+extern int telstats_bin(uint64_t ns);
+extern uint64_t telstats_binlow(int bin);
+extern uint64_t telstats_now(void);
+
+#endif // TELSTATS_H
@@ -107,6 +107,7 @@ typedef enum
 /* current state of everything.
  * H refers to the telescope axis of "longitude", be it HA or Az.
  * D refers to the telescope axis of "latitude", be it Dec or Alt.
+ * N.B. telwire.h lists every field of this and the structs within it.
  */
 typedef struct
 {
@@ -148,6 +149,11 @@ typedef struct
      * SuperWASP specific state is below
      */
 
+    /* N.B. keep these last, see telshm.c */
+    unsigned int gen;     /* bumped when telstate, targets or positions change */
+    unsigned int waiters; /* number of readers blocked in telshm_wait() */
+    unsigned int seq;     /* odd while a group of fields is being changed */
+
 } TelStatShm;
 
 /* handy shortcuts that check things for being ready for normal observing */
@@ -167,6 +173,16 @@ typedef struct
 #define RMOT (&telstatshmp->minfo[TEL_RM])
 #define OMOT (&telstatshmp->minfo[TEL_OM])
 
+/* telshm.c */
+extern TelStatShm *telshm_attach(int create, int *oldp);
+extern char *telshm_error(void);
+extern void telshm_wbegin(TelStatShm *tp);
+extern void telshm_wend(TelStatShm *tp);
+extern int telshm_snapshot(TelStatShm *tp, TelStatShm *copy);
+extern void telshm_publish(TelStatShm *tp, TelStatShm *from);
+extern void telshm_notify(TelStatShm *tp);
+extern int telshm_wait(TelStatShm *tp, unsigned int *genp, int minms, int maxms);
+
 /* telaxes.c */
 extern void tel_hadec2xy(double H, double D, TelAxes *tap, double *X, double *Y);
 extern void tel_xy2hadec(double X, double Y, TelAxes *tap, double *H, double *D);
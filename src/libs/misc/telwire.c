@@ -0,0 +1,227 @@
+/* portable encoding of TelStatShm, see telwire.h.
+ *
+ * telwire_layout() summarises how this build lays out TelStatShm in memory:
+ * where every field in the tables lands, down to the bit for bitfields,
+ * and the byte order and format of ints and doubles. two builds which
+ * agree on it may exchange raw TelStatShm bytes instead.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "telstatshm.h"
+#include "telwire.h"
+
+static unsigned char *put32(unsigned char *bp, unsigned int v);
+static unsigned char *put64(unsigned char *bp, double d);
+static unsigned int get32(unsigned char *bp);
+static double get64(unsigned char *bp);
+static unsigned char *encNow(unsigned char *bp, Now *sp);
+static unsigned char *encAxes(unsigned char *bp, TelAxes *sp);
+static unsigned char *encMotor(unsigned char *bp, MotorInfo *sp);
+static unsigned char *decNow(unsigned char *bp, Now *sp);
+static unsigned char *decAxes(unsigned char *bp, TelAxes *sp);
+static unsigned char *decMotor(unsigned char *bp, MotorInfo *sp);
+static unsigned int hash(unsigned int h, void *p, int n);
+static unsigned int hashInt(unsigned int h, int v);
+
+/* encode one field of *sp at bp, advancing bp */
+#define ENC_I32(name) bp = put32(bp, (unsigned int)sp->name);
+#define ENC_F64(name) bp = put64(bp, sp->name);
+#define ENC_CHR(name) *bp++ = sp->name;
+#define ENC_BIT(name) *bp++ = sp->name != 0;
+#define ENC_STR8(name) memcpy(bp, sp->name, TW_STR8_SZ), bp += TW_STR8_SZ;
+#define ENC_NOW(name) bp = encNow(bp, &sp->name);
+#define ENC_AXES(name) bp = encAxes(bp, &sp->name);
+#define ENC_MOTORS(name)                                                                                               \
+    for (i = 0; i < TEL_NM; i++)                                                                                       \
+        bp = encMotor(bp, &sp->name[i]);
+#define ENC(type, name) ENC_##type(name)
+
+/* decode one field of *sp from bp, advancing bp */
+#define DEC_I32(name) sp->name = (int)get32(bp), bp += TW_I32_SZ;
+#define DEC_F64(name) sp->name = get64(bp), bp += TW_F64_SZ;
+#define DEC_CHR(name) sp->name = *bp++;
+#define DEC_BIT(name) sp->name = *bp++ != 0;
+#define DEC_STR8(name) memcpy(sp->name, bp, TW_STR8_SZ), bp += TW_STR8_SZ;
+#define DEC_NOW(name) bp = decNow(bp, &sp->name);
+#define DEC_AXES(name) bp = decAxes(bp, &sp->name);
+#define DEC_MOTORS(name)                                                                                               \
+    for (i = 0; i < TEL_NM; i++)                                                                                       \
+        bp = decMotor(bp, &sp->name[i]);
+#define DEC(type, name) DEC_##type(name)
+
+/* fold where one field of a T lives into h. for bitfields we find out by
+ * setting one and seeing which bits change.
+ */
+#define LAY_FIELD(T, name) h = hashInt(hashInt(h, offsetof(T, name)), sizeof(((T *)0)->name));
+#define LAY_I32(T, name) LAY_FIELD(T, name)
+#define LAY_F64(T, name) LAY_FIELD(T, name)
+#define LAY_CHR(T, name) LAY_FIELD(T, name)
+#define LAY_STR8(T, name) LAY_FIELD(T, name)
+#define LAY_NOW(T, name) LAY_FIELD(T, name)
+#define LAY_AXES(T, name) LAY_FIELD(T, name)
+#define LAY_MOTORS(T, name) LAY_FIELD(T, name)
+#define LAY_BIT(T, name)                                                                                               \
+    {                                                                                                                  \
+        T s;                                                                                                           \
+        memset(&s, 0, sizeof(s));                                                                                      \
+        s.name = one;                                                                                                  \
+        for (i = 0; i < (int)sizeof(s); i++)                                                                           \
+            if (((unsigned char *)&s)[i])                                                                              \
+                h = hashInt(hash(h, (unsigned char *)&s + i, 1), i);                                                   \
+    }
+#define LAY_TOP(type, name) LAY_##type(TelStatShm, name)
+#define LAY_NOWF(type, name) LAY_##type(Now, name)
+#define LAY_AXESF(type, name) LAY_##type(TelAxes, name)
+#define LAY_MOTORF(type, name) LAY_##type(MotorInfo, name)
+
+/* STR8 fields must be just that long */
+typedef char TW_check_str8[sizeof(((Now *)0)->n_tznm) == TW_STR8_SZ ? 1 : -1];
+
+/* put *tp into buf[TELWIRE_LEN] */
+void telwire_encode(TelStatShm *tp, unsigned char *buf)
+{
+    TelStatShm *sp = tp;
+    unsigned char *bp = buf;
+    int i;
+
+    TW_TOP(ENC)
+}
+
+/* fill in *tp from buf[TELWIRE_LEN].
+ * N.B. gen, waiters and seq are not touched.
+ */
+void telwire_decode(unsigned char *buf, TelStatShm *tp)
+{
+    TelStatShm *sp = tp;
+    unsigned char *bp = buf;
+    int i;
+
+    TW_TOP(DEC)
+}
+
+/* return a summary of how this build lays out TelStatShm in memory */
+unsigned int telwire_layout()
+{
+    static unsigned int layout;
+    volatile int one = 1;
+    unsigned int h;
+    double d = 1.5;
+    int n = 0x01020304;
+    int i;
+
+    if (layout)
+        return (layout);
+
+    h = 2166136261u;
+    h = hashInt(h, TELWIRE_VERSION);
+    h = hashInt(h, TEL_NM);
+    h = hash(h, &n, sizeof(n));
+    h = hash(h, &d, sizeof(d));
+    h = hashInt(h, sizeof(TelStatShm));
+    h = hashInt(h, offsetof(TelStatShm, gen));
+    TW_TOP(LAY_TOP)
+    h = hashInt(h, sizeof(Now));
+    TW_NOW(LAY_NOWF)
+    h = hashInt(h, sizeof(TelAxes));
+    TW_AXES(LAY_AXESF)
+    h = hashInt(h, sizeof(MotorInfo));
+    TW_MOTOR(LAY_MOTORF)
+
+    layout = h ? h : 1;
+    return (layout);
+}
+
+static unsigned char *put32(unsigned char *bp, unsigned int v)
+{
+    bp[0] = v;
+    bp[1] = v >> 8;
+    bp[2] = v >> 16;
+    bp[3] = v >> 24;
+    return (bp + 4);
+}
+
+static unsigned char *put64(unsigned char *bp, double d)
+{
+    unsigned long long v;
+
+    memcpy(&v, &d, sizeof(v));
+    put32(bp, (unsigned int)v);
+    put32(bp + 4, (unsigned int)(v >> 32));
+    return (bp + 8);
+}
+
+static unsigned int get32(unsigned char *bp)
+{
+    return (bp[0] | bp[1] << 8 | bp[2] << 16 | (unsigned int)bp[3] << 24);
+}
+
+static double get64(unsigned char *bp)
+{
+    unsigned long long v = get32(bp) | (unsigned long long)get32(bp + 4) << 32;
+    double d;
+
+    memcpy(&d, &v, sizeof(d));
+    return (d);
+}
+
+static unsigned char *encNow(unsigned char *bp, Now *sp)
+{
+    TW_NOW(ENC)
+    return (bp);
+}
+
+static unsigned char *encAxes(unsigned char *bp, TelAxes *sp)
+{
+    TW_AXES(ENC)
+    return (bp);
+}
+
+static unsigned char *encMotor(unsigned char *bp, MotorInfo *sp)
+{
+    TW_MOTOR(ENC)
+    return (bp);
+}
+
+static unsigned char *decNow(unsigned char *bp, Now *sp)
+{
+    TW_NOW(DEC)
+    return (bp);
+}
+
+static unsigned char *decAxes(unsigned char *bp, TelAxes *sp)
+{
+    TW_AXES(DEC)
+    return (bp);
+}
+
+static unsigned char *decMotor(unsigned char *bp, MotorInfo *sp)
+{
+    TW_MOTOR(DEC)
+    return (bp);
+}
+
+/* FNV-1a */
+static unsigned int hash(unsigned int h, void *p, int n)
+{
+    unsigned char *cp = (unsigned char *)p;
+
+    while (n-- > 0)
+    {
+        h ^= *cp++;
+        h *= 16777619u;
+    }
+    return (h);
+}
+
+static unsigned int hashInt(unsigned int h, int v)
+{
+    unsigned char b[4];
+
+    put32(b, (unsigned int)v);
+    return (hash(h, b, sizeof(b)));
+}
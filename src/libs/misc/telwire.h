@@ -0,0 +1,127 @@
+/* portable encoding of TelStatShm, for sending it between machines.
+ *
+ * the tables below list every field of TelStatShm and the structs within
+ * it, in order, with how each is sent. the encoding is these fields in
+ * this order, each a fixed number of little-endian bytes, so the whole is
+ * always TELWIRE_LEN long and any two encodings may be compared byte for
+ * byte. doubles are sent as their IEEE 754 bits.
+ *
+ * N.B. change these whenever TelStatShm changes, and bump TELWIRE_VERSION
+ *   whenever the encoding changes. gen, waiters and seq are not sent.
+ */
+
+#ifndef TELWIRE_H
+#define TELWIRE_H
+
+#define TELWIRE_VERSION 1
+
+/* how each kind of field is sent, and its size on the wire */
+#define TW_I32_SZ 4    /* int or enum */
+#define TW_F64_SZ 8    /* double */
+#define TW_CHR_SZ 1    /* char */
+#define TW_BIT_SZ 1    /* 1-bit bitfield, sent as 0 or 1 */
+#define TW_STR8_SZ 8   /* char[8] */
+#define TW_NOW_SZ (TW_NOW(TW_SUBSIZE) 0)
+#define TW_AXES_SZ (TW_AXES(TW_SUBSIZE) 0)
+#define TW_MOTORS_SZ (TEL_NM * (TW_MOTOR(TW_SUBSIZE) 0))
+#define TW_SIZE(type, name) TW_##type##_SZ +
+#define TW_SUBSIZE(type, name) TW_##type##_SZ + /* N.B. macros can't recurse */
+
+/* Now */
+#define TW_NOW(X)                                                                                                      \
+    X(F64, n_mjd)                                                                                                      \
+    X(F64, n_lat)                                                                                                      \
+    X(F64, n_lng)                                                                                                      \
+    X(F64, n_tz)                                                                                                       \
+    X(F64, n_temp)                                                                                                     \
+    X(F64, n_pressure)                                                                                                 \
+    X(F64, n_elev)                                                                                                     \
+    X(F64, n_dip)                                                                                                      \
+    X(F64, n_epoch)                                                                                                    \
+    X(STR8, n_tznm)
+
+/* TelAxes */
+#define TW_AXES(X)                                                                                                     \
+    X(BIT, GERMEQ)                                                                                                     \
+    X(BIT, GERMEQ_FLIP)                                                                                                \
+    X(BIT, ZENFLIP)                                                                                                    \
+    X(F64, HT)                                                                                                         \
+    X(F64, DT)                                                                                                         \
+    X(F64, XP)                                                                                                         \
+    X(F64, YC)                                                                                                         \
+    X(F64, NP)                                                                                                         \
+    X(F64, R0)                                                                                                         \
+    X(F64, hneglim)                                                                                                    \
+    X(F64, hposlim)
+
+/* MotorInfo, sent TEL_NM times */
+#define TW_MOTOR(X)                                                                                                    \
+    X(CHR, axis)                                                                                                       \
+    X(BIT, have)                                                                                                       \
+    X(BIT, xtrack)                                                                                                     \
+    X(BIT, haveenc)                                                                                                    \
+    X(BIT, enchome)                                                                                                    \
+    X(BIT, havelim)                                                                                                    \
+    X(BIT, posside)                                                                                                    \
+    X(BIT, homelow)                                                                                                    \
+    X(BIT, homing)                                                                                                     \
+    X(BIT, limiting)                                                                                                   \
+    X(BIT, ishomed)                                                                                                    \
+    X(I32, step)                                                                                                       \
+    X(I32, sign)                                                                                                       \
+    X(I32, estep)                                                                                                      \
+    X(I32, esign)                                                                                                      \
+    X(F64, limmarg)                                                                                                    \
+    X(F64, maxvel)                                                                                                     \
+    X(F64, maxacc)                                                                                                     \
+    X(F64, slimacc)                                                                                                    \
+    X(F64, poslim)                                                                                                     \
+    X(F64, neglim)                                                                                                     \
+    X(F64, trencwt)                                                                                                    \
+    X(F64, df)                                                                                                         \
+    X(F64, cvel)                                                                                                       \
+    X(F64, cpos)                                                                                                       \
+    X(F64, dpos)                                                                                                       \
+    X(I32, raw)
+
+/* TelStatShm itself */
+#define TW_TOP(X)                                                                                                      \
+    X(I32, telescoped_pid)                                                                                             \
+    X(NOW, now)                                                                                                        \
+    X(I32, dt)                                                                                                         \
+    X(F64, CJ2kRA)                                                                                                     \
+    X(F64, CJ2kDec)                                                                                                    \
+    X(F64, CARA)                                                                                                       \
+    X(F64, CAHA)                                                                                                       \
+    X(F64, CADec)                                                                                                      \
+    X(F64, Calt)                                                                                                       \
+    X(F64, Caz)                                                                                                        \
+    X(F64, CPA)                                                                                                        \
+    X(F64, Clst)                                                                                                       \
+    X(F64, DJ2kRA)                                                                                                     \
+    X(F64, DJ2kDec)                                                                                                    \
+    X(F64, DARA)                                                                                                       \
+    X(F64, DAHA)                                                                                                       \
+    X(F64, DADec)                                                                                                      \
+    X(F64, Dalt)                                                                                                       \
+    X(F64, Daz)                                                                                                        \
+    X(F64, DPA)                                                                                                        \
+    X(F64, mdha)                                                                                                       \
+    X(F64, mddec)                                                                                                      \
+    X(F64, jdha)                                                                                                       \
+    X(F64, jddec)                                                                                                      \
+    X(MOTORS, minfo)                                                                                                   \
+    X(AXES, tax)                                                                                                       \
+    X(I32, telstate)                                                                                                   \
+    X(I32, telstateidx)                                                                                                \
+    X(I32, jogging_ison)
+
+/* bytes in one encoding */
+#define TELWIRE_LEN (TW_TOP(TW_SIZE) 0)
+
+/* telwire.c */
+extern void telwire_encode(TelStatShm *tp, unsigned char *buf);
+extern void telwire_decode(unsigned char *buf, TelStatShm *tp);
+extern unsigned int telwire_layout(void);
+
+#endif // TELWIRE_H
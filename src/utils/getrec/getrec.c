@@ -0,0 +1,105 @@
+/*
+    Main program to print the state of the telescope at past times from
+    the telemetry archive kept by telrecd, one line per record
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "circum.h"
+#include "telstatshm.h"
+#include "telrec.h"
+
+#define MJDOFF (MJD0 - 2400000.5) /* n_mjd + MJDOFF = MJD */
+
+static void usage(char *me);
+static int prRec(double n_mjd, TelStatShm *tp, void *arg);
+
+int main(int argc, char **argv)
+{
+    char *dir = NULL;
+    double t0, t1;
+    TelRec *trp;
+    TelStatShm t;
+    int i, nt = 0;
+    double ts[2];
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (argv[i][0] != '-' && nt < 2)
+            ts[nt++] = atof(argv[i]);
+        else
+            usage(argv[0]);
+    }
+    if (nt == 0)
+        usage(argv[0]);
+    t0 = ts[0] - MJDOFF;
+    t1 = nt > 1 ? ts[1] - MJDOFF : t0;
+
+    trp = telrec_open(dir, 0);
+    if (!trp)
+    {
+        if (errno == EPROTO)
+            fprintf(stderr, "%s: not version %d\n", dir ? dir : TELREC_DIR, TELREC_VERSION);
+        else
+            perror(dir ? dir : TELREC_DIR);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("#%15s %5s %12s %12s %12s %12s", "MJD", "state", "CJ2kRA", "CJ2kDec", "Calt", "Caz");
+    for (i = 0; i < TEL_NM; i++)
+        printf(" %10s %12s %12s", "raw", "cpos", "dpos");
+    printf("\n");
+
+    if (nt == 1)
+    {
+        /* state in effect then */
+        double n_mjd;
+
+        if (telrec_find(trp, t0, &t, &n_mjd) < 0)
+        {
+            fprintf(stderr, "No records before %.8f\n", ts[0]);
+            exit(EXIT_FAILURE);
+        }
+        prRec(n_mjd, &t, NULL);
+    }
+    else if (telrec_range(trp, t0, t1, prRec, NULL) == 0)
+    {
+        fprintf(stderr, "No records from %.8f to %.8f\n", ts[0], ts[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    telrec_close(trp);
+    exit(EXIT_SUCCESS);
+}
+
+static void usage(char *me)
+{
+    fprintf(stderr, "Syntax: %s [-d dir] mjd [mjd2]\n", me);
+    fprintf(stderr, " mjd:      print the last record at or before this MJD\n");
+    fprintf(stderr, " mjd mjd2: print all records from mjd through mjd2\n");
+    fprintf(stderr, " -d:       archive directory, default $TELHOME/%s\n", TELREC_DIR);
+    exit(EXIT_FAILURE);
+}
+
+/* print one record on one line, positions in rads */
+static int prRec(double n_mjd, TelStatShm *tp, void *arg)
+{
+    int i;
+
+    printf("%16.8f %5d %12.9f %12.9f %12.9f %12.9f", n_mjd + MJDOFF, tp->telstate, tp->CJ2kRA, tp->CJ2kDec, tp->Calt,
+           tp->Caz);
+    for (i = 0; i < TEL_NM; i++)
+    {
+        MotorInfo *mip = &tp->minfo[i];
+        printf(" %10d %12.9f %12.9f", mip->raw, mip->cpos, mip->dpos);
+    }
+    printf("\n");
+    return (0);
+}
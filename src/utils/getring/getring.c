@@ -0,0 +1,104 @@
+/*
+    Main program to print the per-cycle telemetry that telescoped keeps in
+    the TELRINGKEY shared memory ring, one line per control cycle
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "P_.h"
+#include "astro.h"
+#include "telring.h"
+
+#define FOLLOWMS 10 /* how often to look for new records with -f, ms */
+
+static void usage(char *me);
+static void prRec(TelRingRec *rp);
+
+int main(int argc, char **argv)
+{
+    TelRing *trp;
+    TelRingRec r;
+    uint64_t cursor, head;
+    long count = 100;
+    int follow = 0;
+    int i, s;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+            follow = 1;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            count = atol(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+    if (count < 0)
+        usage(argv[0]);
+
+    trp = telring_open(0);
+    if (!trp)
+    {
+        if (errno == EPROTO)
+            fprintf(stderr, "TELRINGKEY: not version %d\n", TELRING_VERSION);
+        else
+            perror("TELRINGKEY");
+        exit(EXIT_FAILURE);
+    }
+
+    /* start count back from the latest */
+    head = telring_head(trp);
+    cursor = head > (uint64_t)count ? head - count : 0;
+
+    printf("#%15s %5s %10s %10s", "MJD", "state", "mdha", "mddec");
+    for (i = 0; i < TEL_NM; i++)
+        printf(" %10s %12s %12s %12s", "raw", "cpos", "dpos", "cvel");
+    printf("\n");
+
+    while (1)
+    {
+        while ((s = telring_read(trp, &cursor, &r)) != 0)
+        {
+            if (s < 0)
+                fprintf(stderr, "Missed records, resuming at %llu\n", (unsigned long long)cursor);
+            else
+                prRec(&r);
+        }
+
+        if (!follow)
+            break;
+
+        fflush(stdout);
+        {
+            struct timespec ts = {0, FOLLOWMS * 1000000};
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+static void usage(char *me)
+{
+    fprintf(stderr, "Syntax: %s [-f] [-n count]\n", me);
+    fprintf(stderr, " -f: keep printing new records as they arrive\n");
+    fprintf(stderr, " -n: start this many records back, default 100\n");
+    exit(EXIT_FAILURE);
+}
+
+/* print one record on one line, positions in rads */
+static void prRec(TelRingRec *rp)
+{
+    int i;
+
+    printf("%16.8f %5d %10.3e %10.3e", rp->n_mjd + MJD0 - 2400000.5, rp->telstate, rp->mdha, rp->mddec);
+    for (i = 0; i < TEL_NM; i++)
+    {
+        TelRingMot *rmp = &rp->mot[i];
+        printf(" %10d %12.9f %12.9f %12.9f", rmp->raw, rmp->cpos, rmp->dpos, rmp->cvel);
+    }
+    printf("\n");
+}
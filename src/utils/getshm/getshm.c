@@ -1,114 +1,665 @@
 /*
     Main program to read the Talon shared memory and print all the requested
     information as formatted strings, suitable for FITS headers
+
+    With -b or -d we stay running and answer one request per line, from
+    stdin or from clients of a unix socket. Each request is blank for the
+    state now, one MJD for the state interpolated to then, or the start and
+    end MJD of an exposure for the positions averaged over it. Each reply
+    is the header lines followed by a line holding just END. The last
+    HISTSECS of history is kept in memory, so ask for an exposure when it
+    has ended but not long after; a time outside that is answered ERROR.
 */
 
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "P_.h"
 #include "astro.h"
+#include "telenv.h"
 #include "telstatshm.h"
 
+#define DEFSOCK "comm/getshm.sock" /* default socket, from TELHOME */
+#define HISTSECS 3600              /* secs of history kept */
+#define HISTMS 250                 /* least ms between snapshots kept */
+#define HISTN (HISTSECS * 1000 / HISTMS + 2) /* snapshots of history kept */
+#define MAXGAP 2.0                 /* most secs a request may be after the latest */
+#define MAXCLIENTS 64              /* most socket clients at once */
+#define REQLEN 128                 /* longest request line */
+#define REPLEN 4096                /* longest reply */
+#define MJDOFF (MJD0 - 2400000.5)  /* standard MJD - n_mjd */
+
+/* one socket client */
+typedef struct
+{
+    int fd;            /* connection, or -1 if unused */
+    char in[REQLEN];   /* partial request */
+    int inlen;         /* bytes in in[] */
+} Client;
+
 TelStatShm *init_shm(void);
+static void usage(char *me);
+static int fmtHeader(char *buf, TelStatShm *tp, double t0, double t1);
+static void *histWatcher(void *dummy);
+static void startHistory(void);
+static int answer(char *req, char *rep);
+static void histAdd(TelStatShm *tp);
+static int expoMean(double t0, double t1, TelStatShm *out);
+static int histFind(double t);
+static double interp(double t, int f, double near);
+static void batchMode(void);
+static void daemonMode(char *path);
+static int setupSocket(char *path);
+static void readClient(Client *cp);
+static int writeAll(int fd, char *buf, int n);
 
-TelStatShm *init_shm()
+/* the doubles averaged over an exposure, and whether each wraps at 2*PI */
+#define AVGF(name, wrap) {offsetof(TelStatShm, name), wrap}
+static struct
 {
-    int shmid;
-    long addr;
+    int off;
+    int wrap;
+} avgf[] = {
+    AVGF(CJ2kRA, 1),
+    AVGF(CJ2kDec, 0),
+    AVGF(CARA, 1),
+    AVGF(CAHA, 1),
+    AVGF(CADec, 0),
+    AVGF(Calt, 0),
+    AVGF(Caz, 1),
+    AVGF(minfo[TEL_HM].cpos, 0),
+    AVGF(minfo[TEL_DM].cpos, 0),
+    AVGF(minfo[TEL_OM].cpos, 0),
+};
+#define NAVGF ((int)(sizeof(avgf) / sizeof(avgf[0])))
+#define FIELD(tp, f) (*(double *)((char *)(tp) + avgf[f].off))
+#define HIST(i) hist[(hist0 + (i)) % HISTN] /* i'th oldest snapshot */
 
-    shmid = shmget(TELSTATSHMKEY, sizeof(TelStatShm), 0);
-    if (shmid < 0)
-    {
-        perror("shmget TELSTATSHMKEY");
-        exit(EXIT_FAILURE);
-    }
+static TelStatShm *liveshmp;      /* the real shm */
+static TelStatShm *hist;          /* ring of HISTN recent snapshots */
+static int nhist;                 /* snapshots in hist[], up to HISTN */
+static int hist0;                 /* index of oldest in hist[] */
+static pthread_mutex_t histlock = PTHREAD_MUTEX_INITIALIZER;
+
+TelStatShm *init_shm()
+{
+    TelStatShm *tp = telshm_attach(0, NULL);
 
-    addr = (long)shmat(shmid, (void *)0, 0);
-    if (addr == -1)
+    if (!tp)
     {
-        perror("shmat TELSTATSHMKEY");
+        fprintf(stderr, "TelStatShm: %s\n", telshm_error());
         exit(EXIT_FAILURE);
     }
 
-    return (TelStatShm *)addr;
+    return (tp);
 }
 
 int main(int argc, char **argv)
 {
-    char buf[128];
-    double lst, fupos;
+    char buf[REPLEN];
     long maxtime = 90;
-    TelStatShm *telstatshmp;
+    double waitsecs = -1;
+    TelStatShm shm;
+    char *me = argv[0];
+    char *sockpath = NULL;
+    int bflag = 0;
 
+    if (argc >= 2 && strcmp(argv[1], "-b") == 0)
+    {
+        bflag = 1;
+        argc -= 1;
+        argv += 1;
+    }
+    else if (argc >= 2 && strcmp(argv[1], "-d") == 0)
+    {
+        /* optional socket path */
+        sockpath = DEFSOCK;
+        if (argc >= 3 && argv[2][0] != '-' && strspn(argv[2], "0123456789") != strlen(argv[2]))
+        {
+            sockpath = argv[2];
+            argc -= 1;
+            argv += 1;
+        }
+        argc -= 1;
+        argv += 1;
+    }
+    else if (argc >= 3 && strcmp(argv[1], "-w") == 0)
+    {
+        /* wait for a change first */
+        waitsecs = atof(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
     if (argc == 2)
     {
         maxtime = atol(argv[1]);
     }
-    if ((argc > 2) || (maxtime == 0L))
+    if ((argc > 2) || (maxtime == 0L) || (waitsecs == 0))
+        usage(me);
+
+    liveshmp = init_shm();
+
+    if (bflag)
+        batchMode();
+    if (sockpath)
+        daemonMode(sockpath);
+
+    if (waitsecs > 0)
     {
-        printf("Syntax: %s [max_time_for_meteo]\n", argv[0]);
-        exit(EXIT_FAILURE);
+        unsigned int gen = liveshmp->gen;
+        (void)telshm_wait(liveshmp, &gen, 0, (int)(waitsecs * 1000));
     }
 
-    telstatshmp = init_shm();
-
-    printf("MJD-OBS = %16.8lf ", telstatshmp->now.n_mjd + MJD0 - 2400000.5);
-    printf("/ Modified Julian Day of Talon variables\n");
-    now_lst(&telstatshmp->now, &lst);
-    fs_sexa(buf, lst, 2, 3600);
-    printf("LST     = %s ", buf);
-    printf("/ Local sidereal time\n");
-    fs_sexa(buf, raddeg(telstatshmp->now.n_lat), 3, 3600);
-    printf("LATITUDE= %s ", buf);
-    printf("/ Telescope latitude (degrees +N)\n");
-    fs_sexa(buf, raddeg(telstatshmp->now.n_lng), 4, 3600);
-    printf("LONGITUD= %s ", buf);
-    printf("/ Telescope longitude (degrees +E)\n");
-    fs_sexa(buf, raddeg(telstatshmp->Calt), 3, 3600);
-    printf("ELEVATIO= %s ", buf);
-    printf("/ Elevation at MJD-OBS (degrees)\n");
-    fs_sexa(buf, raddeg(telstatshmp->Caz), 3, 3600);
-    printf("AZIMUTH = %s ", buf);
-    printf("/ Azimuth at MJD-OBS (degrees E of N)\n");
-    fs_sexa(buf, radhr(telstatshmp->CAHA), 3, 360000);
-    printf("HA      = %s ", buf);
-    printf("/ Hour Angle at MJD-OBS\n");
-    fs_sexa(buf, radhr(telstatshmp->CARA), 3, 360000);
-    printf("RAEOD   = %s ", buf);
-    printf("/ Apparent RA at MJD-OBS\n");
-    fs_sexa(buf, raddeg(telstatshmp->CADec), 3, 36000);
-    printf("DECEOD  = %s ", buf);
-    printf("/ Apparent Dec at MJD-OBS\n");
-    fs_sexa(buf, radhr(telstatshmp->CJ2kRA), 3, 360000);
-    printf("RA      = %s ", buf);
-    printf("/ J2000 RA at MJD-OBS\n");
-    fs_sexa(buf, raddeg(telstatshmp->CJ2kDec), 3, 36000);
-    printf("DEC     = %s ", buf);
-    printf("/ J2000 Dec at MJD-OBS\n");
-    fs_sexa(buf, radhr(telstatshmp->DJ2kRA), 3, 36000);
-    printf("OBJRA   = %s ", buf);
-    printf("/ Target RA in J2000\n");
-    fs_sexa(buf, raddeg(telstatshmp->DJ2kDec), 3, 36000);
-    printf("OBJDEC  = %s ", buf);
-    printf("/ Target Dec in J2000\n");
-    printf("EQUINOX = 2000.0 ");
-    printf("/ Equinox for RA and Dec (in years)\n");
-    printf("RAWHENC = %lf ", telstatshmp->minfo[TEL_HM].cpos);
-    printf("/ HA encoder at MJD-OBS (radians)\n");
-    printf("RAWDENC = %lf ", telstatshmp->minfo[TEL_DM].cpos);
-    printf("/ Dec encoder at MJD-OBS (radians)\n");
-    if (telstatshmp->minfo[TEL_OM].have)
-    {
-        MotorInfo *mip = &telstatshmp->minfo[TEL_OM];
-        printf("RAWOSTP = %lf ", mip->cpos);
-        printf("/ Focus encoder at MJD-OBS (radians)\n");
+    /* work from a consistent copy so all values are from the same moment */
+    if (telshm_snapshot(liveshmp, &shm) < 0)
+        fprintf(stderr, "Warning: telescoped did not finish an update\n");
+
+    fmtHeader(buf, &shm, 0, 0);
+    fputs(buf, stdout);
+
+    exit(EXIT_SUCCESS);
+}
+
+static void usage(char *me)
+{
+    printf("Syntax: %s [-w max_secs_to_wait_for_change] [max_time_for_meteo]\n", me);
+    printf("        %s -b [max_time_for_meteo]\n", me);
+    printf("        %s -d [socket] [max_time_for_meteo]\n", me);
+    printf(" -b: answer requests on stdin\n");
+    printf(" -d: answer requests on unix socket, default $TELHOME/%s\n", DEFSOCK);
+    printf(" each request is a line: [mjd_start [mjd_end]]\n");
+    exit(EXIT_FAILURE);
+}
+
+/* format the header for *tp into buf[REPLEN], return its length.
+ * if t1 > 0 *tp holds the mean over the exposure t0..t1, else it is the
+ * state at one moment.
+ */
+static int fmtHeader(char *buf, TelStatShm *tp, double t0, double t1)
+{
+    char *at = t1 > 0 ? "over exposure" : "at MJD-OBS";
+    char *bp = buf;
+    char sexa[64];
+    double lst, fupos;
+
+    if (t1 > 0)
+    {
+        bp += sprintf(bp, "MJD-OBS = %16.8lf ", t0);
+        bp += sprintf(bp, "/ Modified Julian Day of exposure start\n");
+        bp += sprintf(bp, "MJD-END = %16.8lf ", t1);
+        bp += sprintf(bp, "/ Modified Julian Day of exposure end\n");
+    }
+    else
+    {
+        bp += sprintf(bp, "MJD-OBS = %16.8lf ", tp->now.n_mjd + MJDOFF);
+        bp += sprintf(bp, "/ Modified Julian Day of Talon variables\n");
+    }
+    now_lst(&tp->now, &lst);
+    fs_sexa(sexa, lst, 2, 3600);
+    bp += sprintf(bp, "LST     = %s ", sexa);
+    bp += sprintf(bp, "/ Local sidereal time%s\n", t1 > 0 ? " at mid-exposure" : "");
+    fs_sexa(sexa, raddeg(tp->now.n_lat), 3, 3600);
+    bp += sprintf(bp, "LATITUDE= %s ", sexa);
+    bp += sprintf(bp, "/ Telescope latitude (degrees +N)\n");
+    fs_sexa(sexa, raddeg(tp->now.n_lng), 4, 3600);
+    bp += sprintf(bp, "LONGITUD= %s ", sexa);
+    bp += sprintf(bp, "/ Telescope longitude (degrees +E)\n");
+    fs_sexa(sexa, raddeg(tp->Calt), 3, 3600);
+    bp += sprintf(bp, "ELEVATIO= %s ", sexa);
+    bp += sprintf(bp, "/ Elevation %s (degrees)\n", at);
+    fs_sexa(sexa, raddeg(tp->Caz), 3, 3600);
+    bp += sprintf(bp, "AZIMUTH = %s ", sexa);
+    bp += sprintf(bp, "/ Azimuth %s (degrees E of N)\n", at);
+    fs_sexa(sexa, radhr(tp->CAHA), 3, 360000);
+    bp += sprintf(bp, "HA      = %s ", sexa);
+    bp += sprintf(bp, "/ Hour Angle %s\n", at);
+    fs_sexa(sexa, radhr(tp->CARA), 3, 360000);
+    bp += sprintf(bp, "RAEOD   = %s ", sexa);
+    bp += sprintf(bp, "/ Apparent RA %s\n", at);
+    fs_sexa(sexa, raddeg(tp->CADec), 3, 36000);
+    bp += sprintf(bp, "DECEOD  = %s ", sexa);
+    bp += sprintf(bp, "/ Apparent Dec %s\n", at);
+    fs_sexa(sexa, radhr(tp->CJ2kRA), 3, 360000);
+    bp += sprintf(bp, "RA      = %s ", sexa);
+    bp += sprintf(bp, "/ J2000 RA %s\n", at);
+    fs_sexa(sexa, raddeg(tp->CJ2kDec), 3, 36000);
+    bp += sprintf(bp, "DEC     = %s ", sexa);
+    bp += sprintf(bp, "/ J2000 Dec %s\n", at);
+    fs_sexa(sexa, radhr(tp->DJ2kRA), 3, 36000);
+    bp += sprintf(bp, "OBJRA   = %s ", sexa);
+    bp += sprintf(bp, "/ Target RA in J2000\n");
+    fs_sexa(sexa, raddeg(tp->DJ2kDec), 3, 36000);
+    bp += sprintf(bp, "OBJDEC  = %s ", sexa);
+    bp += sprintf(bp, "/ Target Dec in J2000\n");
+    bp += sprintf(bp, "EQUINOX = 2000.0 ");
+    bp += sprintf(bp, "/ Equinox for RA and Dec (in years)\n");
+    bp += sprintf(bp, "RAWHENC = %lf ", tp->minfo[TEL_HM].cpos);
+    bp += sprintf(bp, "/ HA encoder %s (radians)\n", at);
+    bp += sprintf(bp, "RAWDENC = %lf ", tp->minfo[TEL_DM].cpos);
+    bp += sprintf(bp, "/ Dec encoder %s (radians)\n", at);
+    if (tp->minfo[TEL_OM].have)
+    {
+        MotorInfo *mip = &tp->minfo[TEL_OM];
+        bp += sprintf(bp, "RAWOSTP = %lf ", mip->cpos);
+        bp += sprintf(bp, "/ Focus encoder %s (radians)\n", at);
         fupos = mip->step / ((2 * PI) * mip->focscale) * mip->cpos;
-        printf("FOCUSPOS = %lf ", fupos);
-        printf("/ Focus position from home (microns)\n");
+        bp += sprintf(bp, "FOCUSPOS = %lf ", fupos);
+        bp += sprintf(bp, "/ Focus position from home (microns)\n");
+    }
+
+    return (bp - buf);
+}
+
+/* thread to add a snapshot to hist[] each time telescoped changes shm */
+static void *histWatcher(void *dummy)
+{
+    unsigned int gen = liveshmp->gen;
+    TelStatShm t;
+
+    while (1)
+    {
+        (void)telshm_snapshot(liveshmp, &t);
+
+        pthread_mutex_lock(&histlock);
+        histAdd(&t);
+        pthread_mutex_unlock(&histlock);
+
+        (void)telshm_wait(liveshmp, &gen, 0, 1000);
+    }
+
+    return (NULL);
+}
+
+static void startHistory()
+{
+    pthread_t tid;
+
+    if (!(hist = (TelStatShm *)malloc(HISTN * sizeof(TelStatShm))))
+    {
+        fprintf(stderr, "No memory for history\n");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_create(&tid, NULL, histWatcher, NULL) != 0)
+    {
+        fprintf(stderr, "Can not start history thread\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(tid);
+}
+
+/* answer one request line, put reply in rep[REPLEN] and return its length */
+static int answer(char *req, char *rep)
+{
+    double t0, t1;
+    TelStatShm t;
+    int n;
+
+    switch (sscanf(req, "%lf %lf", &t0, &t1))
+    {
+    case 2:
+        if (t1 < t0)
+        {
+            n = sprintf(rep, "ERROR exposure ends before it starts\n");
+            break;
+        }
+        if (expoMean(t0 - MJDOFF, t1 - MJDOFF, &t) < 0)
+        {
+            n = sprintf(rep, "ERROR exposure is not within history\n");
+            break;
+        }
+        n = fmtHeader(rep, &t, t0, t1);
+        break;
+    case 1:
+        if (expoMean(t0 - MJDOFF, t0 - MJDOFF, &t) < 0)
+        {
+            n = sprintf(rep, "ERROR time is not within history\n");
+            break;
+        }
+        n = fmtHeader(rep, &t, 0, 0);
+        break;
+    case 0:
+        n = sprintf(rep, "ERROR request is not [mjd_start [mjd_end]]\n");
+        break;
+    default:
+        (void)telshm_snapshot(liveshmp, &t);
+        n = fmtHeader(rep, &t, 0, 0);
+        break;
+    }
+
+    n += sprintf(rep + n, "END\n");
+    return (n);
+}
+
+/* add *tp to hist[] if it is newer than the latest there. that replaces
+ * the latest if it is within HISTMS of the one before, so hist[] always
+ * ends with the newest state yet spans HISTSECS.
+ * N.B. caller holds histlock.
+ */
+static void histAdd(TelStatShm *tp)
+{
+    if (nhist > 0 && tp->now.n_mjd <= HIST(nhist - 1).now.n_mjd)
+        return;
+
+    if (nhist < 2 || (tp->now.n_mjd - HIST(nhist - 2).now.n_mjd) * SPD * 1000 >= HISTMS)
+    {
+        if (nhist < HISTN)
+            nhist++;
+        else
+            hist0 = (hist0 + 1) % HISTN;
+    }
+    HIST(nhist - 1) = *tp;
+}
+
+/* fill *out with the state over n_mjd t0..t1 from hist[]. the fields in
+ * avgf[] are time averages of the values interpolated linearly between
+ * snapshots, all else is from the snapshot nearest mid-exposure.
+ * after the last snapshot, and for MAXGAP at most, the state is taken to
+ * be as it shows. if t0 == t1 this just interpolates to t0.
+ * return 0 if ok, else -1 if hist[] does not cover t0..t1.
+ */
+static int expoMean(double t0, double t1, TelStatShm *out)
+{
+    double tm = (t0 + t1) / 2;
+    double sum[NAVGF], ref[NAVGF], prevv[NAVGF];
+    double t, prevt;
+    int i, f, k;
+
+    /* hist[] may not have the very latest change yet, so add it */
+    (void)telshm_snapshot(liveshmp, out);
+
+    pthread_mutex_lock(&histlock);
+    histAdd(out);
+
+    /* too old to have, or still to come */
+    if (t0 < HIST(0).now.n_mjd || t1 > HIST(nhist - 1).now.n_mjd + MAXGAP / SPD)
+    {
+        pthread_mutex_unlock(&histlock);
+        return (-1);
+    }
+
+    /* non-averaged fields from the snapshot nearest mid-exposure */
+    k = histFind(tm);
+    if (k < nhist - 1 && HIST(k + 1).now.n_mjd - tm < tm - HIST(k).now.n_mjd)
+        k++;
+    *out = HIST(k);
+
+    /* trapezoids between t0, each snapshot within, and t1.
+     * angles are unwrapped relative to their value at t0.
+     */
+    k = histFind(t0);
+    for (f = 0; f < NAVGF; f++)
+    {
+        ref[f] = prevv[f] = interp(t0, f, FIELD(&HIST(k), f));
+        sum[f] = 0;
+    }
+    prevt = t0;
+    for (i = histFind(t0) + 1; i <= nhist; i++)
+    {
+        t = i < nhist ? HIST(i).now.n_mjd : t1;
+        if (t <= prevt)
+            continue;
+        if (t > t1)
+            t = t1;
+        for (f = 0; f < NAVGF; f++)
+        {
+            double v = interp(t, f, ref[f]);
+
+            sum[f] += (v + prevv[f]) / 2 * (t - prevt);
+            prevv[f] = v;
+        }
+        prevt = t;
+        if (t == t1)
+            break;
+    }
+
+    pthread_mutex_unlock(&histlock);
+
+    /* a mean, or the one interpolated value if no time passed */
+    for (f = 0; f < NAVGF; f++)
+    {
+        double m = t1 > t0 ? sum[f] / (t1 - t0) : ref[f];
+
+        if (avgf[f].wrap)
+        {
+            /* back into the range of the original */
+            double lo = ref[f] < 0 ? -PI : 0;
+            m -= 2 * PI * floor((m - lo) / (2 * PI));
+        }
+        FIELD(out, f) = m;
+    }
+    out->now.n_mjd = tm;
+
+    return (0);
+}
+
+/* index of the last snapshot in hist[] at or before n_mjd t, else 0.
+ * N.B. caller holds histlock.
+ */
+static int histFind(double t)
+{
+    int lo = 0, hi = nhist - 1;
+
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+
+        if (HIST(mid).now.n_mjd <= t)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return (lo);
+}
+
+/* field f interpolated to n_mjd t from hist[]. if it is an angle, the
+ * result is within PI of near.
+ * N.B. caller holds histlock.
+ */
+static double interp(double t, int f, double near)
+{
+    int k = histFind(t);
+    double v = FIELD(&HIST(k), f);
+
+    if (k < nhist - 1 && t > HIST(k).now.n_mjd)
+    {
+        double ta = HIST(k).now.n_mjd;
+        double tb = HIST(k + 1).now.n_mjd;
+        double d = FIELD(&HIST(k + 1), f) - v;
+
+        if (avgf[f].wrap)
+            d -= 2 * PI * floor(d / (2 * PI) + 0.5);
+        v += d * (t - ta) / (tb - ta);
+    }
+    if (avgf[f].wrap)
+        v -= 2 * PI * floor((v - near) / (2 * PI) + 0.5);
+
+    return (v);
+}
+
+/* answer request lines on stdin until EOF */
+static void batchMode()
+{
+    char req[REQLEN], rep[REPLEN];
+
+    startHistory();
+
+    while (fgets(req, sizeof(req), stdin))
+    {
+        answer(req, rep);
+        fputs(rep, stdout);
+        fflush(stdout);
     }
 
     exit(EXIT_SUCCESS);
 }
+
+/* answer request lines from any number of clients of a unix socket */
+static void daemonMode(char *path)
+{
+    static Client clients[MAXCLIENTS];
+    struct pollfd pfds[MAXCLIENTS + 1];
+    int sockfd, i;
+
+    sockfd = setupSocket(path);
+    signal(SIGPIPE, SIG_IGN);
+    startHistory();
+
+    for (i = 0; i < MAXCLIENTS; i++)
+        clients[i].fd = -1;
+
+    while (1)
+    {
+        pfds[0].fd = sockfd;
+        pfds[0].events = POLLIN;
+        for (i = 0; i < MAXCLIENTS; i++)
+        {
+            pfds[i + 1].fd = clients[i].fd;
+            pfds[i + 1].events = POLLIN;
+        }
+
+        if (poll(pfds, MAXCLIENTS + 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < MAXCLIENTS; i++)
+            if (clients[i].fd >= 0 && pfds[i + 1].revents)
+                readClient(&clients[i]);
+
+        if (pfds[0].revents & POLLIN)
+        {
+            int fd = accept(sockfd, NULL, NULL);
+
+            if (fd < 0)
+                continue;
+            for (i = 0; i < MAXCLIENTS; i++)
+                if (clients[i].fd < 0)
+                    break;
+            if (i == MAXCLIENTS)
+            {
+                fprintf(stderr, "Too many clients\n");
+                close(fd);
+                continue;
+            }
+            clients[i].fd = fd;
+            clients[i].inlen = 0;
+        }
+    }
+}
+
+/* create and listen on the unix socket at path, replacing any old one.
+ * exit if trouble.
+ */
+static int setupSocket(char *path)
+{
+    struct sockaddr_un sun;
+    char fullpath[1024];
+    int fd;
+
+    if (path[0] == '/')
+        strcpy(fullpath, path);
+    else
+        telfixpath(fullpath, path);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(fullpath) >= sizeof(sun.sun_path))
+    {
+        fprintf(stderr, "%s: socket path too long\n", fullpath);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(sun.sun_path, fullpath);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    (void)unlink(fullpath);
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+    {
+        perror(fullpath);
+        exit(EXIT_FAILURE);
+    }
+    if (listen(fd, MAXCLIENTS) < 0)
+    {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+
+    return (fd);
+}
+
+/* read from a client and answer each whole request line.
+ * close the client on EOF, error or a line too long.
+ */
+static void readClient(Client *cp)
+{
+    char rep[REPLEN];
+    char *nl;
+    int n;
+
+    n = read(cp->fd, cp->in + cp->inlen, sizeof(cp->in) - 1 - cp->inlen);
+    if (n <= 0)
+    {
+        close(cp->fd);
+        cp->fd = -1;
+        return;
+    }
+    cp->inlen += n;
+    cp->in[cp->inlen] = '\0';
+
+    while ((nl = strchr(cp->in, '\n')))
+    {
+        *nl = '\0';
+        n = answer(cp->in, rep);
+        if (writeAll(cp->fd, rep, n) < 0)
+        {
+            close(cp->fd);
+            cp->fd = -1;
+            return;
+        }
+        cp->inlen -= nl + 1 - cp->in;
+        memmove(cp->in, nl + 1, cp->inlen + 1);
+    }
+
+    if (cp->inlen == sizeof(cp->in) - 1)
+    {
+        close(cp->fd);
+        cp->fd = -1;
+    }
+}
+
+/* write all n bytes of buf to fd, return 0 if ok else -1 */
+static int writeAll(int fd, char *buf, int n)
+{
+    while (n > 0)
+    {
+        int w = write(fd, buf, n);
+
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (-1);
+        }
+        buf += w;
+        n -= w;
+    }
+    return (0);
+}
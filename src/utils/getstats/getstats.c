@@ -0,0 +1,112 @@
+/*
+    Main program to print the control loop timing statistics kept by
+    telescoped in the TELSTATSKEY shared memory
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "telstats.h"
+
+static void usage(char *me);
+static void prSummary(TelStats *tsp);
+static void prBins(TelStatsStage *sp);
+
+int main(int argc, char **argv)
+{
+    TelStats *tsp;
+    char *stage = NULL;
+    int zero = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-z") == 0)
+            zero = 1;
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            stage = argv[++i];
+        else
+            usage(argv[0]);
+    }
+
+    tsp = telstats_open(0);
+    if (!tsp)
+    {
+        if (errno == EPROTO)
+            fprintf(stderr, "TELSTATSKEY: not version %d\n", TELSTATS_VERSION);
+        else
+            perror("TELSTATSKEY");
+        exit(EXIT_FAILURE);
+    }
+
+    if (stage)
+    {
+        for (i = 0; i < TS_NSTAGES; i++)
+            if (strcmp(tsp->stage[i].name, stage) == 0)
+                break;
+        if (i == TS_NSTAGES)
+        {
+            fprintf(stderr, "%s: no such stage\n", stage);
+            exit(EXIT_FAILURE);
+        }
+        prBins(&tsp->stage[i]);
+    }
+    else
+        prSummary(tsp);
+
+    if (zero)
+        telstats_zero(tsp);
+
+    exit(EXIT_SUCCESS);
+}
+
+static void usage(char *me)
+{
+    fprintf(stderr, "Syntax: %s [-b stage] [-z]\n", me);
+    fprintf(stderr, " -b: print each non-empty bin of the named stage\n");
+    fprintf(stderr, " -z: zero all counters after printing\n");
+    exit(EXIT_FAILURE);
+}
+
+/* print one line per stage, all times in microseconds */
+static void prSummary(TelStats *tsp)
+{
+    time_t t = (time_t)tsp->start;
+    int i;
+
+    printf("pid %d, since %s", (int)tsp->pid, ctime(&t));
+    printf("%-12s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "stage", "n", "last", "min", "mean", "p50", "p90", "p99",
+           "p99.9", "max");
+
+    for (i = 0; i < TS_NSTAGES; i++)
+    {
+        TelStatsStage *sp = &tsp->stage[i];
+
+        if (!sp->name[0])
+            continue;
+        printf("%-12s %9llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", sp->name, (unsigned long long)sp->n,
+               sp->last / 1e3, sp->min / 1e3, sp->n ? sp->sum / 1e3 / sp->n : 0.0, telstats_pct(sp, 50) / 1e3,
+               telstats_pct(sp, 90) / 1e3, telstats_pct(sp, 99) / 1e3, telstats_pct(sp, 99.9) / 1e3,
+               sp->max / 1e3);
+    }
+}
+
+/* print the range and count of each non-empty bin, microseconds */
+static void prBins(TelStatsStage *sp)
+{
+    uint64_t n = 0;
+    int i;
+
+    printf("%12s %12s %10s %7s\n", "from", "to", "count", "cum %");
+    for (i = 0; i < TS_NBINS; i++)
+    {
+        if (!sp->bin[i])
+            continue;
+        n += sp->bin[i];
+        printf("%12.3f %12.3f %10llu %7.3f\n", telstats_binlow(i) / 1e3, telstats_binlow(i + 1) / 1e3,
+               (unsigned long long)sp->bin[i], 100.0 * n / sp->n);
+    }
+}
@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -58,16 +59,25 @@
 Widget toplevel_w;
 XtAppContext app;
 char myclass[] = "XObs";
-TelStatShm *telstatshmp;
+TelStatShm *telstatshmp; /* our private copy, refreshed by periodic_check() */
 Obj sunobj, moonobj;
 int xobs_alone;
 
-#define SHMPOLL_PERIOD 100 /* statshm polling period, ms */
+#define SHMPOLL_PERIOD 100 /* statshm polling period, ms, and min between change updates */
+#define CLOCK_PERIOD 200   /* polling period once changes wake us, ms, just for the clock */
 
 static void chkDaemon(char *name, char *fifo, int required, int to);
 static void initShm(void);
 static void onsig(int sn);
 static void periodic_check(void);
+static void startShmWatch(void);
+static void *shmWatcher(void *dummy);
+static void shmChanged(XtPointer client, int *fdp, XtInputId *idp);
+
+static TelStatShm *liveshmp;           /* the real shared segment */
+static TelStatShm shmcopy;             /* consistent copy of it for telstatshmp */
+static int shmpoll_ms = SHMPOLL_PERIOD; /* current periodic_check() period */
+static int shmpipe[2];                 /* shmWatcher() writes here when shm changes */
 
 static char *progname;
 
@@ -122,8 +132,9 @@ int main(int ac, char *av[])
     if (xobs_alone)
         initPipes();
 
-    /* start a periodic timer */
+    /* start a periodic timer, and updates as soon as telescoped changes */
     periodic_check();
+    startShmWatch();
 
     /* up */
     XtRealizeWidget(toplevel_w);
@@ -150,26 +161,15 @@ void die()
 
 static void initShm()
 {
-    int shmid;
-    long addr;
-
-    shmid = shmget(TELSTATSHMKEY, sizeof(TelStatShm), 0);
-    if (shmid < 0)
-    {
-        perror("shmget TELSTATSHMKEY");
-        unlock_running(progname, 0);
-        exit(1);
-    }
-
-    addr = (long)shmat(shmid, (void *)0, 0);
-    if (addr == -1)
+    liveshmp = telshm_attach(0, NULL);
+    if (!liveshmp)
     {
-        perror("shmat TELSTATSHMKEY");
+        fprintf(stderr, "TelStatShm: %s\n", telshm_error());
         unlock_running(progname, 0);
         exit(1);
     }
-
-    telstatshmp = (TelStatShm *)addr;
+    telstatshmp = &shmcopy;
+    (void)telshm_snapshot(liveshmp, telstatshmp);
 }
 
 /* start the given daemon on the given channel if not already running.
@@ -228,6 +228,57 @@ static void onsig(int sn)
 
 static void periodic_check()
 {
+    (void)telshm_snapshot(liveshmp, telstatshmp);
+    updateStatus(0);
+    XtAppAddTimeOut(app, shmpoll_ms, (XtTimerCallbackProc)periodic_check, 0);
+}
+
+/* start a thread to tell us through shmpipe whenever telescoped changes
+ * something, so we need only poll slowly to keep the clock going.
+ * if trouble we just keep polling at the original rate.
+ */
+static void startShmWatch()
+{
+    pthread_t tid;
+
+    if (pipe(shmpipe) < 0)
+    {
+        daemonLog("shm watch pipe: %s\n", strerror(errno));
+        return;
+    }
+    if (pthread_create(&tid, NULL, shmWatcher, NULL) != 0)
+    {
+        daemonLog("shm watch thread failed\n");
+        close(shmpipe[0]);
+        close(shmpipe[1]);
+        return;
+    }
+    pthread_detach(tid);
+
+    XtAppAddInput(app, shmpipe[0], (XtPointer)XtInputReadMask, shmChanged, 0);
+    shmpoll_ms = CLOCK_PERIOD;
+}
+
+/* thread that waits for telescoped to change shm and says so on shmpipe.
+ * N.B. touches nothing else, all X work stays in the main thread.
+ */
+static void *shmWatcher(void *dummy)
+{
+    unsigned int gen = liveshmp->gen;
+
+    while (1)
+        if (telshm_wait(liveshmp, &gen, SHMPOLL_PERIOD, -1) > 0 && write(shmpipe[1], "", 1) < 0)
+            break;
+
+    return (NULL);
+}
+
+/* called by Xt when shmWatcher() says telescoped changed something */
+static void shmChanged(XtPointer client, int *fdp, XtInputId *idp)
+{
+    char buf[64];
+
+    (void)read(*fdp, buf, sizeof(buf));
+    (void)telshm_snapshot(liveshmp, telstatshmp);
     updateStatus(0);
-    XtAppAddTimeOut(app, SHMPOLL_PERIOD, (XtTimerCallbackProc)periodic_check, 0);
 }